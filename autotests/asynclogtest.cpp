@@ -0,0 +1,130 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/asynclogtest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "utils/asynclog.h"
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QThread>
+
+#include <memory>
+#include <vector>
+
+using namespace Kleo;
+
+namespace
+{
+
+QByteArray readFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+}
+
+class AsyncLogTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testLinesArePrefixed()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.filePath(QStringLiteral("log"));
+        {
+            AsyncLog log(fileName);
+            const auto channel = log.createChannel("one");
+            channel->write("first ", 6);
+            channel->write("line\nsecond line\n", 17);
+        }
+        QCOMPARE(readFile(fileName), QByteArray("one: first line\none: second line\n"));
+    }
+
+    void testReleasedChannelIsWrittenOut()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.filePath(QStringLiteral("log"));
+        AsyncLog log(fileName);
+        {
+            const auto channel = log.createChannel("gone");
+            channel->write("bye\n", 4);
+        }
+        QTRY_COMPARE(readFile(fileName), QByteArray("gone: bye\n"));
+    }
+
+    void testOverflowDropsMessages()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.filePath(QStringLiteral("log"));
+        {
+            AsyncLog log(fileName);
+            const auto channel = log.createChannel("c", 1024);
+            const QByteArray message(1000, 'x');
+            channel->write(message.constData(), message.size());
+            // doesn't fit anymore (unless the log was very quick)
+            channel->write(message.constData(), message.size());
+        }
+        const QByteArray contents = readFile(fileName);
+        QVERIFY(contents.startsWith("c: " + QByteArray(1000, 'x')));
+        QVERIFY(contents.contains("[1000 bytes of log messages dropped]\n") || contents.count('x') == 2000);
+    }
+
+    void testConcurrentChannels()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.filePath(QStringLiteral("log"));
+        const int numThreads = 4;
+        const int numLines = 10000;
+        {
+            AsyncLog log(fileName);
+            std::vector<std::unique_ptr<QThread>> threads;
+            for (int i = 0; i < numThreads; ++i) {
+                const auto channel = log.createChannel(QByteArray::number(i), 1024 * 1024);
+                threads.emplace_back(QThread::create([channel]() {
+                    for (int line = 0; line < numLines; ++line) {
+                        channel->write("line\n", 5);
+                    }
+                }));
+                threads.back()->start();
+            }
+            for (const auto &thread : threads) {
+                thread->wait();
+            }
+        }
+        const QList<QByteArray> lines = readFile(fileName).split('\n');
+        QCOMPARE(lines.size(), numThreads * numLines + 1);
+        for (int i = 0; i < numThreads; ++i) {
+            QCOMPARE(lines.count(QByteArray::number(i) + ": line"), numLines);
+        }
+    }
+
+    void testRotation()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.filePath(QStringLiteral("log"));
+        {
+            AsyncLog log(fileName, 100);
+            const auto channel = log.createChannel("c");
+            const QByteArray message = QByteArray(200, 'a') + '\n';
+            channel->write(message.constData(), message.size());
+            QTRY_VERIFY(QFile::exists(fileName + QLatin1String(".1")));
+            channel->write("b\n", 2);
+        }
+        QCOMPARE(readFile(fileName + QLatin1String(".1")), "c: " + QByteArray(200, 'a') + '\n');
+        QCOMPARE(readFile(fileName), QByteArray("c: b\n"));
+    }
+};
+
+QTEST_GUILESS_MAIN(AsyncLogTest)
+
+#include "asynclogtest.moc"
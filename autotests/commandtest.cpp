@@ -0,0 +1,146 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/commandtest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <libkleopatraclient/core/command.h>
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <memory>
+#include <vector>
+
+using namespace KleopatraClientCopy;
+
+namespace
+{
+
+class GetInfoVersionCommand : public Command
+{
+public:
+    explicit GetInfoVersionCommand(const QString &serverLocation)
+        : Command()
+    {
+        setServerLocation(serverLocation);
+        setCommand("GETINFO version");
+    }
+};
+
+// a minimal UI server that answers every command with OK, sending the
+// reply to the last command together with a trailing comment line
+class FakeServer : public QLocalServer
+{
+public:
+    explicit FakeServer(QObject *parent = nullptr)
+        : QLocalServer(parent)
+    {
+        connect(this, &QLocalServer::newConnection, this, [this]() {
+            while (QLocalSocket *const socket = nextPendingConnection()) {
+                connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+                connect(socket, &QIODevice::readyRead, socket, [socket]() {
+                    while (socket->canReadLine()) {
+                        const QByteArray line = socket->readLine().trimmed();
+                        if (line == "GETINFO pid") {
+                            socket->write("D 4242\nOK\n");
+                        } else if (line == "GETINFO version") {
+                            socket->write("D 3.1.0\nOK\n# bye\n");
+                        } else {
+                            socket->write("OK\n");
+                        }
+                    }
+                });
+                socket->write("OK Pleased to meet you\n");
+            }
+        });
+    }
+};
+
+}
+
+class CommandTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+#ifdef Q_OS_WIN
+        QSKIP("The UI server uses Assuan's socket emulation on Windows");
+#endif
+        QVERIFY(m_dir.isValid());
+        m_socketName = m_dir.filePath(QStringLiteral("S.uiserver"));
+        QVERIFY(m_server.listen(m_socketName));
+    }
+
+    void testStartInCurrentThread()
+    {
+        GetInfoVersionCommand cmd(m_socketName);
+        QSignalSpy startedSpy(&cmd, &Command::started);
+        QSignalSpy finishedSpy(&cmd, &Command::finished);
+
+        cmd.startInCurrentThread();
+        // the signals are always emitted from the event loop
+        QCOMPARE(startedSpy.count(), 0);
+        QCOMPARE(finishedSpy.count(), 0);
+
+        QVERIFY(finishedSpy.wait());
+        QCOMPARE(startedSpy.count(), 1);
+        QCOMPARE(finishedSpy.count(), 1);
+        QVERIFY2(!cmd.error(), qPrintable(cmd.errorString()));
+        QCOMPARE(cmd.serverPid(), qint64(4242));
+        QCOMPARE(cmd.receivedData(), QByteArray("3.1.0"));
+    }
+
+    void testWaitForFinished()
+    {
+        GetInfoVersionCommand cmd(m_socketName);
+        cmd.startInCurrentThread();
+        QVERIFY(cmd.waitForFinished(10000));
+        QVERIFY2(!cmd.error(), qPrintable(cmd.errorString()));
+        QCOMPARE(cmd.receivedData(), QByteArray("3.1.0"));
+    }
+
+    void testDeleteOnFinished()
+    {
+        QPointer<GetInfoVersionCommand> cmd = new GetInfoVersionCommand(m_socketName);
+        bool succeeded = false;
+        connect(cmd.data(), &Command::finished, this, [&cmd, &succeeded]() {
+            succeeded = !cmd->error();
+            delete cmd.data();
+        });
+        cmd->startInCurrentThread();
+        QTRY_VERIFY(cmd.isNull());
+        QVERIFY(succeeded);
+    }
+
+    void testConcurrentCommands()
+    {
+        std::vector<std::unique_ptr<GetInfoVersionCommand>> commands;
+        for (int i = 0; i < 20; ++i) {
+            commands.emplace_back(new GetInfoVersionCommand(m_socketName));
+            commands.back()->startInCurrentThread();
+        }
+        for (const auto &cmd : commands) {
+            QVERIFY(cmd->waitForFinished(10000));
+            QVERIFY2(!cmd->error(), qPrintable(cmd->errorString()));
+            QCOMPARE(cmd->receivedData(), QByteArray("3.1.0"));
+        }
+    }
+
+private:
+    QTemporaryDir m_dir;
+    QString m_socketName;
+    FakeServer m_server;
+};
+
+QTEST_GUILESS_MAIN(CommandTest)
+#include "commandtest.moc"
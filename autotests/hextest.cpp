@@ -0,0 +1,200 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/hextest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "utils/hex.h"
+
+#include <Libkleo/KleoException>
+
+#include <QByteArray>
+#include <QTest>
+
+#include <algorithm>
+#include <string>
+
+using namespace Kleo;
+
+namespace
+{
+
+// the byte-wise encoder formerly used by hexencode()
+std::string hexencode_bytewise(const std::string &in)
+{
+    std::string result;
+    result.reserve(3 * in.size());
+
+    static const char hex[] = "0123456789ABCDEF";
+
+    for (std::string::const_iterator it = in.begin(), end = in.end(); it != end; ++it)
+        switch (const unsigned char ch = *it) {
+        default:
+            if ((ch >= '!' && ch <= '~') || ch > 0xA0) {
+                result += ch;
+                break;
+            }
+            Q_FALLTHROUGH();
+        case ' ':
+            result += '+';
+            break;
+        case '"':
+        case '#':
+        case '$':
+        case '%':
+        case '\'':
+        case '+':
+        case '=':
+            result += '%';
+            result += hex[(ch & 0xF0) >> 4 ];
+            result += hex[(ch & 0x0F)      ];
+            break;
+        }
+
+    return result;
+}
+
+std::string all_bytes()
+{
+    std::string s;
+    for (int i = 0; i < 256; ++i) {
+        s += char(i);
+    }
+    return s;
+}
+
+// something like an audit log: long runs of clean text with some spaces and escapes
+std::string generate_log(int size)
+{
+    static const char line[] = "<tr><td>gpgsm: 2021-05-04 12:00:00 signature by \"Some One <one@example.net>\" is good; key 0123456789ABCDEF</td></tr>\n";
+    std::string s;
+    s.reserve(size);
+    while (int(s.size()) < size) {
+        s += line;
+    }
+    s.resize(size);
+    return s;
+}
+
+}
+
+class HexTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testEncode_data()
+    {
+        QTest::addColumn<QByteArray>("data");
+
+        QTest::newRow("empty") << QByteArray();
+        QTest::newRow("clean") << QByteArray("abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+        QTest::newRow("escapes") << QByteArray("\"#$%'+= \t\r\n");
+        QTest::newRow("all bytes") << QByteArray::fromStdString(all_bytes());
+        QTest::newRow("all bytes twice") << QByteArray::fromStdString(all_bytes() + all_bytes());
+        QTest::newRow("log") << QByteArray::fromStdString(generate_log(10000));
+        // escapes at every position of a SIMD block, and tails of every length
+        for (int i = 0; i < 70; ++i) {
+            QTest::newRow(qPrintable(QStringLiteral("escape at %1").arg(i)))
+                    << (QByteArray(i, 'a') + '%' + QByteArray(70 - i, 'b'));
+            QTest::newRow(qPrintable(QStringLiteral("length %1").arg(i))) << QByteArray(i, char(0xC3));
+        }
+    }
+
+    void testEncode()
+    {
+        QFETCH(QByteArray, data);
+
+        const std::string in = data.toStdString();
+        const std::string encoded = hexencode(in);
+        QCOMPARE(encoded, hexencode_bytewise(in));
+        // control characters and 0x7F..0xA0 are encoded lossily as '+'
+        const bool lossless = std::all_of(in.begin(), in.end(), [](unsigned char ch) {
+            return (ch >= ' ' && ch <= '~') || ch > 0xA0;
+        });
+        if (lossless) {
+            QCOMPARE(hexdecode(encoded), in);
+        }
+    }
+
+    void testDecode_data()
+    {
+        QTest::addColumn<QByteArray>("encoded");
+        QTest::addColumn<QByteArray>("decoded");
+
+        QTest::newRow("empty") << QByteArray("") << QByteArray("");
+        QTest::newRow("plain") << QByteArray("abc") << QByteArray("abc");
+        QTest::newRow("plus") << QByteArray("a+b") << QByteArray("a b");
+        QTest::newRow("upper hex") << QByteArray("%3D%2B") << QByteArray("=+");
+        QTest::newRow("lower hex") << QByteArray("%3d%2b") << QByteArray("=+");
+        QTest::newRow("long") << QByteArray(QByteArray(100, 'x') + "%25" + QByteArray(100, 'y'))
+                              << QByteArray(QByteArray(100, 'x') + "%" + QByteArray(100, 'y'));
+    }
+
+    void testDecode()
+    {
+        QFETCH(QByteArray, encoded);
+        QFETCH(QByteArray, decoded);
+
+        QCOMPARE(hexdecode(encoded), decoded);
+        QCOMPARE(hexdecode(encoded.toStdString()), decoded.toStdString());
+    }
+
+    void testDecodeErrors_data()
+    {
+        QTest::addColumn<QByteArray>("encoded");
+
+        QTest::newRow("truncated") << QByteArray("abc%4");
+        QTest::newRow("percent at end") << QByteArray(QByteArray(40, 'a') + '%');
+        QTest::newRow("invalid hex") << QByteArray("%4G");
+    }
+
+    void testDecodeErrors()
+    {
+        QFETCH(QByteArray, encoded);
+
+        QVERIFY_EXCEPTION_THROWN(hexdecode(encoded.toStdString()), Exception);
+    }
+
+    void testQByteArrayNotNull()
+    {
+        QVERIFY(!hexencode(QByteArray("")).isNull());
+        QVERIFY(hexencode(QByteArray()).isNull());
+    }
+
+    void benchmarkEncode_data()
+    {
+        QTest::addColumn<bool>("bytewise");
+
+        QTest::newRow("byte-wise") << true;
+        QTest::newRow("hexencode") << false;
+    }
+
+    void benchmarkEncode()
+    {
+        QFETCH(bool, bytewise);
+
+        const std::string log = generate_log(1024 * 1024);
+        size_t n = 0;
+        QBENCHMARK {
+            n = bytewise ? hexencode_bytewise(log).size() : hexencode(log).size();
+        }
+        QVERIFY(n > log.size());
+    }
+
+    void benchmarkDecode()
+    {
+        const std::string encoded = hexencode(generate_log(1024 * 1024));
+        size_t n = 0;
+        QBENCHMARK {
+            n = hexdecode(encoded).size();
+        }
+        QCOMPARE(n, size_t(1024 * 1024));
+    }
+};
+
+QTEST_GUILESS_MAIN(HexTest)
+
+#include "hextest.moc"
@@ -0,0 +1,202 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/kdpipeiodevicetest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "utils/kdpipeiodevice.h"
+
+#include <QCryptographicHash>
+#include <QSignalSpy>
+#include <QTest>
+#include <QThread>
+
+#include <memory>
+
+namespace
+{
+
+// writes totalSize bytes in chunks of chunkSize from a separate thread and
+// reads them in the calling thread; returns the number of bytes read
+qint64 transfer(qint64 totalSize, qint64 chunkSize, QByteArray *writtenHash = nullptr, QByteArray *readHash = nullptr)
+{
+    const auto pipes = KDPipeIODevice::makePairOfConnectedPipes();
+    std::unique_ptr<KDPipeIODevice> in(pipes.first);
+    std::unique_ptr<KDPipeIODevice> out(pipes.second);
+    if (!in || !out) {
+        return -1;
+    }
+
+    QByteArray chunk(chunkSize, Qt::Uninitialized);
+    for (int i = 0; i < chunk.size(); ++i) {
+        chunk[i] = char(i * 7);
+    }
+
+    QCryptographicHash outHash(QCryptographicHash::Sha1);
+    std::unique_ptr<QThread> writer(QThread::create([&]() {
+        for (qint64 remaining = totalSize; remaining > 0;) {
+            const qint64 toWrite = std::min(remaining, chunkSize);
+            const qint64 written = out->write(chunk.constData(), toWrite);
+            if (written <= 0) {
+                break;
+            }
+            if (writtenHash) {
+                outHash.addData(chunk.constData(), written);
+            }
+            remaining -= written;
+        }
+        out->close();
+    }));
+    writer->start();
+
+    QCryptographicHash inHash(QCryptographicHash::Sha1);
+    QByteArray buffer(chunkSize, Qt::Uninitialized);
+    qint64 total = 0;
+    while (true) {
+        const qint64 numRead = in->read(buffer.data(), buffer.size());
+        if (numRead < 0) {
+            break;
+        }
+        if (numRead == 0) {
+            // reads in the thread of the device don't block
+            if (in->atEnd()) {
+                break;
+            }
+            in->waitForReadyRead(1000);
+            continue;
+        }
+        if (readHash) {
+            inHash.addData(buffer.constData(), numRead);
+        }
+        total += numRead;
+    }
+    writer->wait();
+
+    if (writtenHash) {
+        *writtenHash = outHash.result();
+    }
+    if (readHash) {
+        *readHash = inHash.result();
+    }
+    return total;
+}
+
+}
+
+class KDPipeIODeviceTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testTransfer_data()
+    {
+        QTest::addColumn<qint64>("totalSize");
+        QTest::addColumn<qint64>("chunkSize");
+
+        QTest::newRow("empty") << qint64(0) << qint64(4096);
+        QTest::newRow("small") << qint64(100) << qint64(4096);
+        QTest::newRow("odd chunks") << qint64(1000003) << qint64(4093);
+        QTest::newRow("large chunks") << qint64(16 * 1024 * 1024) << qint64(1024 * 1024);
+    }
+
+    void testTransfer()
+    {
+        QFETCH(qint64, totalSize);
+        QFETCH(qint64, chunkSize);
+
+        QByteArray writtenHash, readHash;
+        QCOMPARE(transfer(totalSize, chunkSize, &writtenHash, &readHash), totalSize);
+        QCOMPARE(readHash, writtenHash);
+    }
+
+    void testReadyRead()
+    {
+        const auto pipes = KDPipeIODevice::makePairOfConnectedPipes();
+        std::unique_ptr<KDPipeIODevice> in(pipes.first);
+        std::unique_ptr<KDPipeIODevice> out(pipes.second);
+        QVERIFY(in && out);
+
+        QSignalSpy readyRead(in.get(), &QIODevice::readyRead);
+        in->bytesAvailable(); // starts the reader thread where there is one
+        QSignalSpy bytesWritten(out.get(), &QIODevice::bytesWritten);
+
+        const QByteArray data("hello\nworld");
+        QCOMPARE(out->write(data), qint64(data.size()));
+        QVERIFY(readyRead.wait());
+        QTRY_VERIFY(!bytesWritten.isEmpty());
+
+        QTRY_COMPARE(in->bytesAvailable(), qint64(data.size()));
+        QVERIFY(in->canReadLine());
+        QCOMPARE(in->readLine(), QByteArray("hello\n"));
+        QCOMPARE(in->read(100), QByteArray("world"));
+
+        out->close();
+        QTRY_VERIFY(in->atEnd());
+        QCOMPARE(in->read(100), QByteArray());
+    }
+
+    void testReadDoesNotBlock()
+    {
+#ifndef Q_OS_LINUX
+        QSKIP("Only the direct pipes on Linux read without blocking");
+#endif
+        const auto pipes = KDPipeIODevice::makePairOfConnectedPipes();
+        std::unique_ptr<KDPipeIODevice> in(pipes.first);
+        std::unique_ptr<KDPipeIODevice> out(pipes.second);
+        QVERIFY(in && out);
+
+        char ch;
+        QCOMPARE(in->read(&ch, 1), qint64(0));
+        QVERIFY(!in->atEnd());
+    }
+
+    void testReadyReadAfterCanReadLine()
+    {
+        const auto pipes = KDPipeIODevice::makePairOfConnectedPipes();
+        std::unique_ptr<KDPipeIODevice> in(pipes.first);
+        std::unique_ptr<KDPipeIODevice> out(pipes.second);
+        QVERIFY(in && out);
+
+        QSignalSpy readyRead(in.get(), &QIODevice::readyRead);
+        in->bytesAvailable(); // starts the reader thread where there is one
+
+        QCOMPARE(out->write("hel"), qint64(3));
+        QVERIFY(readyRead.wait());
+        QTRY_COMPARE(in->bytesAvailable(), qint64(3));
+        // drains the pipe without reading from the device
+        QVERIFY(!in->canReadLine());
+
+        readyRead.clear();
+        QCOMPARE(out->write("lo\n"), qint64(3));
+        QVERIFY(readyRead.wait());
+        QTRY_VERIFY(in->canReadLine());
+        QCOMPARE(in->readLine(), QByteArray("hello\n"));
+    }
+
+    void benchmarkThroughput_data()
+    {
+        QTest::addColumn<qint64>("chunkSize");
+
+        QTest::newRow("4 KiB") << qint64(4 * 1024);
+        QTest::newRow("64 KiB") << qint64(64 * 1024);
+        QTest::newRow("1 MiB") << qint64(1024 * 1024);
+    }
+
+    void benchmarkThroughput()
+    {
+        QFETCH(qint64, chunkSize);
+
+        const qint64 totalSize = 256 * 1024 * 1024;
+        qint64 n = 0;
+        QBENCHMARK {
+            n = transfer(totalSize, chunkSize);
+        }
+        QCOMPARE(n, totalSize);
+    }
+};
+
+QTEST_GUILESS_MAIN(KDPipeIODeviceTest)
+
+#include "kdpipeiodevicetest.moc"
@@ -0,0 +1,177 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/sumfiletest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "utils/sumfile.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QRegExp>
+#include <QTemporaryFile>
+#include <QTest>
+#include <QTextStream>
+
+using namespace Kleo;
+
+using Entries = std::vector<SumFileEntry>;
+Q_DECLARE_METATYPE(Entries)
+
+namespace
+{
+
+// the QRegExp/QTextStream based parser formerly used by the checksum
+// controllers, for comparing the speed. Its pattern "(\\?)..." required
+// a literal '?' at the start of the line, so it never matched anything;
+// here the backslash is optional, as intended.
+QString decode(const QString &encoded)
+{
+    QString decoded;
+    decoded.reserve(encoded.size());
+    bool shift = false;
+    for (QChar ch : encoded)
+        if (shift) {
+            switch (ch.toLatin1()) {
+            case '\\': decoded += QLatin1Char('\\'); break;
+            case 'n':  decoded += QLatin1Char('\n'); break;
+            default:   decoded += ch; break;
+            }
+            shift = false;
+        } else {
+            if (ch == QLatin1Char('\\')) {
+                shift = true;
+            } else {
+                decoded += ch;
+            }
+        }
+    return decoded;
+}
+
+std::vector<SumFileEntry> parse_sum_file_regexp(const QString &fileName)
+{
+    std::vector<SumFileEntry> files;
+    QFile f(fileName);
+    if (f.open(QIODevice::ReadOnly)) {
+        QTextStream s(&f);
+        QRegExp rx(QLatin1String("(\\\\?)([a-f0-9A-F]+) ([ *])([^\n]+)\n*"));
+        while (!s.atEnd()) {
+            const QString line = s.readLine();
+            if (rx.exactMatch(line)) {
+                const SumFileEntry file = {
+                    rx.cap(1) == QLatin1String("\\") ? decode(rx.cap(4)) : rx.cap(4),
+                    rx.cap(2).toLatin1(),
+                    rx.cap(3) == QLatin1String("*"),
+                };
+                files.push_back(file);
+            }
+        }
+    }
+    return files;
+}
+
+QByteArray generate_sum_file(int numEntries, Entries *entries = nullptr)
+{
+    QByteArray data;
+    for (int i = 0; i < numEntries; ++i) {
+        const QByteArray checksum = QCryptographicHash::hash(QByteArray::number(i), QCryptographicHash::Sha256).toHex();
+        const QByteArray name = "some/directory/file-" + QByteArray::number(i) + ".tar.xz";
+        data += checksum + "  " + name + '\n';
+        if (entries) {
+            entries->push_back({QString::fromLatin1(name), checksum, false});
+        }
+    }
+    return data;
+}
+
+SumFileEntry entry(const QString &name, const QByteArray &checksum, bool binary = false)
+{
+    return {name, checksum, binary};
+}
+
+}
+
+class SumFileTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testParse_data()
+    {
+        QTest::addColumn<QByteArray>("data");
+        QTest::addColumn<Entries>("expected");
+
+        const QByteArray checksum = "0123456789abcdef";
+        QTest::newRow("empty") << QByteArray() << Entries();
+        QTest::newRow("text") << QByteArray("0123456789abcdef  foo.txt\n")
+                              << Entries{entry(QStringLiteral("foo.txt"), checksum)};
+        QTest::newRow("binary") << QByteArray("0123456789ABCDEF *foo.bin\n")
+                                << Entries{entry(QStringLiteral("foo.bin"), "0123456789ABCDEF", true)};
+        QTest::newRow("no trailing newline") << QByteArray("0123456789abcdef  foo.txt")
+                                             << Entries{entry(QStringLiteral("foo.txt"), checksum)};
+        QTest::newRow("crlf") << QByteArray("0123456789abcdef  foo.txt\r\n0123456789abcdef *bar\r\n")
+                              << Entries{entry(QStringLiteral("foo.txt"), checksum), entry(QStringLiteral("bar"), checksum, true)};
+        QTest::newRow("spaces in name") << QByteArray("0123456789abcdef   foo bar \n")
+                                        << Entries{entry(QStringLiteral(" foo bar "), checksum)};
+        QTest::newRow("escaped") << QByteArray("\\0123456789abcdef  foo\\nbar\\\\baz\n")
+                                 << Entries{entry(QStringLiteral("foo\nbar\\baz"), checksum)};
+        QTest::newRow("invalid escape") << QByteArray("\\0123456789abcdef  foo\\xbar\n")
+                                        << Entries{entry(QStringLiteral("fooxbar"), checksum)};
+        QTest::newRow("garbage") << QByteArray("not a checksum\n\n0123 \nxyz  foo\n0123456789abcdef  ok\n")
+                                 << Entries{entry(QStringLiteral("ok"), checksum)};
+        QTest::newRow("utf-8") << QByteArray("0123456789abcdef  gr\xc3\xbc\xc3\x9f" "e.txt\n")
+                               << Entries{entry(QFile::decodeName("gr\xc3\xbc\xc3\x9f" "e.txt"), checksum)};
+        Entries many;
+        const QByteArray manyData = generate_sum_file(1000, &many);
+        QTest::newRow("many") << manyData << many;
+    }
+
+    void testParse()
+    {
+        QFETCH(QByteArray, data);
+        QFETCH(Entries, expected);
+
+        QTemporaryFile f;
+        QVERIFY(f.open());
+        f.write(data);
+        f.close();
+
+        const std::vector<SumFileEntry> actual = parseSumFile(f.fileName());
+        QCOMPARE(actual.size(), expected.size());
+        for (size_t i = 0; i < actual.size(); ++i) {
+            QCOMPARE(actual[i].name, expected[i].name);
+            QCOMPARE(actual[i].checksum, expected[i].checksum);
+            QCOMPARE(actual[i].binary, expected[i].binary);
+        }
+    }
+
+    void benchmarkParse_data()
+    {
+        QTest::addColumn<bool>("regexp");
+
+        QTest::newRow("QRegExp") << true;
+        QTest::newRow("parseSumFile") << false;
+    }
+
+    void benchmarkParse()
+    {
+        QFETCH(bool, regexp);
+
+        QTemporaryFile f;
+        QVERIFY(f.open());
+        f.write(generate_sum_file(100000));
+        f.close();
+
+        size_t n = 0;
+        QBENCHMARK {
+            n = regexp ? parse_sum_file_regexp(f.fileName()).size() : parseSumFile(f.fileName()).size();
+        }
+        QCOMPARE(n, size_t(100000));
+    }
+};
+
+QTEST_GUILESS_MAIN(SumFileTest)
+
+#include "sumfiletest.moc"
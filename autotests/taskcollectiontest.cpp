@@ -0,0 +1,121 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    autotests/taskcollectiontest.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <crypto/task.h>
+#include <crypto/taskcollection.h>
+
+#include <QSignalSpy>
+#include <QString>
+#include <QTest>
+
+#include <memory>
+#include <vector>
+
+using namespace Kleo::Crypto;
+
+Q_DECLARE_METATYPE(std::shared_ptr<const Kleo::Crypto::Task::Result>)
+
+namespace
+{
+
+std::vector<std::shared_ptr<Task>> makeTasks(int n)
+{
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int i = 0; i < n; ++i) {
+        // error tasks report their result from the event loop once started
+        tasks.push_back(Task::makeErrorTask(i + 1, QStringLiteral("result %1").arg(i), QStringLiteral("task %1").arg(i)));
+    }
+    return tasks;
+}
+
+int errorCodeOf(const QList<QVariant> &arguments)
+{
+    return arguments.at(0).value<std::shared_ptr<const Task::Result>>()->errorCode();
+}
+
+}
+
+class TaskCollectionTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        qRegisterMetaType<std::shared_ptr<const Task::Result>>();
+    }
+
+    void testResultsAreEmittedInOrder()
+    {
+        const auto tasks = makeTasks(3);
+        TaskCollection coll;
+        coll.setTasks(tasks);
+        coll.setPreserveResultOrder(true);
+        QSignalSpy resultSpy(&coll, &TaskCollection::result);
+        QSignalSpy doneSpy(&coll, &TaskCollection::done);
+
+        tasks[2]->start();
+        tasks[1]->start();
+        QTest::qWait(0);
+        QCOMPARE(resultSpy.count(), 0);
+
+        tasks[0]->start();
+        QTRY_VERIFY(doneSpy.count() == 1);
+        QCOMPARE(resultSpy.count(), 3);
+        QCOMPARE(errorCodeOf(resultSpy.at(0)), 1);
+        QCOMPARE(errorCodeOf(resultSpy.at(1)), 2);
+        QCOMPARE(errorCodeOf(resultSpy.at(2)), 3);
+    }
+
+    void testTaskCanceledBeforeStart()
+    {
+        const auto tasks = makeTasks(3);
+        TaskCollection coll;
+        coll.setTasks(tasks);
+        coll.setPreserveResultOrder(true);
+        QSignalSpy resultSpy(&coll, &TaskCollection::result);
+        QSignalSpy doneSpy(&coll, &TaskCollection::done);
+
+        tasks[1]->start();
+        tasks[2]->start();
+        QTRY_VERIFY(coll.numberOfCompletedTasks() == 2);
+        // the first task hasn't reported a result yet
+        QCOMPARE(resultSpy.count(), 0);
+
+        coll.skipTask(tasks[0]->id());
+        QCOMPARE(resultSpy.count(), 2);
+        QCOMPARE(errorCodeOf(resultSpy.at(0)), 2);
+        QCOMPARE(errorCodeOf(resultSpy.at(1)), 3);
+        QCOMPARE(doneSpy.count(), 1);
+        QVERIFY(coll.allTasksCompleted());
+    }
+
+    void testTaskInTheMiddleCanceledBeforeStart()
+    {
+        const auto tasks = makeTasks(3);
+        TaskCollection coll;
+        coll.setTasks(tasks);
+        coll.setPreserveResultOrder(true);
+        QSignalSpy resultSpy(&coll, &TaskCollection::result);
+        QSignalSpy doneSpy(&coll, &TaskCollection::done);
+
+        coll.skipTask(tasks[1]->id());
+        QCOMPARE(doneSpy.count(), 0);
+
+        tasks[2]->start();
+        tasks[0]->start();
+        QTRY_VERIFY(doneSpy.count() == 1);
+        QCOMPARE(resultSpy.count(), 2);
+        QCOMPARE(errorCodeOf(resultSpy.at(0)), 1);
+        QCOMPARE(errorCodeOf(resultSpy.at(1)), 3);
+    }
+};
+
+QTEST_GUILESS_MAIN(TaskCollectionTest)
+#include "taskcollectiontest.moc"
@@ -13,6 +13,8 @@
 
 #include "command_p.h"
 
+#include <utils/keycacheupdater.h>
+
 #include "dialogs/adduseriddialog.h"
 #include "dialogs/addemaildialog.h"
 
@@ -192,6 +194,9 @@ void AddUserIDCommand::Private::slotDialogRejected()
 
 void AddUserIDCommand::Private::slotResult(const Error &err)
 {
+    if (!err) {
+        KeyCacheUpdater::keysChanged({key()});
+    }
     if (err.isCanceled())
         ;
     else if (err) {
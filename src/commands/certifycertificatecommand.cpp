@@ -17,6 +17,7 @@
 
 #include "exportopenpgpcertstoservercommand.h"
 #include "dialogs/certifycertificatedialog.h"
+#include "utils/keycacheupdater.h"
 #include "utils/tags.h"
 
 #include <Libkleo/KeyCache>
@@ -226,6 +227,14 @@ void CertifyCertificateCommand::Private::slotDialogRejected()
 
 void CertifyCertificateCommand::Private::slotResult(const Error &err)
 {
+    if (!err) {
+        // a certification of a trusted introducer validates other certificates
+        if (key().ownerTrust() >= Key::Marginal) {
+            KeyCacheUpdater::unknownKeysChanged();
+        } else {
+            KeyCacheUpdater::keysChanged({key()});
+        }
+    }
     if (!err && !err.isCanceled() && dialog && dialog->exportableCertificationSelected() && dialog->sendToServer()) {
         auto const cmd = new ExportOpenPGPCertsToServerCommand(key());
         cmd->start();
@@ -14,6 +14,8 @@
 #include "changeexpirycommand.h"
 #include "command_p.h"
 
+#include <utils/keycacheupdater.h>
+
 #include "dialogs/expirydialog.h"
 
 #include <Libkleo/Formatting>
@@ -156,6 +158,9 @@ void ChangeExpiryCommand::Private::slotDialogRejected()
 
 void ChangeExpiryCommand::Private::slotResult(const Error &err)
 {
+    if (!err) {
+        KeyCacheUpdater::keysChanged({key()});
+    }
     if (err.isCanceled())
         ;
     else if (err) {
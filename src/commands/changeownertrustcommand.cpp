@@ -13,6 +13,8 @@
 
 #include "command_p.h"
 
+#include <utils/keycacheupdater.h>
+
 #include <dialogs/ownertrustdialog.h>
 
 #include <Libkleo/Formatting>
@@ -164,6 +166,10 @@ void ChangeOwnerTrustCommand::Private::slotDialogRejected()
 
 void ChangeOwnerTrustCommand::Private::slotResult(const Error &err)
 {
+    if (!err) {
+        // changes the validity of the certificates signed by the owner
+        KeyCacheUpdater::unknownKeysChanged();
+    }
     if (err.isCanceled())
         ;
     else if (err) {
@@ -12,6 +12,8 @@
 #include "changeroottrustcommand.h"
 #include "command_p.h"
 
+#include <utils/keycacheupdater.h>
+
 #include <Libkleo/KeyCache>
 
 #include <Libkleo/GnuPG>
@@ -70,7 +72,7 @@ private:
 private:
     void slotOperationFinished()
     {
-        KeyCache::mutableInstance()->enableFileSystemWatcher(true);
+        KeyCacheUpdater::enableFileSystemWatcher(true);
         if (error.isEmpty()) {
             KeyCache::mutableInstance()->reload(GpgME::CMS);
         } else
@@ -173,7 +175,7 @@ void ChangeRootTrustCommand::doStart()
     }
 
     d->gpgConfPath = gpgConfPath();
-    KeyCache::mutableInstance()->enableFileSystemWatcher(false);
+    KeyCacheUpdater::enableFileSystemWatcher(false);
     d->start();
 }
 
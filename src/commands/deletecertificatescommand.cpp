@@ -14,6 +14,7 @@
 #include "command_p.h"
 
 #include <dialogs/deletecertificatesdialog.h>
+#include <utils/keycacheupdater.h>
 
 #include <Libkleo/KeyCache>
 #include <Libkleo/Predicates>
@@ -385,6 +386,7 @@ void DeleteCertificatesCommand::Private::showErrorsAndFinish()
         std::vector<Key> keys = pgpKeys;
         keys.insert(keys.end(), cmsKeys.begin(), cmsKeys.end());
         KeyCache::mutableInstance()->remove(keys);
+        KeyCacheUpdater::keysChanged(keys);
     }
 
     finished();
@@ -16,6 +16,8 @@
 #include "certifycertificatecommand.h"
 #include "kleopatra_debug.h"
 
+#include "utils/keycacheupdater.h"
+
 #include <Libkleo/Algorithm>
 #include <Libkleo/KeyList>
 #include <Libkleo/KeyListSortFilterProxyModel>
@@ -160,6 +162,7 @@ ImportCertificatesCommand::Private::Private(ImportCertificatesCommand *qq, KeyLi
       containedExternalCMSCerts(false),
       nonWorkingProtocols(),
       idsByJob(),
+      protocolsByJob(),
       jobs(),
       results(),
       ids()
@@ -425,17 +428,37 @@ void ImportCertificatesCommand::Private::setWaitForMoreJobs(bool wait)
     tryToFinish();
 }
 
+// lets the key cache list only the imported certificates again
+static void announceChangedKeys(const ImportResult &result, GpgME::Protocol protocol)
+{
+    if (result.numSecretKeysImported()) {
+        // handleOwnerTrust() may change the owner trust
+        KeyCacheUpdater::unknownKeysChanged();
+        return;
+    }
+    QStringList fingerprints;
+    const auto imports = result.imports();
+    for (const Import &import : imports) {
+        if (import.fingerprint() && import.status()) {
+            fingerprints << QString::fromLatin1(import.fingerprint());
+        }
+    }
+    if (!fingerprints.empty()) {
+        KeyCacheUpdater::keysChanged(fingerprints, protocol);
+    }
+}
+
 void ImportCertificatesCommand::Private::importResult(const ImportResult &result)
 {
 
     jobs.erase(std::remove(jobs.begin(), jobs.end(), q->sender()), jobs.end());
 
+    announceChangedKeys(result, protocolsByJob[q->sender()]);
     importResult(result, idsByJob[q->sender()]);
 }
 
 void ImportCertificatesCommand::Private::importResult(const ImportResult &result, const QString &id)
 {
-
     results.push_back(result);
     ids.push_back(id);
 
@@ -618,6 +641,7 @@ void ImportCertificatesCommand::Private::startImport(GpgME::Protocol protocol, c
     } else {
         jobs.push_back(job.release());
         idsByJob[jobs.back()] = id;
+        protocolsByJob[jobs.back()] = protocol;
     }
 }
 
@@ -663,6 +687,7 @@ void ImportCertificatesCommand::Private::startImport(GpgME::Protocol protocol, c
     } else {
         jobs.push_back(job.release());
         idsByJob[jobs.back()] = id;
+        protocolsByJob[jobs.back()] = protocol;
     }
 }
 
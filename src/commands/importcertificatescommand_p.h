@@ -72,6 +72,7 @@ private:
     bool containedExternalCMSCerts;
     std::vector<GpgME::Protocol> nonWorkingProtocols;
     std::map<QObject *, QString> idsByJob;
+    std::map<QObject *, GpgME::Protocol> protocolsByJob;
     std::vector<QGpgME::AbstractImportJob *> jobs;
     std::vector<GpgME::ImportResult> results;
     QStringList ids;
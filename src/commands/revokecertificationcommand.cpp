@@ -16,6 +16,7 @@
 
 #include "exportopenpgpcertstoservercommand.h"
 #include "dialogs/revokecertificationdialog.h"
+#include "utils/keycacheupdater.h"
 
 #include <Libkleo/Formatting>
 #include <Libkleo/KeyCache>
@@ -120,6 +121,14 @@ void RevokeCertificationCommand::Private::slotDialogRejected()
 
 void RevokeCertificationCommand::Private::slotResult(const Error &err)
 {
+    if (!err) {
+        // see CertifyCertificateCommand::Private::slotResult()
+        if (certificationTarget.ownerTrust() >= Key::Marginal) {
+            KeyCacheUpdater::unknownKeysChanged();
+        } else {
+            KeyCacheUpdater::keysChanged({certificationTarget});
+        }
+    }
     if (err.isCanceled()) {
         // do nothing
     } else if (err) {
@@ -42,13 +42,65 @@
 #include <QTimer>
 #include <QFileDialog>
 #include <QTemporaryDir>
+#include <QThreadPool>
 
+#include <algorithm>
+#include <map>
 
 using namespace GpgME;
 using namespace Kleo;
 using namespace Kleo::Crypto;
 using namespace Kleo::Crypto::Gui;
 
+namespace
+{
+struct OutputMove {
+    QString source;
+    QString destination;
+    bool isDir;
+    bool makeUnique; // pick a non-existing name instead of overwriting destination
+};
+}
+
+static QString unique_path(const QString &path, bool isDir)
+{
+    const QFileInfo fi(path);
+    const QString dir = fi.absolutePath();
+    const QString base = isDir ? fi.fileName() : fi.completeBaseName();
+    const QString suffix = isDir || fi.suffix().isEmpty() ? QString() : QLatin1Char('.') + fi.suffix();
+    QString candidate = path;
+    for (int i = 1; QFileInfo::exists(candidate) && i < 1000; ++i) {
+        candidate = QStringLiteral("%1/%2_%3%4").arg(dir, base, QString::number(i), suffix);
+    }
+    return candidate;
+}
+
+// runs in a worker thread; returns the error messages
+static QStringList move_outputs(const std::vector<OutputMove> &moves)
+{
+    QStringList errors;
+    for (const OutputMove &move : moves) {
+        const QString dest = move.makeUnique ? unique_path(move.destination, move.isDir) : move.destination;
+        qCDebug(KLEOPATRA_LOG) << "Moving " << move.source << " to " << dest;
+        if (move.isDir) {
+            if (!moveDir(move.source, dest)) {
+                errors.push_back(xi18n("Failed to move <filename>%1</filename> to <filename>%2</filename>.",
+                                       move.source, dest));
+            }
+            continue;
+        }
+        if (QFileInfo::exists(dest) && !QFile::remove(dest)) {
+            errors.push_back(xi18n("Failed to delete <filename>%1</filename>.", dest));
+            continue;
+        }
+        if (!QFile::rename(move.source, dest)) {
+            errors.push_back(xi18n("Failed to move <filename>%1</filename> to <filename>%2</filename>.",
+                                   move.source, dest));
+        }
+    }
+    return errors;
+}
+
 class AutoDecryptVerifyFilesController::Private
 {
     AutoDecryptVerifyFilesController *const q;
@@ -56,11 +108,15 @@ public:
     explicit Private(AutoDecryptVerifyFilesController *qq);
     ~Private() {
         qCDebug(KLEOPATRA_LOG);
+        // pending moves still need the work directory
+        m_movePool.waitForDone();
         delete m_workDir;
     }
 
     void slotDialogCanceled();
     void schedule();
+    bool canStart(const Task *task) const;
+    bool hasPendingDependents(const Task *task) const;
 
     void exec();
     std::vector<std::shared_ptr<Task> > buildTasks(const QStringList &, QStringList &);
@@ -71,9 +127,24 @@ public:
         GpgME::Protocol protocol = GpgME::UnknownProtocol;
         int classification = 0;
         std::shared_ptr<Output> output;
+        const Task *task = nullptr;
     };
     QVector<CryptoFile> classifyAndSortFiles(const QStringList &files);
 
+    // each task writes into its own subdirectory of m_workDir, so that its
+    // outputs can be moved independently of the other tasks
+    struct TaskOutput {
+        const Task *task;
+        QString workDir;
+        QString inputFileName;
+        bool moved;
+    };
+    std::vector<OutputMove> outputMoves(const TaskOutput &output, const QDir &outDir, bool interactive, bool &overWriteAll) const;
+    void moveOutputs(const std::vector<OutputMove> &moves);
+    void moveOutputsOfTask(const Task *task);
+    void slotOutputsMoved(const QStringList &errors);
+    void finish();
+
     void reportError(int err, const QString &details)
     {
         q->setLastError(err, details);
@@ -82,18 +153,29 @@ public:
     void cancelAllTasks();
 
     QStringList m_passedFiles, m_filesAfterPreparation;
-    std::vector<std::shared_ptr<const DecryptVerifyResult> > m_results;
-    std::vector<std::shared_ptr<Task> > m_runnableTasks, m_completedTasks;
-    std::shared_ptr<Task> m_runningTask;
+    std::map<int, std::shared_ptr<const DecryptVerifyResult> > m_results;
+    std::vector<std::shared_ptr<Task> > m_runnableTasks, m_runningTasks, m_completedTasks;
+    std::map<const Task *, const Task *> m_prerequisites;
+    std::vector<TaskOutput> m_outputs;
+    unsigned int m_maxRunningTasks = 1;
     bool m_errorDetected = false;
+    bool m_moveImmediately = false;
+    bool m_dialogClosed = false;
+    unsigned int m_pendingMoves = 0;
+    QString m_immediateOutputLocation;
     DecryptVerifyOperation m_operation = DecryptVerify;
     DecryptVerifyFilesDialog *m_dialog = nullptr;
+    std::shared_ptr<TaskCollection> m_taskCollection;
     QTemporaryDir *m_workDir = nullptr;
+    QThreadPool m_movePool;
 };
 
 AutoDecryptVerifyFilesController::Private::Private(AutoDecryptVerifyFilesController *qq) : q(qq)
 {
     qRegisterMetaType<VerificationResult>();
+    // a single thread, so that moves are done in order and don't race
+    // for the same non-existing target names
+    m_movePool.setMaxThreadCount(1);
 }
 
 void AutoDecryptVerifyFilesController::Private::slotDialogCanceled()
@@ -101,20 +183,151 @@ void AutoDecryptVerifyFilesController::Private::slotDialogCanceled()
     qCDebug(KLEOPATRA_LOG);
 }
 
+bool AutoDecryptVerifyFilesController::Private::canStart(const Task *task) const
+{
+    const auto it = m_prerequisites.find(task);
+    if (it == m_prerequisites.end()) {
+        return true;
+    }
+    const auto isPrerequisite = [it](const std::shared_ptr<Task> &t) { return t.get() == it->second; };
+    return std::none_of(m_runnableTasks.begin(), m_runnableTasks.end(), isPrerequisite)
+           && std::none_of(m_runningTasks.begin(), m_runningTasks.end(), isPrerequisite);
+}
+
+bool AutoDecryptVerifyFilesController::Private::hasPendingDependents(const Task *task) const
+{
+    const auto dependsOnTask = [this, task](const std::shared_ptr<Task> &t) {
+        const auto it = m_prerequisites.find(t.get());
+        return it != m_prerequisites.end() && it->second == task;
+    };
+    return std::any_of(m_runnableTasks.begin(), m_runnableTasks.end(), dependsOnTask)
+           || std::any_of(m_runningTasks.begin(), m_runningTasks.end(), dependsOnTask);
+}
+
 void AutoDecryptVerifyFilesController::Private::schedule()
 {
-    if (!m_runningTask && !m_runnableTasks.empty()) {
-        const std::shared_ptr<Task> t = m_runnableTasks.back();
-        m_runnableTasks.pop_back();
+    // tasks are taken from the back; tasks reading the output of another
+    // task have to wait until that task is done
+    while (m_runningTasks.size() < m_maxRunningTasks) {
+        const auto it = std::find_if(m_runnableTasks.rbegin(), m_runnableTasks.rend(),
+                                     [this](const std::shared_ptr<Task> &t) { return canStart(t.get()); });
+        if (it == m_runnableTasks.rend()) {
+            break;
+        }
+        const std::shared_ptr<Task> t = *it;
+        m_runnableTasks.erase(std::next(it).base());
+        m_runningTasks.push_back(t);
         t->start();
-        m_runningTask = t;
     }
-    if (!m_runningTask) {
+    if (m_runningTasks.empty()) {
         kleo_assert(m_runnableTasks.empty());
-        for (const std::shared_ptr<const DecryptVerifyResult> &i : std::as_const(m_results)) {
-            Q_EMIT q->verificationResult(i->verificationResult());
+        for (const auto &i : std::as_const(m_results)) {
+            Q_EMIT q->verificationResult(i.second->verificationResult());
+        }
+    }
+}
+
+std::vector<OutputMove> AutoDecryptVerifyFilesController::Private::outputMoves(const TaskOutput &output, const QDir &outDir, bool interactive, bool &overWriteAll) const
+{
+    std::vector<OutputMove> moves;
+    const QDir workdir(output.workDir);
+    qCDebug(KLEOPATRA_LOG) << workdir.entryList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QFileInfo &fi: workdir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot)) {
+        const auto inpath = fi.absoluteFilePath();
+
+        if (fi.isDir()) {
+            // A directory. Assume that the input was an archive
+            // and avoid directory merges by trying to find a non
+            // existing directory.
+            auto candidate = fi.baseName();
+            if (candidate.startsWith(QLatin1Char('-'))) {
+                // Bug in GpgTar Extracts stdout passed archives to a dir named -
+                candidate = QFileInfo(output.inputFileName).baseName();
+            }
+            moves.push_back({inpath, outDir.absoluteFilePath(candidate), true, true});
+            continue;
+        }
+        const auto outpath = outDir.absoluteFilePath(fi.fileName());
+        if (!interactive) {
+            moves.push_back({inpath, outpath, false, true});
+            continue;
         }
+        const QFileInfo ofi(outpath);
+        if (ofi.exists()) {
+            int sel = KMessageBox::No;
+            if (!overWriteAll) {
+                sel = KMessageBox::questionYesNoCancel(m_dialog, i18n("The file <b>%1</b> already exists.\n"
+                                                       "Overwrite?", outpath),
+                                                       i18n("Overwrite Existing File?"),
+                                                       KStandardGuiItem::overwrite(),
+                                                       KGuiItem(i18n("Overwrite All")),
+                                                       KStandardGuiItem::cancel());
+            }
+            if (sel == KMessageBox::Cancel) {
+                qCDebug(KLEOPATRA_LOG) << "Overwriting canceled for: " << outpath;
+                continue;
+            }
+            if (sel == KMessageBox::No) { //Overwrite All
+                overWriteAll = true;
+            }
+        }
+        moves.push_back({inpath, outpath, false, false});
     }
+    return moves;
+}
+
+void AutoDecryptVerifyFilesController::Private::moveOutputs(const std::vector<OutputMove> &moves)
+{
+    if (moves.empty()) {
+        return;
+    }
+    ++m_pendingMoves;
+    m_movePool.start([this, moves]() {
+        const QStringList errors = move_outputs(moves);
+        QMetaObject::invokeMethod(q, [this, errors]() { slotOutputsMoved(errors); }, Qt::QueuedConnection);
+    });
+}
+
+void AutoDecryptVerifyFilesController::Private::moveOutputsOfTask(const Task *task)
+{
+    if (!m_dialog || !m_workDir) {
+        return;
+    }
+    const auto it = std::find_if(m_outputs.begin(), m_outputs.end(),
+                                 [task](const TaskOutput &o) { return o.task == task; });
+    if (it == m_outputs.end() || it->moved || hasPendingDependents(task)) {
+        return;
+    }
+    if (m_immediateOutputLocation.isEmpty()) {
+        const QString outLoc = m_dialog->outputLocation();
+        if (outLoc.isEmpty() || !QDir().mkpath(outLoc) || !QFileInfo(outLoc).isWritable()) {
+            // keep the outputs in the work directory; they are moved
+            // when the dialog is accepted
+            qCDebug(KLEOPATRA_LOG) << "Cannot move outputs to" << outLoc << "yet";
+            return;
+        }
+        m_immediateOutputLocation = outLoc;
+        m_dialog->setOutputLocationEditable(false);
+    }
+    bool overWriteAll = false;
+    it->moved = true;
+    moveOutputs(outputMoves(*it, QDir(m_immediateOutputLocation), false, overWriteAll));
+}
+
+void AutoDecryptVerifyFilesController::Private::slotOutputsMoved(const QStringList &errors)
+{
+    for (const QString &err : errors) {
+        q->setLastError(makeGnuPGError(GPG_ERR_GENERAL), err);
+    }
+    --m_pendingMoves;
+    if (m_dialogClosed && !m_pendingMoves) {
+        finish();
+    }
+}
+
+void AutoDecryptVerifyFilesController::Private::finish()
+{
+    q->emitDoneOrError();
 }
 
 void AutoDecryptVerifyFilesController::Private::exec()
@@ -141,89 +354,40 @@ void AutoDecryptVerifyFilesController::Private::exec()
     Q_ASSERT(m_runnableTasks.empty());
     m_runnableTasks.swap(tasks);
 
+    m_maxRunningTasks = Task::maxConcurrentTasks();
+    m_moveImmediately = FileOperationsPreferences().moveDecryptedFilesImmediately();
+
     std::shared_ptr<TaskCollection> coll(new TaskCollection);
     for (const std::shared_ptr<Task> &i : std::as_const(m_runnableTasks)) {
         q->connectTask(i);
     }
-    coll->setTasks(m_runnableTasks);
+    // the tasks are started from the back
+    coll->setTasks(std::vector<std::shared_ptr<Task> >(m_runnableTasks.rbegin(), m_runnableTasks.rend()));
+    coll->setPreserveResultOrder(m_maxRunningTasks > 1);
     m_dialog = new DecryptVerifyFilesDialog(coll);
+    m_taskCollection = coll;
     m_dialog->setOutputLocation(heuristicBaseDirectory(m_passedFiles));
 
     QTimer::singleShot(0, q, SLOT(schedule()));
     if (m_dialog->exec() == QDialog::Accepted && m_workDir) {
         // Without workdir there is nothing to move.
-        const QDir workdir(m_workDir->path());
         const QDir outDir(m_dialog->outputLocation());
         bool overWriteAll = false;
-        qCDebug(KLEOPATRA_LOG) << workdir.entryList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
-        for (const QFileInfo &fi: workdir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot)) {
-            const auto inpath = fi.absoluteFilePath();
-
-            if (fi.isDir()) {
-                // A directory. Assume that the input was an archive
-                // and avoid directory merges by trying to find a non
-                // existing directory.
-                auto candidate = fi.baseName();
-                if (candidate.startsWith(QLatin1Char('-'))) {
-                    // Bug in GpgTar Extracts stdout passed archives to a dir named -
-                    candidate = QFileInfo(m_passedFiles.first()).baseName();
-                }
-
-                QString suffix;
-                QFileInfo ofi;
-                int i = 0;
-                do {
-                    ofi = QFileInfo(outDir.absoluteFilePath(candidate + suffix));
-                    if (!ofi.exists()) {
-                        break;
-                    }
-                    suffix = QStringLiteral("_%1").arg(++i);
-                } while (i < 1000);
-
-                if (!moveDir(inpath, ofi.absoluteFilePath())) {
-                    reportError(makeGnuPGError(GPG_ERR_GENERAL),
-                            xi18n("Failed to move <filename>%1</filename> to <filename>%2</filename>.",
-                                  inpath, ofi.absoluteFilePath()));
-                }
-                continue;
-            }
-            const auto outpath = outDir.absoluteFilePath(fi.fileName());
-            qCDebug(KLEOPATRA_LOG) << "Moving " << inpath << " to " << outpath;
-            const QFileInfo ofi(outpath);
-            if (ofi.exists()) {
-                int sel = KMessageBox::No;
-                if (!overWriteAll) {
-                    sel = KMessageBox::questionYesNoCancel(m_dialog, i18n("The file <b>%1</b> already exists.\n"
-                                                           "Overwrite?", outpath),
-                                                           i18n("Overwrite Existing File?"),
-                                                           KStandardGuiItem::overwrite(),
-                                                           KGuiItem(i18n("Overwrite All")),
-                                                           KStandardGuiItem::cancel());
-                }
-                if (sel == KMessageBox::Cancel) {
-                    qCDebug(KLEOPATRA_LOG) << "Overwriting canceled for: " << outpath;
-                    continue;
-                }
-                if (sel == KMessageBox::No) { //Overwrite All
-                    overWriteAll = true;
-                }
-                if (!QFile::remove(outpath)) {
-                    reportError(makeGnuPGError(GPG_ERR_GENERAL),
-                                xi18n("Failed to delete <filename>%1</filename>.",
-                                      outpath));
-                    continue;
-                }
-            }
-            if (!QFile::rename(inpath, outpath)) {
-                reportError(makeGnuPGError(GPG_ERR_GENERAL),
-                            xi18n("Failed to move <filename>%1</filename> to <filename>%2</filename>.",
-                                  inpath, outpath));
+        std::vector<OutputMove> moves;
+        for (const TaskOutput &output : std::as_const(m_outputs)) {
+            if (!output.moved) {
+                const auto taskMoves = outputMoves(output, outDir, true, overWriteAll);
+                moves.insert(moves.end(), taskMoves.begin(), taskMoves.end());
             }
         }
+        moveOutputs(moves);
     }
-    q->emitDoneOrError();
     delete m_dialog;
     m_dialog = nullptr;
+    m_dialogClosed = true;
+    if (!m_pendingMoves) {
+        finish();
+    }
 }
 
 QVector<AutoDecryptVerifyFilesController::Private::CryptoFile> AutoDecryptVerifyFilesController::Private::classifyAndSortFiles(const QStringList &files)
@@ -302,11 +466,13 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
             // First, see if previous task was a decryption task for the same file
             // and "pipe" it's output into our input
             std::shared_ptr<Input> input;
+            const Task *prerequisite = nullptr;
             bool prepend = false;
             if (it != cryptoFiles.begin()) {
                 const auto prev = it - 1;
                 if (prev->protocol == cFile.protocol && prev->baseName == cFile.baseName) {
                     input = Input::createFromOutput(prev->output);
+                    prerequisite = prev->task;
                     prepend = true;
                 }
             }
@@ -323,6 +489,9 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
                 t->setInput(Input::createFromFile(cFile.fileName));
                 t->setSignedData(input);
                 t->setProtocol(cFile.protocol);
+                if (prerequisite) {
+                    m_prerequisites[t.get()] = prerequisite;
+                }
                 if (prepend) {
                     // Put the verify task BEFORE the decrypt task in the tasks queue,
                     // because the tasks are executed in reverse order!
@@ -403,11 +572,15 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
             }
             qCDebug(KLEOPATRA_LOG) << "Using:" << m_workDir->path() << "as temporary directory.";
 
-            const auto wd = QDir(m_workDir->path());
+            auto wd = QDir(m_workDir->path());
+            const auto taskDir = QString::number(m_outputs.size());
+            if (wd.mkdir(taskDir)) {
+                wd.cd(taskDir);
+            }
 
             const auto output =
                 ad       ? ad->createOutputFromUnpackCommand(cFile.protocol, cFile.fileName, wd) :
-                /*else*/   Output::createFromFile(wd.absoluteFilePath(outputFileName(fi.fileName())), false);
+                /*else*/   Output::createFromFile(wd.absoluteFilePath(outputFileName(fi.fileName())), false, fi.size());
 
             // If this might be opaque CMS signature, then try that. We already handled
             // detached CMS signature above
@@ -419,6 +592,7 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
                 t->setInput(input);
                 t->setOutput(output);
                 t->setProtocol(cFile.protocol);
+                m_outputs.push_back({t.get(), wd.absolutePath(), cFile.fileName, false});
                 tasks.push_back(t);
             } else {
                 // Any message. That is not an opaque signature needs to be
@@ -430,6 +604,8 @@ std::vector< std::shared_ptr<Task> > AutoDecryptVerifyFilesController::Private::
                 t->setOutput(output);
                 t->setProtocol(cFile.protocol);
                 cFile.output = output;
+                cFile.task = t.get();
+                m_outputs.push_back({t.get(), wd.absolutePath(), cFile.fileName, false});
                 tasks.push_back(t);
             }
         }
@@ -477,12 +653,18 @@ void AutoDecryptVerifyFilesController::Private::cancelAllTasks()
 {
 
     // we just kill all runnable tasks - this will not result in
-    // signal emissions.
+    // signal emissions, so the collection must not wait for them.
+    if (m_taskCollection) {
+        for (const std::shared_ptr<Task> &t : std::as_const(m_runnableTasks)) {
+            m_taskCollection->skipTask(t->id());
+        }
+    }
     m_runnableTasks.clear();
 
     // a cancel() will result in a call to
-    if (m_runningTask) {
-        m_runningTask->cancel();
+    const auto runningTasks = m_runningTasks;
+    for (const std::shared_ptr<Task> &t : runningTasks) {
+        t->cancel();
     }
 }
 
@@ -503,18 +685,31 @@ void AutoDecryptVerifyFilesController::cancel()
 void AutoDecryptVerifyFilesController::doTaskDone(const Task *task, const std::shared_ptr<const Task::Result> &result)
 {
     Q_ASSERT(task);
-    Q_UNUSED(task)
 
     // We could just delete the tasks here, but we can't use
     // Qt::QueuedConnection here (we need sender()) and other slots
     // might not yet have executed. Therefore, we push completed tasks
     // into a burial container
 
-    d->m_completedTasks.push_back(d->m_runningTask);
-    d->m_runningTask.reset();
+    const auto it = std::find_if(d->m_runningTasks.begin(), d->m_runningTasks.end(),
+                                 [task](const std::shared_ptr<Task> &t) { return t.get() == task; });
+    if (it != d->m_runningTasks.end()) {
+        d->m_completedTasks.push_back(*it);
+        d->m_runningTasks.erase(it);
+    }
 
     if (const std::shared_ptr<const DecryptVerifyResult> &dvr = std::dynamic_pointer_cast<const DecryptVerifyResult>(result)) {
-        d->m_results.push_back(dvr);
+        d->m_results[task->id()] = dvr;
+    }
+
+    if (d->m_moveImmediately && result && !result->hasError()) {
+        d->moveOutputsOfTask(task);
+        // a decrypted file read by a detached signature verification
+        // can only be moved once the verification is done
+        const auto prerequisite = d->m_prerequisites.find(task);
+        if (prerequisite != d->m_prerequisites.end()) {
+            d->moveOutputsOfTask(prerequisite->second);
+        }
     }
 
     QTimer::singleShot(0, this, SLOT(schedule()));
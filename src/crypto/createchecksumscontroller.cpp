@@ -11,8 +11,13 @@
 
 #include "createchecksumscontroller.h"
 
+#include "fileoperationspreferences.h"
+
+#include <utils/checksumcache.h>
+#include <utils/checksumengine.h>
 #include <utils/input.h>
 #include <utils/output.h>
+#include <utils/sumfile.h>
 #include <utils/kleo_assert.h>
 
 #include <Libkleo/Stl_Util>
@@ -21,7 +26,6 @@
 
 #include <KLocalizedString>
 #include "kleopatra_debug.h"
-#include <QTemporaryFile>
 #include <KConfigGroup>
 #include <KSharedConfig>
 
@@ -38,6 +42,7 @@
 #include <QProgressDialog>
 #include <QDir>
 #include <QProcess>
+#include <QSaveFile>
 
 #include <gpg-error.h>
 
@@ -245,6 +250,8 @@ private:
     QStringList files;
     QStringList errors, created;
     bool allowAddition;
+    bool useBuiltinEngine;
+    bool incremental;
     volatile bool canceled;
 };
 
@@ -260,6 +267,8 @@ CreateChecksumsController::Private::Private(CreateChecksumsController *qq)
       errors(),
       created(),
       allowAddition(false),
+      useBuiltinEngine(true),
+      incremental(FileOperationsPreferences().incrementalChecksumCreation()),
       canceled(false)
 {
     connect(this, SIGNAL(progress(int,int,QString)),
@@ -318,6 +327,19 @@ bool CreateChecksumsController::allowAddition() const
     return d->allowAddition;
 }
 
+void CreateChecksumsController::setIncremental(bool incremental)
+{
+    kleo_assert(!d->isRunning());
+    const QMutexLocker locker(&d->mutex);
+    d->incremental = incremental;
+}
+
+bool CreateChecksumsController::isIncremental() const
+{
+    const QMutexLocker locker(&d->mutex);
+    return d->incremental;
+}
+
 void CreateChecksumsController::start()
 {
 
@@ -333,6 +355,7 @@ void CreateChecksumsController::start()
         connect(d->progressDialog.data(), &QProgressDialog::canceled, this, &CreateChecksumsController::cancel);
 #endif // QT_NO_PROGRESSDIALOG
 
+        d->useBuiltinEngine = FileOperationsPreferences().useBuiltinChecksumEngine();
         d->canceled = false;
         d->errors.clear();
         d->created.clear();
@@ -375,64 +398,6 @@ static QStringList remove_checksum_files(QStringList l, const QList<QRegExp> &rx
     return l;
 }
 
-namespace
-{
-struct File {
-    QString name;
-    QByteArray checksum;
-    bool binary;
-};
-}
-
-static QString decode(const QString &encoded)
-{
-    QString decoded;
-    decoded.reserve(encoded.size());
-    bool shift = false;
-    for (QChar ch : encoded)
-        if (shift) {
-            switch (ch.toLatin1()) {
-            case '\\': decoded += QLatin1Char('\\'); break;
-            case 'n':  decoded += QLatin1Char('\n'); break;
-            default:
-                qCDebug(KLEOPATRA_LOG) << "invalid escape sequence" << '\\' << ch << "(interpreted as '" << ch << "')";
-                decoded += ch;
-                break;
-            }
-            shift = false;
-        } else {
-            if (ch == QLatin1Char('\\')) {
-                shift = true;
-            } else {
-                decoded += ch;
-            }
-        }
-    return decoded;
-}
-
-static std::vector<File> parse_sum_file(const QString &fileName)
-{
-    std::vector<File> files;
-    QFile f(fileName);
-    if (f.open(QIODevice::ReadOnly)) {
-        QTextStream s(&f);
-        QRegExp rx(QLatin1String("(\\?)([a-f0-9A-F]+) ([ *])([^\n]+)\n*"));
-        while (!s.atEnd()) {
-            const QString line = s.readLine();
-            if (rx.exactMatch(line)) {
-                Q_ASSERT(!rx.cap(4).endsWith(QLatin1Char('\n')));
-                const File file = {
-                    rx.cap(1) == QLatin1String("\\") ? decode(rx.cap(4)) : rx.cap(4),
-                    rx.cap(2).toLatin1(),
-                    rx.cap(3) == QLatin1String("*"),
-                };
-                files.push_back(file);
-            }
-        }
-    }
-    return files;
-}
-
 static quint64 aggregate_size(const QDir &dir, const QStringList &files)
 {
     quint64 n = 0;
@@ -480,11 +445,11 @@ static std::vector<Dir> find_dirs_by_sum_files(const QStringList &files, bool al
         if (allowAddition) {
             inputFiles = entries;
         } else {
-            const std::vector<File> parsed = parse_sum_file(fi.absoluteFilePath());
+            const std::vector<SumFileEntry> parsed = parseSumFile(fi.absoluteFilePath());
             QStringList oldInputFiles;
             oldInputFiles.reserve(parsed.size());
             std::transform(parsed.cbegin(), parsed.cend(), std::back_inserter(oldInputFiles),
-                           std::mem_fn(&File::name));
+                           std::mem_fn(&SumFileEntry::name));
             inputFiles = fs_intersect(oldInputFiles, entries);
         }
 
@@ -586,17 +551,21 @@ static std::vector<Dir> find_dirs_by_input_files(const QStringList &files, const
 
 static QString process(const Dir &dir, bool *fatal)
 {
-    const QString absFilePath = dir.dir.absoluteFilePath(dir.sumFile);
-    QTemporaryFile out;
+    // QSaveFile replaces the checksum file atomically, keeping its
+    // permissions; a new checksum file gets the permissions the umask allows
+    QSaveFile out(dir.dir.absoluteFilePath(dir.sumFile));
     QProcess p;
-    if (!out.open()) {
+    if (!out.open(QIODevice::WriteOnly)) {
         return QStringLiteral("Failed to open Temporary file.");
     }
     p.setWorkingDirectory(dir.dir.absolutePath());
-    p.setStandardOutputFile(out.fileName());
     const QString program = dir.checksumDefinition->createCommand();
     dir.checksumDefinition->startCreateCommand(&p, dir.inputFiles);
+    while (p.waitForReadyRead()) {
+        out.write(p.readAllStandardOutput());
+    }
     p.waitForFinished();
+    out.write(p.readAllStandardOutput());
     qCDebug(KLEOPATRA_LOG) << "[" << &p << "] Exit code " << p.exitCode();
 
     if (p.exitStatus() != QProcess::NormalExit || p.exitCode() != 0) {
@@ -611,14 +580,52 @@ static QString process(const Dir &dir, bool *fatal)
         }
     }
 
-    QFileInfo fi(absFilePath);
-    if (!(fi.exists() && !QFile::remove(absFilePath)) && QFile::copy(out.fileName(), absFilePath)) {
+    if (out.commit()) {
         return QString();
     }
 
     return xi18n("Failed to overwrite <filename>%1</filename>.", dir.sumFile);
 }
 
+static QString write_sum_file(const Dir &dir, std::vector<ChecksumEngine::Result>::const_iterator results)
+{
+    const auto end = results + dir.inputFiles.size();
+    const auto failed = std::find_if(results, end, [](const ChecksumEngine::Result &result) {
+                                                       return !result.errorString.isEmpty();
+                                                   });
+    if (failed != end) {
+        return failed->errorString;
+    }
+
+    QSaveFile out(dir.dir.absoluteFilePath(dir.sumFile));
+    if (out.open(QIODevice::WriteOnly)) {
+        for (const QString &file : dir.inputFiles) {
+            out.write(ChecksumEngine::formatLine(file, results->checksum, !HAVE_UNIX));
+            ++results;
+        }
+        if (out.commit()) {
+            return QString();
+        }
+    }
+
+    return xi18n("Failed to overwrite <filename>%1</filename>.", dir.sumFile);
+}
+
+static void update_checksum_cache(const Dir &dir, QCryptographicHash::Algorithm algorithm,
+                                  std::vector<ChecksumEngine::Result>::const_iterator results,
+                                  std::vector<ChecksumCache::Stamp>::const_iterator stamps)
+{
+    ChecksumCache cache(dir.dir.absoluteFilePath(dir.sumFile), algorithm);
+    for (const QString &file : dir.inputFiles) {
+        cache.insert(file, *stamps, results->checksum);
+        ++results;
+        ++stamps;
+    }
+    if (!cache.save()) {
+        qCDebug(KLEOPATRA_LOG) << "failed to save checksum cache for" << dir.dir.absoluteFilePath(dir.sumFile);
+    }
+}
+
 namespace
 {
 static QDebug operator<<(QDebug s, const Dir &dir)
@@ -636,6 +643,8 @@ void CreateChecksumsController::Private::run()
     const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions = this->checksumDefinitions;
     const std::shared_ptr<ChecksumDefinition> checksumDefinition = this->checksumDefinition;
     const bool allowAddition = this->allowAddition;
+    const bool useBuiltinEngine = this->useBuiltinEngine;
+    const bool incremental = this->incremental;
 
     locker.unlock();
 
@@ -686,18 +695,109 @@ void CreateChecksumsController::Private::run()
             const quint64 factor = total / std::numeric_limits<int>::max() + 1;
 
             quint64 done = 0;
+
+            // Step 2a: hash the files of all directories using well-known
+            // checksum programs in one go, so the worker pool is kept busy
+            // across directory boundaries. In incremental mode, files which
+            // didn't change since the sum file was written are not rehashed:
+
+            std::vector<const Dir *> builtinDirs, externalDirs;
+            std::vector<QCryptographicHash::Algorithm> algorithms;
             for (const Dir &dir : dirs) {
+                QCryptographicHash::Algorithm algorithm;
+                if (useBuiltinEngine && ChecksumEngine::algorithmFor(dir.checksumDefinition, &algorithm)) {
+                    builtinDirs.push_back(&dir);
+                    algorithms.push_back(algorithm);
+                } else {
+                    externalDirs.push_back(&dir);
+                }
+            }
+
+            std::vector<ChecksumEngine::Result> results;
+            std::vector<ChecksumCache::Stamp> stamps;
+            std::vector<ChecksumEngine::Job> jobs;
+            std::vector<size_t> jobIndexes;
+            quint64 reused = 0;
+            for (size_t i = 0; i < builtinDirs.size() && !canceled; ++i) {
+                const Dir &dir = *builtinDirs[i];
+                QHash<QString, QByteArray> existing;
+                ChecksumCache cache(dir.dir.absoluteFilePath(dir.sumFile), algorithms[i]);
+                if (incremental && cache.load()) {
+                    const std::vector<SumFileEntry> parsed = parseSumFile(dir.dir.absoluteFilePath(dir.sumFile));
+                    for (const SumFileEntry &file : parsed) {
+                        existing.insert(file.name, file.checksum);
+                    }
+                }
+                for (const QString &file : dir.inputFiles) {
+                    const QString fileName = dir.dir.absoluteFilePath(file);
+                    const ChecksumCache::Stamp stamp = incremental ? ChecksumCache::stamp(fileName) : ChecksumCache::Stamp();
+                    const QByteArray checksum = cache.checksum(file, stamp);
+                    ChecksumEngine::Result result;
+                    if (!checksum.isEmpty() && existing.value(file).compare(checksum, Qt::CaseInsensitive) == 0) {
+                        result.checksum = checksum;
+                        reused += stamp.size;
+                    } else {
+                        jobIndexes.push_back(results.size());
+                        jobs.push_back({fileName, algorithms[i]});
+                    }
+                    results.push_back(result);
+                    stamps.push_back(stamp);
+                }
+            }
+
+            if (!results.empty()) {
+                const QString checksumming = i18np("Checksumming 1 file...", "Checksumming %1 files...", static_cast<int>(jobs.size()));
+                const ChecksumEngine engine;
+                const std::vector<ChecksumEngine::Result> jobResults
+                    = engine.run(jobs,
+                                 [this, done, reused, factor, total, &checksumming](quint64 bytes) {
+                                     Q_EMIT progress((done + reused + bytes) / factor, total / factor, checksumming);
+                                 },
+                                 [this]() { return canceled; });
+                for (size_t i = 0; i < jobResults.size(); ++i) {
+                    results[jobIndexes[i]] = jobResults[i];
+                }
+
+                auto begin = results.cbegin();
+                auto stamp = stamps.cbegin();
+                for (size_t i = 0; i < builtinDirs.size() && begin != results.cend(); ++i) {
+                    const Dir &dir = *builtinDirs[i];
+                    const auto end = begin + dir.inputFiles.size();
+                    // don't write sum files for directories that were only partially hashed
+                    if (std::all_of(begin, end, std::mem_fn(&ChecksumEngine::Result::isDone))) {
+                        const QString error = write_sum_file(dir, begin);
+                        if (!error.isEmpty()) {
+                            errors.push_back(error);
+                        } else {
+                            created.push_back(dir.dir.absoluteFilePath(dir.sumFile));
+                            if (incremental) {
+                                update_checksum_cache(dir, algorithms[i], begin, stamp);
+                            }
+                        }
+                        done += dir.totalSize;
+                    }
+                    begin = end;
+                    stamp += dir.inputFiles.size();
+                }
+            }
+
+            // Step 2b: run the checksum programs for all other directories:
+
+            for (const Dir *dir : externalDirs) {
+                if (canceled) {
+                    break;
+                }
                 Q_EMIT progress(done / factor, total / factor,
-                                i18n("Checksumming (%2) in %1", dir.checksumDefinition->label(), dir.dir.path()));
+                                i18n("Checksumming (%2) in %1", dir->checksumDefinition->label(), dir->dir.path()));
                 bool fatal = false;
-                const QString error = process(dir, &fatal);
+                const QString error = process(*dir, &fatal);
                 if (!error.isEmpty()) {
                     errors.push_back(error);
                 } else {
-                    created.push_back(dir.dir.absoluteFilePath(dir.sumFile));
+                    created.push_back(dir->dir.absoluteFilePath(dir->sumFile));
                 }
-                done += dir.totalSize;
-                if (fatal || canceled) {
+                done += dir->totalSize;
+                if (fatal) {
                     break;
                 }
             }
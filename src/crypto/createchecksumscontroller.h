@@ -35,6 +35,9 @@ public:
     void setAllowAddition(bool allow);
     bool allowAddition() const;
 
+    void setIncremental(bool incremental);
+    bool isIncremental() const;
+
     void setFiles(const QStringList &files);
 
     void start();
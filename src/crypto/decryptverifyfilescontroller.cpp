@@ -34,6 +34,8 @@
 #include <QPointer>
 #include <QTimer>
 
+#include <algorithm>
+#include <map>
 
 using namespace GpgME;
 using namespace Kleo;
@@ -67,9 +69,11 @@ public:
 
     QStringList m_passedFiles, m_filesAfterPreparation;
     QPointer<DecryptVerifyFilesWizard> m_wizard;
-    std::vector<std::shared_ptr<const DecryptVerifyResult> > m_results;
+    std::shared_ptr<TaskCollection> m_taskCollection;
+    std::map<int, std::shared_ptr<const DecryptVerifyResult> > m_results; // by task id, i.e. in input order
     std::vector<std::shared_ptr<Task> > m_runnableTasks, m_completedTasks;
-    std::shared_ptr<Task> m_runningTask;
+    std::vector<std::shared_ptr<Task> > m_runningTasks;
+    unsigned int m_maxRunningTasks;
     bool m_errorDetected;
     DecryptVerifyOperation m_operation;
 };
@@ -117,7 +121,8 @@ std::shared_ptr<AbstractDecryptVerifyTask> DecryptVerifyFilesController::Private
         const std::shared_ptr<Input> input = Input::createFromFile(fileName);
         const std::shared_ptr<Output> output =
             ad       ? ad->createOutputFromUnpackCommand(proto, fileName, outDir) :
-            /*else*/   Output::createFromFile(outDir.absoluteFilePath(outputFileName(QFileInfo(fileName).fileName())), overwritePolicy);
+            /*else*/   Output::createFromFile(outDir.absoluteFilePath(outputFileName(QFileInfo(fileName).fileName())), overwritePolicy,
+                                                 QFileInfo(fileName).size());
 
         if (mayBeCipherText(classification)) {
             qCDebug(KLEOPATRA_LOG) << "creating a DecryptVerifyTask";
@@ -142,7 +147,7 @@ std::shared_ptr<AbstractDecryptVerifyTask> DecryptVerifyFilesController::Private
     return task;
 }
 
-DecryptVerifyFilesController::Private::Private(DecryptVerifyFilesController *qq) : q(qq), m_errorDetected(false), m_operation(DecryptVerify)
+DecryptVerifyFilesController::Private::Private(DecryptVerifyFilesController *qq) : q(qq), m_maxRunningTasks(1), m_errorDetected(false), m_operation(DecryptVerify)
 {
     qRegisterMetaType<VerificationResult>();
 }
@@ -157,12 +162,19 @@ void DecryptVerifyFilesController::Private::slotWizardOperationPrepared()
     kleo_assert(m_runnableTasks.empty());
     m_runnableTasks.swap(tasks);
 
+    m_maxRunningTasks = Task::maxConcurrentTasks();
+
     std::shared_ptr<TaskCollection> coll(new TaskCollection);
     for (const auto &i: m_runnableTasks) {
         q->connectTask(i);
     }
     coll->setTasks(m_runnableTasks);
+    coll->setPreserveResultOrder(m_maxRunningTasks > 1);
     m_wizard->setTaskCollection(coll);
+    m_taskCollection = coll;
+
+    // schedule() takes tasks from the back
+    std::reverse(m_runnableTasks.begin(), m_runnableTasks.end());
 
     QTimer::singleShot(0, q, SLOT(schedule()));
 }
@@ -175,18 +187,21 @@ void DecryptVerifyFilesController::Private::slotWizardCanceled()
 void DecryptVerifyFilesController::doTaskDone(const Task *task, const std::shared_ptr<const Task::Result> &result)
 {
     Q_ASSERT(task);
-    Q_UNUSED(task)
 
     // We could just delete the tasks here, but we can't use
     // Qt::QueuedConnection here (we need sender()) and other slots
     // might not yet have executed. Therefore, we push completed tasks
     // into a burial container
 
-    d->m_completedTasks.push_back(d->m_runningTask);
-    d->m_runningTask.reset();
+    const auto it = std::find_if(d->m_runningTasks.begin(), d->m_runningTasks.end(),
+                                 [task](const std::shared_ptr<Task> &t) { return t.get() == task; });
+    if (it != d->m_runningTasks.end()) {
+        d->m_completedTasks.push_back(*it);
+        d->m_runningTasks.erase(it);
+    }
 
     if (const std::shared_ptr<const DecryptVerifyResult> &dvr = std::dynamic_pointer_cast<const DecryptVerifyResult>(result)) {
-        d->m_results.push_back(dvr);
+        d->m_results[task->id()] = dvr;
     }
 
     QTimer::singleShot(0, this, SLOT(schedule()));
@@ -194,16 +209,16 @@ void DecryptVerifyFilesController::doTaskDone(const Task *task, const std::share
 
 void DecryptVerifyFilesController::Private::schedule()
 {
-    if (!m_runningTask && !m_runnableTasks.empty()) {
+    while (m_runningTasks.size() < m_maxRunningTasks && !m_runnableTasks.empty()) {
         const std::shared_ptr<Task> t = m_runnableTasks.back();
         m_runnableTasks.pop_back();
+        m_runningTasks.push_back(t);
         t->start();
-        m_runningTask = t;
     }
-    if (!m_runningTask) {
+    if (m_runningTasks.empty()) {
         kleo_assert(m_runnableTasks.empty());
         for (const auto &i: m_results) {
-            Q_EMIT q->verificationResult(i->verificationResult());
+            Q_EMIT q->verificationResult(i.second->verificationResult());
         }
         q->emitDoneOrError();
     }
@@ -417,12 +432,19 @@ void DecryptVerifyFilesController::Private::cancelAllTasks()
 {
 
     // we just kill all runnable tasks - this will not result in
-    // signal emissions.
+    // signal emissions, so the collection must not wait for them.
+    if (m_taskCollection) {
+        for (const std::shared_ptr<Task> &t : std::as_const(m_runnableTasks)) {
+            m_taskCollection->skipTask(t->id());
+        }
+    }
     m_runnableTasks.clear();
 
     // a cancel() will result in a call to
-    if (m_runningTask) {
-        m_runningTask->cancel();
+    // doTaskDone(), which removes the task from m_runningTasks
+    const std::vector<std::shared_ptr<Task> > running = m_runningTasks;
+    for (const std::shared_ptr<Task> &t : running) {
+        t->cancel();
     }
 }
 
@@ -18,6 +18,8 @@
 
 #include "kleopatra_debug.h"
 
+#include "utils/indexedkeylistsortfilterproxymodel.h"
+
 #include <Libkleo/KeyCache>
 #include <Libkleo/KeyFilter>
 #include <Libkleo/KeyList>
@@ -84,7 +86,7 @@ CertificateLineEdit::CertificateLineEdit(AbstractKeyListModel *model,
                                          QWidget *parent,
                                          KeyFilter *filter)
     : QLineEdit(parent),
-      mFilterModel(new KeyListSortFilterProxyModel(this)),
+      mFilterModel(new IndexedKeyListSortFilterProxyModel(this)),
       mCompleterFilterModel(new ProxyModel(this)),
       mCompleter(new QCompleter(this)),
       mFilter(std::shared_ptr<KeyFilter>(filter)),
@@ -204,7 +206,7 @@ void CertificateLineEdit::updateKey()
         mLineAction->setToolTip(i18n("Open selection dialog."));
         setToolTip({});
     } else {
-        mFilterModel->setFilterFixedString(mailText);
+        mFilterModel->setStringFilter(mailText);
         if (mFilterModel->rowCount() > 1) {
             // keep current key or group if they still match
             if (!mKey.isNull()) {
@@ -26,6 +26,7 @@ namespace Kleo
 {
 class AbstractKeyListModel;
 class KeyFilter;
+class IndexedKeyListSortFilterProxyModel;
 class KeyListSortFilterProxyModel;
 
 /** Line edit and completion based Certificate Selection Widget.
@@ -89,7 +90,7 @@ private Q_SLOTS:
     void checkLocate();
 
 private:
-    KeyListSortFilterProxyModel *const mFilterModel;
+    IndexedKeyListSortFilterProxyModel *const mFilterModel;
     KeyListSortFilterProxyModel *const mCompleterFilterModel;
     QCompleter *mCompleter = nullptr;
     QLabel *mStatusLabel,
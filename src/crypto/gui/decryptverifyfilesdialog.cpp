@@ -181,6 +181,11 @@ QString DecryptVerifyFilesDialog::outputLocation() const
     return m_outputLocationFNR->fileName();
 }
 
+void DecryptVerifyFilesDialog::setOutputLocationEditable(bool editable)
+{
+    m_outputLocationFNR->setEnabled(editable);
+}
+
 void DecryptVerifyFilesDialog::btnClicked(QAbstractButton *btn)
 {
     if (m_buttonBox->buttonRole(btn) == QDialogButtonBox::DestructiveRole) {
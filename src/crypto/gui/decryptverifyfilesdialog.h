@@ -43,6 +43,7 @@ public:
 
     void setOutputLocation(const QString &dir);
     QString outputLocation() const;
+    void setOutputLocationEditable(bool editable);
 
 protected Q_SLOTS:
     void progress(const QString &msg, int progress, int total);
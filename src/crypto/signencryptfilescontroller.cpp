@@ -40,6 +40,8 @@
 #include <QFileInfo>
 #include <QDir>
 
+#include <deque>
+
 using namespace Kleo;
 using namespace Kleo::Crypto;
 using namespace GpgME;
@@ -69,14 +71,29 @@ private:
     }
 
     void schedule();
-    std::shared_ptr<SignEncryptTask> takeRunnable(GpgME::Protocol proto);
 
     static void assertValidOperation(unsigned int);
     static QString titleForOperation(unsigned int op);
 private:
-    std::vector< std::shared_ptr<SignEncryptTask> > runnable, completed;
-    std::shared_ptr<SignEncryptTask> cms, openpgp;
+    // the tasks of one protocol, which are started in order with
+    // at most maxRunningTasks of them running at the same time
+    struct TaskQueue {
+        std::deque< std::shared_ptr<SignEncryptTask> > runnable;
+        std::vector< std::shared_ptr<SignEncryptTask> > running;
+
+        void start(unsigned int maxRunningTasks);
+        std::shared_ptr<SignEncryptTask> takeRunning(const Task *task);
+        void cancel();
+        bool empty() const
+        {
+            return runnable.empty() && running.empty();
+        }
+    };
+    TaskQueue cms, openpgp;
+    std::vector< std::shared_ptr<SignEncryptTask> > completed;
+    unsigned int maxRunningTasks;
     QPointer<SignEncryptFilesWizard> wizard;
+    std::shared_ptr<TaskCollection> taskCollection;
     QStringList files;
     unsigned int operation;
     Protocol protocol;
@@ -84,10 +101,12 @@ private:
 
 SignEncryptFilesController::Private::Private(SignEncryptFilesController *qq)
     : q(qq),
-      runnable(),
       cms(),
       openpgp(),
+      completed(),
+      maxRunningTasks(1),
       wizard(),
+      taskCollection(),
       files(),
       operation(SignAllowed | EncryptAllowed | ArchiveAllowed),
       protocol(UnknownProtocol)
@@ -565,20 +584,27 @@ void SignEncryptFilesController::Private::slotWizardOperationPrepared()
             i->setOverwritePolicy(overwritePolicy);
         }
 
-        kleo_assert(runnable.empty());
+        kleo_assert(cms.empty() && openpgp.empty());
 
-        runnable.swap(tasks);
+        maxRunningTasks = Task::maxConcurrentTasks();
 
-        for (const auto &task : std::as_const(runnable)) {
+        for (const auto &task : std::as_const(tasks)) {
             q->connectTask(task);
+            // protocol() throws for tasks without signers, recipients or symmetric encryption
+            const Protocol protocol = task->protocol();
+            kleo_assert(protocol == CMS || protocol == OpenPGP);
+            (protocol == CMS ? cms : openpgp).runnable.push_back(task);
         }
 
         std::shared_ptr<TaskCollection> coll(new TaskCollection);
 
         std::vector<std::shared_ptr<Task> > tmp;
-        std::copy(runnable.begin(), runnable.end(), std::back_inserter(tmp));
+        std::copy(tasks.begin(), tasks.end(), std::back_inserter(tmp));
         coll->setTasks(tmp);
+        // the tasks of both protocols run at the same time
+        coll->setPreserveResultOrder(true);
         wizard->setTaskCollection(coll);
+        taskCollection = coll;
 
         QTimer::singleShot(0, q, SLOT(schedule()));
 
@@ -594,40 +620,53 @@ void SignEncryptFilesController::Private::slotWizardOperationPrepared()
     }
 }
 
-void SignEncryptFilesController::Private::schedule()
+void SignEncryptFilesController::Private::TaskQueue::start(unsigned int maxRunningTasks)
 {
-
-    if (!cms)
-        if (const std::shared_ptr<SignEncryptTask> t = takeRunnable(CMS)) {
-            t->start();
-            cms = t;
-        }
-
-    if (!openpgp)
-        if (const std::shared_ptr<SignEncryptTask> t = takeRunnable(OpenPGP)) {
-            t->start();
-            openpgp = t;
-        }
-
-    if (!cms && !openpgp) {
-        kleo_assert(runnable.empty());
-        q->emitDoneOrError();
+    while (running.size() < maxRunningTasks && !runnable.empty()) {
+        const std::shared_ptr<SignEncryptTask> t = runnable.front();
+        runnable.pop_front();
+        running.push_back(t);
+        t->start();
     }
 }
 
-std::shared_ptr<SignEncryptTask> SignEncryptFilesController::Private::takeRunnable(GpgME::Protocol proto)
+std::shared_ptr<SignEncryptTask> SignEncryptFilesController::Private::TaskQueue::takeRunning(const Task *task)
 {
-    const auto it = std::find_if(runnable.begin(), runnable.end(),
-                                 [proto](const std::shared_ptr<Task> &task) { return task->protocol() == proto; });
-    if (it == runnable.end()) {
+    const auto it = std::find_if(running.begin(), running.end(),
+                                 [task](const std::shared_ptr<SignEncryptTask> &t) { return t.get() == task; });
+    if (it == running.end()) {
         return std::shared_ptr<SignEncryptTask>();
     }
 
     const std::shared_ptr<SignEncryptTask> result = *it;
-    runnable.erase(it);
+    running.erase(it);
     return result;
 }
 
+void SignEncryptFilesController::Private::TaskQueue::cancel()
+{
+    // we just kill all runnable tasks - this will not result in
+    // signal emissions.
+    runnable.clear();
+
+    // a cancel() will result in a call to
+    const auto tasks = running;
+    for (const std::shared_ptr<SignEncryptTask> &t : tasks) {
+        t->cancel();
+    }
+}
+
+void SignEncryptFilesController::Private::schedule()
+{
+    cms.start(maxRunningTasks);
+    openpgp.start(maxRunningTasks);
+
+    if (cms.running.empty() && openpgp.running.empty()) {
+        kleo_assert(cms.runnable.empty() && openpgp.runnable.empty());
+        q->emitDoneOrError();
+    }
+}
+
 void SignEncryptFilesController::doTaskDone(const Task *task, const std::shared_ptr<const Task::Result> &result)
 {
     Q_UNUSED(result)
@@ -638,12 +677,10 @@ void SignEncryptFilesController::doTaskDone(const Task *task, const std::shared_
     // might not yet have executed. Therefore, we push completed tasks
     // into a burial container
 
-    if (task == d->cms.get()) {
-        d->completed.push_back(d->cms);
-        d->cms.reset();
-    } else if (task == d->openpgp.get()) {
-        d->completed.push_back(d->openpgp);
-        d->openpgp.reset();
+    if (const std::shared_ptr<SignEncryptTask> t = d->cms.takeRunning(task)) {
+        d->completed.push_back(t);
+    } else if (const std::shared_ptr<SignEncryptTask> t = d->openpgp.takeRunning(task)) {
+        d->completed.push_back(t);
     }
 
     QTimer::singleShot(0, this, SLOT(schedule()));
@@ -664,18 +701,17 @@ void SignEncryptFilesController::cancel()
 
 void SignEncryptFilesController::Private::cancelAllTasks()
 {
-
-    // we just kill all runnable tasks - this will not result in
-    // signal emissions.
-    runnable.clear();
-
-    // a cancel() will result in a call to
-    if (cms) {
-        cms->cancel();
-    }
-    if (openpgp) {
-        openpgp->cancel();
+    // runnable tasks are dropped without signal emissions, so the
+    // collection must not wait for their results
+    if (taskCollection) {
+        for (const TaskQueue *queue : {&cms, &openpgp}) {
+            for (const std::shared_ptr<SignEncryptTask> &t : queue->runnable) {
+                taskCollection->skipTask(t->id());
+            }
+        }
     }
+    cms.cancel();
+    openpgp.cancel();
 }
 
 void SignEncryptFilesController::Private::ensureWizardCreated()
@@ -456,7 +456,9 @@ void SignEncryptTask::doStart()
     kleo_assert(d->input);
 
     if (!d->output) {
-        d->output = Output::createFromFile(d->outputFileName, d->m_overwritePolicy);
+        // an encrypted or signed file is about as large as its input
+        const qint64 sizeHint = d->detached ? -1 : qint64(inputSize());
+        d->output = Output::createFromFile(d->outputFileName, d->m_overwritePolicy, sizeHint);
     }
 
     if (d->encrypt || d->symmetric) {
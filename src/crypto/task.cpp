@@ -11,6 +11,7 @@
 #include "task.h"
 #include "task_p.h"
 #include "kleopatra_debug.h"
+#include "fileoperationspreferences.h"
 
 #include <Libkleo/KleoException>
 
@@ -24,6 +25,8 @@
 #include <KIconLoader>
 #include <KLocalizedString>
 
+#include <QThread>
+
 
 using namespace Kleo;
 using namespace Kleo::Crypto;
@@ -152,6 +155,13 @@ void Task::setProgress(const QString &label, int processed, int total)
     Q_EMIT progress(label, processed, total, QPrivateSignal());
 }
 
+// static
+unsigned int Task::maxConcurrentTasks()
+{
+    const int configured = FileOperationsPreferences().maxConcurrentTasks();
+    return static_cast<unsigned int>(qMax(1, configured > 0 ? configured : QThread::idealThreadCount()));
+}
+
 void Task::start()
 {
     try {
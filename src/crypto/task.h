@@ -57,6 +57,12 @@ public:
 
     static std::shared_ptr<Task> makeErrorTask(int code, const QString &details, const QString &label);
 
+    /**
+     * Returns how many tasks a controller should run at the same time,
+     * as configured by the user, or the number of processor cores.
+     */
+    static unsigned int maxConcurrentTasks();
+
 public Q_SLOTS:
     virtual void cancel() = 0;
 
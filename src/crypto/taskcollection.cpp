@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <map>
+#include <set>
 
 #include <cmath>
 
@@ -38,6 +39,8 @@ public:
     void taskResult(const std::shared_ptr<const Task::Result> &);
     void taskStarted();
     void calculateAndEmitProgress();
+    void emitPendingResults();
+    void emitDoneIfAllTasksCompleted();
 
     std::map<int, std::shared_ptr<Task> > m_tasks;
     mutable quint64 m_totalProgress;
@@ -47,6 +50,12 @@ public:
     QString m_lastProgressMessage;
     bool m_errorOccurred;
     bool m_doneEmitted;
+    bool m_preserveResultOrder;
+    std::vector<int> m_order;
+    std::map<int, size_t> m_positions;
+    std::map<int, std::shared_ptr<const Task::Result> > m_pendingResults;
+    std::set<int> m_skippedTasks;
+    size_t m_nextResult;
 };
 
 TaskCollection::Private::Private(TaskCollection *qq):
@@ -56,7 +65,9 @@ TaskCollection::Private::Private(TaskCollection *qq):
     m_nCompleted(0),
     m_nErrors(0),
     m_errorOccurred(false),
-    m_doneEmitted(false)
+    m_doneEmitted(false),
+    m_preserveResultOrder(false),
+    m_nextResult(0)
 {
 }
 
@@ -93,7 +104,41 @@ void TaskCollection::Private::taskResult(const std::shared_ptr<const Task::Resul
     }
     m_lastProgressMessage.clear();
     calculateAndEmitProgress();
-    Q_EMIT q->result(result);
+
+    const Task *const task = qobject_cast<Task *>(q->sender());
+    if (!m_preserveResultOrder || !task || m_positions[task->id()] < m_nextResult) {
+        Q_EMIT q->result(result);
+    } else {
+        // hold the result back until the results of all preceding tasks have been emitted
+        m_pendingResults[task->id()] = result;
+        emitPendingResults();
+    }
+
+    emitDoneIfAllTasksCompleted();
+}
+
+void TaskCollection::Private::emitPendingResults()
+{
+    while (m_nextResult < m_order.size()) {
+        const int id = m_order[m_nextResult];
+        if (m_skippedTasks.find(id) != m_skippedTasks.end()) {
+            // this task will never report a result
+            ++m_nextResult;
+            continue;
+        }
+        const auto it = m_pendingResults.find(id);
+        if (it == m_pendingResults.end()) {
+            break;
+        }
+        const std::shared_ptr<const Task::Result> next = it->second;
+        m_pendingResults.erase(it);
+        ++m_nextResult;
+        Q_EMIT q->result(next);
+    }
+}
+
+void TaskCollection::Private::emitDoneIfAllTasksCompleted()
+{
     if (!m_doneEmitted && q->allTasksCompleted()) {
         Q_EMIT q->done();
         m_doneEmitted = true;
@@ -215,6 +260,8 @@ void TaskCollection::setTasks(const std::vector<std::shared_ptr<Task> > &tasks)
     for (const std::shared_ptr<Task> &i : tasks) {
         Q_ASSERT(i);
         d->m_tasks[i->id()] = i;
+        d->m_positions[i->id()] = d->m_order.size();
+        d->m_order.push_back(i->id());
         connect(i.get(), SIGNAL(progress(QString,int,int)),
                 this, SLOT(taskProgress(QString,int,int)));
         connect(i.get(), SIGNAL(result(std::shared_ptr<const Kleo::Crypto::Task::Result>)),
@@ -224,4 +271,28 @@ void TaskCollection::setTasks(const std::vector<std::shared_ptr<Task> > &tasks)
     }
 }
 
+void TaskCollection::setPreserveResultOrder(bool preserve)
+{
+    d->m_preserveResultOrder = preserve;
+}
+
+bool TaskCollection::preserveResultOrder() const
+{
+    return d->m_preserveResultOrder;
+}
+
+void TaskCollection::skipTask(int id)
+{
+    if (d->m_tasks.find(id) == d->m_tasks.end() || !d->m_skippedTasks.insert(id).second) {
+        return;
+    }
+    // a skipped task counts as completed with an error, like a canceled one
+    ++d->m_nCompleted;
+    ++d->m_nErrors;
+    d->m_errorOccurred = true;
+
+    d->emitPendingResults();
+    d->emitDoneIfAllTasksCompleted();
+}
+
 #include "moc_taskcollection.cpp"
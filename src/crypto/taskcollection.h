@@ -36,6 +36,22 @@ public:
 
     void setTasks(const std::vector<std::shared_ptr<Task> > &tasks);
 
+    /**
+     * If set, result() is emitted in the order in which the tasks were
+     * passed to setTasks(), regardless of the order in which they finish.
+     * Use this when running several tasks concurrently.
+     */
+    void setPreserveResultOrder(bool preserve);
+    bool preserveResultOrder() const;
+
+    /**
+     * Tells the collection that the task with the given \a id will not
+     * report a result, e.g. because it was canceled before it was
+     * started. The task counts as completed, and the results of the
+     * following tasks are no longer held back for it.
+     */
+    void skipTask(int id);
+
     bool isEmpty() const;
     size_t size() const;
 
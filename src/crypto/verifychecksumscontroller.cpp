@@ -13,10 +13,14 @@
 
 #ifndef QT_NO_DIRMODEL
 
+#include "fileoperationspreferences.h"
+
 #include <crypto/gui/verifychecksumsdialog.h>
 
+#include <utils/checksumengine.h>
 #include <utils/input.h>
 #include <utils/output.h>
+#include <utils/sumfile.h>
 #include <utils/kleo_assert.h>
 
 #include <Libkleo/Stl_Util>
@@ -38,6 +42,7 @@
 
 #include <deque>
 #include <limits>
+#include <map>
 #include <set>
 
 using namespace Kleo;
@@ -153,6 +158,7 @@ private:
     const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions;
     QStringList files;
     QStringList errors;
+    bool useBuiltinEngine;
     volatile bool canceled;
 };
 
@@ -163,6 +169,7 @@ VerifyChecksumsController::Private::Private(VerifyChecksumsController *qq)
       checksumDefinitions(ChecksumDefinition::getChecksumDefinitions()),
       files(),
       errors(),
+      useBuiltinEngine(true),
       canceled(false)
 {
     connect(this, &Private::progress,
@@ -220,6 +227,7 @@ void VerifyChecksumsController::start()
         connect(d.get(), &Private::status,
                 d->dialog.data(), &VerifyChecksumsDialog::setStatus);
 
+        d->useBuiltinEngine = FileOperationsPreferences().useBuiltinChecksumEngine();
         d->canceled = false;
         d->errors.clear();
     }
@@ -243,6 +251,7 @@ namespace
 struct SumFile {
     QDir dir;
     QString sumFile;
+    std::vector<SumFileEntry> files;
     quint64 totalSize;
     std::shared_ptr<ChecksumDefinition> checksumDefinition;
 };
@@ -257,64 +266,6 @@ static QStringList filter_checksum_files(QStringList l, const QList<QRegExp> &rx
     return l;
 }
 
-namespace
-{
-struct File {
-    QString name;
-    QByteArray checksum;
-    bool binary;
-};
-}
-
-static QString decode(const QString &encoded)
-{
-    QString decoded;
-    decoded.reserve(encoded.size());
-    bool shift = false;
-    for (const QChar &ch : encoded)
-        if (shift) {
-            switch (ch.toLatin1()) {
-            case '\\': decoded += QLatin1Char('\\'); break;
-            case 'n':  decoded += QLatin1Char('\n'); break;
-            default:
-                qCDebug(KLEOPATRA_LOG) << "invalid escape sequence" << '\\' << ch << "(interpreted as '" << ch << "')";
-                decoded += ch;
-                break;
-            }
-            shift = false;
-        } else {
-            if (ch == QLatin1Char('\\')) {
-                shift = true;
-            } else {
-                decoded += ch;
-            }
-        }
-    return decoded;
-}
-
-static std::vector<File> parse_sum_file(const QString &fileName)
-{
-    std::vector<File> files;
-    QFile f(fileName);
-    if (f.open(QIODevice::ReadOnly)) {
-        QTextStream s(&f);
-        QRegExp rx(QLatin1String("(\\?)([a-f0-9A-F]+) ([ *])([^\n]+)\n*"));
-        while (!s.atEnd()) {
-            const QString line = s.readLine();
-            if (rx.exactMatch(line)) {
-                Q_ASSERT(!rx.cap(4).endsWith(QLatin1Char('\n')));
-                const File file = {
-                    rx.cap(1) == QLatin1String("\\") ? decode(rx.cap(4)) : rx.cap(4),
-                    rx.cap(2).toLatin1(),
-                    rx.cap(3) == QLatin1String("*"),
-                };
-                files.push_back(file);
-            }
-        }
-    }
-    return files;
-}
-
 static quint64 aggregate_size(const QDir &dir, const QStringList &files)
 {
     quint64 n = 0;
@@ -359,10 +310,10 @@ struct sumfile_contains_file : std::unary_function<QString, bool> {
         : dir(dir_), fileName(fileName_) {}
     bool operator()(const QString &sumFile) const
     {
-        const std::vector<File> files = parse_sum_file(dir.absoluteFilePath(sumFile));
+        const std::vector<SumFileEntry> files = parseSumFile(dir.absoluteFilePath(sumFile));
         qCDebug(KLEOPATRA_LOG) << "find_sums_by_input_files:      found " << files.size()
                                << " files listed in " << qPrintable(dir.absoluteFilePath(sumFile));
-        for (const File &file : files) {
+        for (const SumFileEntry &file : files) {
             const bool isSameFileName = (QString::compare(file.name, fileName, fs_cs) == 0);
             qCDebug(KLEOPATRA_LOG) << "find_sums_by_input_files:        "
                                    << qPrintable(file.name) << " == "
@@ -496,18 +447,19 @@ static std::vector<SumFile> find_sums_by_input_files(const QStringList &files, Q
 
         for (const QString &sumFileName : std::as_const(it->second)) {
 
-            const std::vector<File> summedfiles = parse_sum_file(dir.absoluteFilePath(sumFileName));
+            std::vector<SumFileEntry> summedfiles = parseSumFile(dir.absoluteFilePath(sumFileName));
             QStringList files;
             files.reserve(summedfiles.size());
             std::transform(summedfiles.cbegin(), summedfiles.cend(),
-                           std::back_inserter(files), std::mem_fn(&File::name));
-            const SumFile sumFile = {
+                           std::back_inserter(files), std::mem_fn(&SumFileEntry::name));
+            SumFile sumFile = {
                 it->first,
                 sumFileName,
+                std::move(summedfiles),
                 aggregate_size(it->first, files),
                 filename2definition(sumFileName, checksumDefinitions),
             };
-            sumfiles.push_back(sumFile);
+            sumfiles.push_back(std::move(sumFile));
 
         }
 
@@ -610,6 +562,7 @@ void VerifyChecksumsController::Private::run()
 
     const QStringList files = this->files;
     const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions = this->checksumDefinitions;
+    const bool useBuiltinEngine = this->useBuiltinEngine;
 
     locker.unlock();
 
@@ -657,16 +610,80 @@ void VerifyChecksumsController::Private::run()
             const quint64 factor = total / std::numeric_limits<int>::max() + 1;
 
             quint64 done = 0;
+
+            // Step 2a: verify all sum files using well-known checksum
+            // programs in one go, fanning the listed files out over the
+            // worker pool and reporting the status of each file as soon
+            // as it has been hashed:
+
+            std::vector<const SumFile *> externalSumFiles;
+            std::vector<ChecksumEngine::Job> jobs;
+            std::vector<std::pair<const SumFile *, const SumFileEntry *>> entries;
+            quint64 builtinSize = 0;
             for (const SumFile &sumFile : sumfiles) {
+                QCryptographicHash::Algorithm algorithm;
+                if (useBuiltinEngine && ChecksumEngine::algorithmFor(sumFile.checksumDefinition, &algorithm)) {
+                    for (const SumFileEntry &file : sumFile.files) {
+                        jobs.push_back({sumFile.dir.absoluteFilePath(file.name), algorithm});
+                        entries.push_back(std::make_pair(&sumFile, &file));
+                    }
+                    builtinSize += sumFile.totalSize;
+                } else {
+                    externalSumFiles.push_back(&sumFile);
+                }
+            }
+
+            if (!jobs.empty()) {
+                const QString verifying = i18np("Verifying the checksum of 1 file...", "Verifying the checksums of %1 files...",
+                                                static_cast<int>(jobs.size()));
+                const auto matches = [&entries](size_t idx, const ChecksumEngine::Result &result) {
+                    return result.checksum.compare(entries[idx].second->checksum, Qt::CaseInsensitive) == 0;
+                };
+                const ChecksumEngine engine;
+                const std::vector<ChecksumEngine::Result> results
+                    = engine.run(jobs,
+                                 [this, done, factor, total, &verifying](quint64 bytes) {
+                                     Q_EMIT progress((done + bytes) / factor, total / factor, verifying);
+                                 },
+                                 [this]() { return canceled; },
+                                 [this, &jobs, &matches](size_t idx, const ChecksumEngine::Result &result) {
+                                     Q_EMIT status(jobs[idx].fileName,
+                                                   !result.errorString.isEmpty() ? VerifyChecksumsDialog::Error :
+                                                   matches(idx, result) ? VerifyChecksumsDialog::OK :
+                                                   VerifyChecksumsDialog::Failed);
+                                 });
+
+                std::map<const SumFile *, int> mismatches;
+                for (size_t idx = 0; idx < results.size(); ++idx) {
+                    const ChecksumEngine::Result &result = results[idx];
+                    if (!result.errorString.isEmpty()) {
+                        errors.push_back(result.errorString);
+                    } else if (result.isDone() && !matches(idx, result)) {
+                        ++mismatches[entries[idx].first];
+                    }
+                }
+                for (const auto &mismatch : mismatches) {
+                    errors.push_back(i18np("%2: 1 computed checksum did not match", "%2: %1 computed checksums did not match",
+                                           mismatch.second, mismatch.first->dir.absoluteFilePath(mismatch.first->sumFile)));
+                }
+                done += builtinSize;
+            }
+
+            // Step 2b: run the verify programs for all other sum files:
+
+            for (const SumFile *sumFile : externalSumFiles) {
+                if (canceled) {
+                    break;
+                }
                 Q_EMIT progress(done / factor, total / factor,
-                                i18n("Verifying checksums (%2) in %1", sumFile.checksumDefinition->label(), sumFile.dir.path()));
+                                i18n("Verifying checksums (%2) in %1", sumFile->checksumDefinition->label(), sumFile->dir.path()));
                 bool fatal = false;
-                const QString error = process(sumFile, &fatal, env, statusCb);
+                const QString error = process(*sumFile, &fatal, env, statusCb);
                 if (!error.isEmpty()) {
                     errors.push_back(error);
                 }
-                done += sumFile.totalSize;
-                if (fatal || canceled) {
+                done += sumFile->totalSize;
+                if (fatal) {
                     break;
                 }
             }
@@ -24,6 +24,7 @@
 
 #include <Libkleo/GnuPG>
 #include <utils/kdpipeiodevice.h>
+#include <utils/keycacheupdater.h>
 #include <utils/log.h>
 
 #include <gpgme++/key.h>
@@ -148,6 +149,7 @@ public:
     std::shared_ptr<KeyCache> keyCache;
     std::shared_ptr<Log> log;
     std::shared_ptr<FileSystemWatcher> watcher;
+    std::unique_ptr<KeyCacheUpdater> keyCacheUpdater;
 
 public:
     void setupKeyCache()
@@ -158,7 +160,12 @@ public:
         watcher->whitelistFiles(gnupgFileWhitelist());
         watcher->addPath(gnupgHomeDirectory());
         watcher->setDelay(1000);
+        // the key cache pauses the watcher during its own reloads, but the
+        // changes are handled by the updater, which updates only the
+        // certificates changed by Kleopatra, if possible
         keyCache->addFileSystemWatcher(watcher);
+        QObject::disconnect(watcher.get(), nullptr, keyCache.get(), nullptr);
+        keyCacheUpdater.reset(new KeyCacheUpdater(keyCache, watcher));
         keyCache->setGroupsConfig(QStringLiteral("kleopatragroupsrc"));
         keyCache->setGroupsEnabled(Settings().groupsEnabled());
     }
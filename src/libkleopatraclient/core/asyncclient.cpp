@@ -0,0 +1,341 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    asyncclient.cpp
+
+    This file is part of KleopatraClient, the Kleopatra interface library
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "asyncclient_p.h"
+
+#include "libkleopatraclientcore_debug.h"
+
+#include <KLocalizedString>
+
+#include <QEventLoop>
+#include <QTimer>
+
+#ifdef Q_OS_WIN
+# include <QFile>
+# include <QHostAddress>
+# include <QTcpSocket>
+#else
+# include <QLocalSocket>
+#endif
+
+#include <climits>
+
+using namespace KleopatraClientCopy;
+
+// maximum length of an Assuan line, including the line terminator
+static const int ASSUAN_LINE_LENGTH = 1000;
+
+static int hex_value(char ch)
+{
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+static QByteArray unescape(const char *begin, const char *end)
+{
+    QByteArray result;
+    result.reserve(end - begin);
+    for (const char *it = begin; it != end; ++it) {
+        if (*it == '%' && end - it >= 3) {
+            const int hi = hex_value(it[1]);
+            const int lo = hex_value(it[2]);
+            if (hi >= 0 && lo >= 0) {
+                result += char(hi << 4 | lo);
+                it += 2;
+                continue;
+            }
+        }
+        result += *it;
+    }
+    return result;
+}
+
+AsyncClient::AsyncClient(QObject *parent)
+    : QObject(parent),
+      m_socket(nullptr),
+      m_state(Idle),
+      m_steps(),
+      m_socketName(),
+      m_startServer(),
+      m_serverStarted(false),
+      m_retries(0),
+      m_errorString()
+{
+
+}
+
+AsyncClient::~AsyncClient()
+{
+    dropSocket();
+}
+
+void AsyncClient::addStep(const Step &step)
+{
+    m_steps.push_back(step);
+}
+
+void AsyncClient::insertSteps(const std::vector<Step> &steps)
+{
+    // the step currently being processed is already popped off the queue
+    m_steps.insert(m_steps.begin(), steps.begin(), steps.end());
+}
+
+void AsyncClient::start(const QString &socketName, const std::function<QString()> &startServer)
+{
+    if (isRunning()) {
+        return;
+    }
+    m_socketName = socketName;
+    m_startServer = startServer;
+    m_serverStarted = false;
+    m_retries = 0;
+    m_errorString.clear();
+    connectToServer();
+}
+
+bool AsyncClient::isRunning() const
+{
+    return m_state != Idle;
+}
+
+bool AsyncClient::waitForFinished(unsigned long ms)
+{
+    if (!isRunning()) {
+        return true;
+    }
+    QEventLoop loop;
+    connect(this, &AsyncClient::finished, &loop, &QEventLoop::quit);
+    if (ms != ULONG_MAX) {
+        QTimer::singleShot(ms > INT_MAX ? INT_MAX : int(ms), &loop, &QEventLoop::quit);
+    }
+    loop.exec(QEventLoop::ExcludeUserInputEvents);
+    return !isRunning();
+}
+
+QString AsyncClient::errorString() const
+{
+    return m_errorString;
+}
+
+void AsyncClient::connectToServer()
+{
+    dropSocket();
+    m_state = Connecting;
+
+#ifdef Q_OS_WIN
+    // Assuan's socket emulation: the socket file contains the TCP port
+    // followed by a nonce the client has to send first
+    QFile f(m_socketName);
+    if (!f.open(QIODevice::ReadOnly)) {
+        connectionFailed(f.errorString());
+        return;
+    }
+    const quint16 port = f.readLine().trimmed().toUShort();
+    const QByteArray nonce = f.read(16);
+    if (!port || nonce.size() != 16) {
+        connectionFailed(i18n("Invalid socket file"));
+        return;
+    }
+    auto socket = new QTcpSocket(this);
+    connect(socket, &QTcpSocket::connected, this, [this, socket, nonce]() {
+        socket->write(nonce);
+        slotConnected();
+    });
+    connect(socket, &QTcpSocket::errorOccurred, this, &AsyncClient::slotError);
+    m_socket = socket;
+    connect(socket, &QIODevice::readyRead, this, &AsyncClient::slotReadyRead);
+    socket->connectToHost(QHostAddress::LocalHost, port);
+#else
+    auto socket = new QLocalSocket(this);
+    connect(socket, &QLocalSocket::connected, this, &AsyncClient::slotConnected);
+    connect(socket, &QLocalSocket::errorOccurred, this, &AsyncClient::slotError);
+    m_socket = socket;
+    connect(socket, &QIODevice::readyRead, this, &AsyncClient::slotReadyRead);
+    socket->connectToServer(m_socketName);
+#endif
+}
+
+void AsyncClient::connectionFailed(const QString &reason)
+{
+    dropSocket();
+    if (!m_serverStarted) {
+        m_serverStarted = true;
+        qDebug("UI server not running, starting it");
+        const QString errorString = m_startServer ? m_startServer() : QString();
+        if (!errorString.isEmpty()) {
+            finish(errorString);
+            return;
+        }
+    }
+    // give it a bit of time to start up and try a couple of times
+    if (m_retries++ < 20) {
+        QTimer::singleShot(500, this, &AsyncClient::connectToServer);
+    } else {
+        finish(i18n("Could not connect to Kleopatra UI server at %1: %2", m_socketName, reason));
+    }
+}
+
+void AsyncClient::slotConnected()
+{
+    m_state = Greeting;
+}
+
+void AsyncClient::slotError()
+{
+    const QString reason = m_socket ? m_socket->errorString() : QString();
+    switch (m_state) {
+    case Idle:
+    case Finishing:
+        return;
+    case Connecting:
+        connectionFailed(reason);
+        return;
+    default:
+        finish(i18n("Lost connection to Kleopatra UI server at %1: %2", m_socketName, reason));
+        return;
+    }
+}
+
+void AsyncClient::slotReadyRead()
+{
+    // handleLine() may finish and drop the socket
+    while (m_socket && m_socket->canReadLine()) {
+        QByteArray line = m_socket->readLine();
+        while (line.endsWith('\n') || line.endsWith('\r')) {
+            line.chop(1);
+        }
+        handleLine(line);
+    }
+}
+
+void AsyncClient::handleLine(const QByteArray &line)
+{
+    const bool ok = line == "OK" || line.startsWith("OK ");
+    const bool err = line.startsWith("ERR ");
+
+    if (m_state == Greeting) {
+        if (ok) {
+            m_state = Ready;
+            sendNext();
+        } else if (err) {
+            finish(i18n("Could not connect to Kleopatra UI server at %1: %2",
+                        m_socketName, QString::fromUtf8(line.mid(4))));
+        }
+        return;
+    }
+
+    if (m_state != Waiting) {
+        qCDebug(LIBKLEOPATRACLIENTCORE_LOG) << "unexpected line from server:" << line;
+        return;
+    }
+
+    if (ok) {
+        complete(0);
+    } else if (err) {
+        const gpg_error_t code = line.mid(4).split(' ').front().toUInt();
+        complete(code ? code : gpg_error(GPG_ERR_GENERAL));
+    } else if (line.startsWith("D ")) {
+        const Step &step = m_steps.front();
+        if (step.data) {
+            step.data(unescape(line.constData() + 2, line.constData() + line.size()));
+        }
+    } else if (line.startsWith("INQUIRE ")) {
+        sendInquireData(line.mid(8).split(' ').front());
+    }
+    // ignore status lines and comments
+}
+
+void AsyncClient::sendNext()
+{
+    if (m_steps.empty()) {
+        finish(QString());
+        return;
+    }
+    m_state = Waiting;
+    m_socket->write(m_steps.front().line + '\n');
+}
+
+void AsyncClient::complete(gpg_error_t err)
+{
+    const Step step = std::move(m_steps.front());
+    m_steps.pop_front();
+    m_state = Ready;
+    const bool proceed = step.done ? step.done(err) : !err;
+    if (proceed) {
+        sendNext();
+    } else {
+        finish(QString());
+    }
+}
+
+void AsyncClient::sendInquireData(const QByteArray &keyword)
+{
+    const Step &step = m_steps.front();
+    if (step.inquireData) {
+        const auto it = step.inquireData->find(keyword.toStdString());
+        if (it != step.inquireData->end()) {
+            const QByteArray &data = it->second;
+            QByteArray line = "D ";
+            for (const char ch : data) {
+                if (ch == '%' || ch == '\r' || ch == '\n') {
+                    static const char hex[] = "0123456789ABCDEF";
+                    line += '%';
+                    line += hex[(uchar(ch) & 0xF0) >> 4];
+                    line += hex[(uchar(ch) & 0x0F)];
+                } else {
+                    line += ch;
+                }
+                if (line.size() >= ASSUAN_LINE_LENGTH - 4) {
+                    m_socket->write(line + '\n');
+                    line = "D ";
+                }
+            }
+            if (line.size() > 2) {
+                m_socket->write(line + '\n');
+            }
+        }
+    }
+    m_socket->write("END\n");
+}
+
+void AsyncClient::finish(const QString &errorString)
+{
+    m_errorString = errorString;
+    m_state = Finishing;
+    m_steps.clear();
+    dropSocket();
+    // we are usually called from slotReadyRead(); a receiver of finished()
+    // may delete us, so the signal must not be emitted from there
+    QMetaObject::invokeMethod(this, [this]() {
+        m_state = Idle;
+        Q_EMIT finished();
+    }, Qt::QueuedConnection);
+}
+
+void AsyncClient::dropSocket()
+{
+    if (!m_socket) {
+        return;
+    }
+    // we might be called from a signal of the socket
+    m_socket->disconnect(this);
+    m_socket->close();
+    m_socket->deleteLater();
+    m_socket = nullptr;
+}
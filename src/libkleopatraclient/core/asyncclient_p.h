@@ -0,0 +1,106 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    asyncclient_p.h
+
+    This file is part of KleopatraClient, the Kleopatra interface library
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+
+#include <gpg-error.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class QIODevice;
+
+namespace KleopatraClientCopy
+{
+
+/**
+ * A non-blocking Assuan client driven by the event loop of the thread it
+ * lives in. It connects to the UI server and sends a queue of Assuan
+ * commands ("steps") one after another, answering inquiries from the
+ * server with the data given for the step.
+ */
+class AsyncClient : public QObject
+{
+    Q_OBJECT
+public:
+    struct Step {
+        // the command line, without the line terminator
+        QByteArray line;
+        // called with the (unescaped) data lines sent by the server
+        std::function<void(const QByteArray &)> data;
+        // data for INQUIREs of the server, by keyword
+        std::shared_ptr<const std::map<std::string, QByteArray>> inquireData;
+        // called with the result of the command; returns false to stop
+        // processing. If not set, processing stops on errors.
+        std::function<bool(gpg_error_t)> done;
+    };
+
+    explicit AsyncClient(QObject *parent = nullptr);
+    ~AsyncClient() override;
+
+    void addStep(const Step &step);
+    // inserts steps before all steps not yet sent
+    void insertSteps(const std::vector<Step> &steps);
+
+    // connects to the server at socketName, calling startServer once if
+    // nobody listens there, and processes the steps
+    void start(const QString &socketName, const std::function<QString()> &startServer);
+    bool isRunning() const;
+    // runs a local event loop until finished() or until ms milliseconds passed
+    bool waitForFinished(unsigned long ms);
+
+    // an error in talking to the server (errors of steps go to their done())
+    QString errorString() const;
+
+Q_SIGNALS:
+    void finished();
+
+private:
+    void connectToServer();
+    void connectionFailed(const QString &reason);
+    void slotConnected();
+    void slotError();
+    void slotReadyRead();
+    void handleLine(const QByteArray &line);
+    void sendNext();
+    void complete(gpg_error_t err);
+    void sendInquireData(const QByteArray &keyword);
+    void finish(const QString &errorString);
+    void dropSocket();
+
+private:
+    enum State {
+        Idle,
+        Connecting,
+        Greeting,
+        Ready,
+        Waiting,
+        // finished() is about to be emitted
+        Finishing
+    };
+
+    QIODevice *m_socket;
+    State m_state;
+    std::deque<Step> m_steps;
+    QString m_socketName;
+    std::function<QString()> m_startServer;
+    bool m_serverStarted;
+    int m_retries;
+    QString m_errorString;
+};
+
+}
+
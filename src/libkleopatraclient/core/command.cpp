@@ -11,6 +11,8 @@
 
 #include "command.h"
 #include "command_p.h"
+#include "session_p.h"
+#include "asyncclient_p.h"
 
 #include <QtGlobal> // Q_OS_WIN
 
@@ -27,6 +29,7 @@
 #include <QFile>
 #include "libkleopatraclientcore_debug.h"
 #include <QDir>
+#include <QElapsedTimer>
 #include <QProcess>
 #include <KLocalizedString>
 
@@ -35,10 +38,9 @@
 #include <gpgme++/global.h>
 
 #include <algorithm>
+#include <climits>
 #include <string>
 #include <sstream>
-#include <memory>
-#include <type_traits>
 
 using namespace KleopatraClientCopy;
 
@@ -145,13 +147,22 @@ QString Command::serverLocation() const
     return d->outputs.serverLocation;
 }
 
+void Command::setSession(const Session &session)
+{
+    const QMutexLocker locker(&d->mutex);
+    d->inputs.session = session.d;
+}
+
 bool Command::waitForFinished()
 {
-    return d->wait();
+    return waitForFinished(ULONG_MAX);
 }
 
 bool Command::waitForFinished(unsigned long ms)
 {
+    if (d->asyncClient && d->asyncClient->isRunning()) {
+        return d->asyncClient->waitForFinished(ms);
+    }
     return d->wait(ms);
 }
 
@@ -184,6 +195,11 @@ void Command::start()
     d->start();
 }
 
+void Command::startInCurrentThread()
+{
+    d->startAsync();
+}
+
 void Command::cancel()
 {
     qCDebug(LIBKLEOPATRACLIENTCORE_LOG) << "Sorry, not implemented: KleopatraClient::Command::Cancel";
@@ -368,41 +384,6 @@ QByteArray Command::command() const
 // here comes the ugly part
 //
 
-#ifdef HAVE_ASSUAN2
-static void my_assuan_release(assuan_context_t ctx)
-{
-    if (ctx) {
-        assuan_release(ctx);
-    }
-}
-#endif
-
-using AssuanContextBase = std::shared_ptr<std::remove_pointer<assuan_context_t>::type>;
-namespace
-{
-struct AssuanClientContext : AssuanContextBase {
-    AssuanClientContext() : AssuanContextBase() {}
-#ifndef HAVE_ASSUAN2
-    explicit AssuanClientContext(assuan_context_t ctx) : AssuanContextBase(ctx, &assuan_disconnect) {}
-    void reset(assuan_context_t ctx = nullptr)
-    {
-        AssuanContextBase::reset(ctx, &assuan_disconnect);
-    }
-#else
-    explicit AssuanClientContext(assuan_context_t ctx) : AssuanContextBase(ctx, &my_assuan_release) {}
-    void reset(assuan_context_t ctx = nullptr)
-    {
-        AssuanContextBase::reset(ctx, &my_assuan_release);
-    }
-#endif
-};
-}
-
-#ifdef HAVE_ASSUAN2
-// compatibility typedef - remove when we require assuan v2...
-using assuan_error_t = gpg_error_t;
-#endif
-
 static assuan_error_t
 my_assuan_transact(const AssuanClientContext &ctx,
                    const char *command,
@@ -456,13 +437,25 @@ static QString uiserver_executable()
     return QStringLiteral("kleopatra");
 }
 
+// as long as the clients retry connecting after starting the server
+static const qint64 UISERVER_STARTUP_TIME = 10000; // ms
+
 static QString start_uiserver()
 {
+    // commands that find the server not running at the same time must not
+    // start several instances of it; they wait for the one being started
+    static QMutex mutex;
+    static QElapsedTimer lastStart;
+    const QMutexLocker locker(&mutex);
+    if (lastStart.isValid() && !lastStart.hasExpired(UISERVER_STARTUP_TIME)) {
+        return QString();
+    }
     if (!QProcess::startDetached(uiserver_executable(), QStringList() << QStringLiteral("--daemon"))) {
+        lastStart.invalidate();
         return i18n("Failed to start uiserver %1", uiserver_executable());
-    } else {
-        return QString();
     }
+    lastStart.start();
+    return QString();
 }
 
 static assuan_error_t getinfo_pid_cb(void *opaque, const void *buffer, size_t length)
@@ -506,24 +499,53 @@ static inline std::ostream &operator<<(std::ostream &s, const QByteArray &ba)
     return s << std::string(ba.data(), ba.size());
 }
 
-static assuan_error_t send_option(const AssuanClientContext &ctx, const char *name, const QVariant &value)
+static QByteArray option_line(const char *name, const QVariant &value)
 {
     std::stringstream ss;
     ss << "OPTION " << name;
     if (value.isValid()) {
         ss << '=' << value.toString().toUtf8();
     }
-    return my_assuan_transact(ctx, ss.str().c_str());
+    return QByteArray::fromStdString(ss.str());
 }
 
-static assuan_error_t send_file(const AssuanClientContext &ctx, const QString &file)
+static assuan_error_t send_option(const AssuanClientContext &ctx, const char *name, const QVariant &value)
+{
+    return my_assuan_transact(ctx, option_line(name, value).constData());
+}
+
+static QByteArray file_line(const QString &file)
 {
     std::stringstream ss;
     ss << "FILE " << hexencode(QFile::encodeName(file));
-    return my_assuan_transact(ctx, ss.str().c_str());
+    return QByteArray::fromStdString(ss.str());
 }
 
-static assuan_error_t send_recipient(const AssuanClientContext &ctx, const QString &recipient, bool info)
+static assuan_error_t send_file(const AssuanClientContext &ctx, const QString &file)
+{
+    return my_assuan_transact(ctx, file_line(file).constData());
+}
+
+static std::map<std::string, QByteArray> files_inquire_data(const QStringList &files)
+{
+    QByteArray data;
+    for (const QString &file : files) {
+        data += QFile::encodeName(file);
+        data += '\0';
+    }
+    return { { "FILES", data } };
+}
+
+// sends all files with one FILES command; fails with GPG_ERR_ASS_UNKNOWN_CMD
+// if the server doesn't support it
+static assuan_error_t send_files(const AssuanClientContext &ctx, const QStringList &files)
+{
+    const std::map<std::string, QByteArray> map = files_inquire_data(files);
+    inquire_data id = { &map, &ctx };
+    return my_assuan_transact(ctx, "FILES", nullptr, nullptr, &command_inquire_cb, &id);
+}
+
+static QByteArray recipient_line(const QString &recipient, bool info)
 {
     std::stringstream ss;
     ss << "RECIPIENT ";
@@ -531,10 +553,29 @@ static assuan_error_t send_recipient(const AssuanClientContext &ctx, const QStri
         ss << "--info ";
     }
     ss << "--" << hexencode(recipient.toUtf8());
-    return my_assuan_transact(ctx, ss.str().c_str());
+    return QByteArray::fromStdString(ss.str());
 }
 
-static assuan_error_t send_sender(const AssuanClientContext &ctx, const QString &sender, bool info)
+static assuan_error_t send_recipient(const AssuanClientContext &ctx, const QString &recipient, bool info)
+{
+    return my_assuan_transact(ctx, recipient_line(recipient, info).constData());
+}
+
+static std::map<std::string, QByteArray> recipients_inquire_data(const QStringList &recipients)
+{
+    return { { "RECIPIENTS", recipients.join(QLatin1Char('\n')).toUtf8() } };
+}
+
+// sends all recipients with one RECIPIENTS command; fails with
+// GPG_ERR_ASS_UNKNOWN_CMD if the server doesn't support it
+static assuan_error_t send_recipients(const AssuanClientContext &ctx, const QStringList &recipients, bool info)
+{
+    const std::map<std::string, QByteArray> map = recipients_inquire_data(recipients);
+    inquire_data id = { &map, &ctx };
+    return my_assuan_transact(ctx, info ? "RECIPIENTS --info" : "RECIPIENTS", nullptr, nullptr, &command_inquire_cb, &id);
+}
+
+static QByteArray sender_line(const QString &sender, bool info)
 {
     std::stringstream ss;
     ss << "SENDER ";
@@ -542,40 +583,36 @@ static assuan_error_t send_sender(const AssuanClientContext &ctx, const QString
         ss << "--info ";
     }
     ss << "--" << hexencode(sender.toUtf8());
-    return my_assuan_transact(ctx, ss.str().c_str());
+    return QByteArray::fromStdString(ss.str());
 }
 
-void Command::Private::run()
+static assuan_error_t send_sender(const AssuanClientContext &ctx, const QString &sender, bool info)
 {
+    return my_assuan_transact(ctx, sender_line(sender, info).constData());
+}
 
-    // Take a snapshot of the input data, and clear the output data:
-    Inputs in;
-    Outputs out;
-    {
-        const QMutexLocker locker(&mutex);
-        in = inputs;
-        outputs = out;
-    }
-
-    out.canceled = false;
+static QString window_id(WId wid)
+{
+#if defined(Q_OS_WIN32)
+    return QString::asprintf("%lx", reinterpret_cast<quintptr>(wid));
+#else
+    return QString::asprintf("%lx", static_cast<unsigned long>(wid));
+#endif
+}
 
-    if (out.serverLocation.isEmpty()) {
-        out.serverLocation = default_socket_name();
-    }
+// connects session to the server at socketName, starting the server if
+// necessary, and looks up the process id of the server; returns an error
+// message on failure
+static QString connect_to_server(Session::Private &session, const QString &socketName)
+{
+    session.disconnect();
 
 #ifndef HAVE_ASSUAN2
     assuan_context_t naked_ctx = 0;
 #endif
     AssuanClientContext ctx;
     assuan_error_t err = 0;
-
-    inquire_data id = { &in.inquireData, &ctx };
-
-    const QString socketName = out.serverLocation;
-    if (socketName.isEmpty()) {
-        out.errorString = i18n("Invalid socket name!");
-        goto leave;
-    }
+    qint64 serverPid = -1;
 
 #ifndef HAVE_ASSUAN2
     err = assuan_socket_connect(&naked_ctx, QFile::encodeName(socketName).constData(), -1);
@@ -584,9 +621,8 @@ void Command::Private::run()
         assuan_context_t naked_ctx = nullptr;
         err = assuan_new(&naked_ctx);
         if (err) {
-            out.errorString = i18n("Could not allocate resources to connect to Kleopatra UI server at %1: %2"
-                                   , socketName, to_error_string(err));
-            goto leave;
+            return i18n("Could not allocate resources to connect to Kleopatra UI server at %1: %2"
+                        , socketName, to_error_string(err));
         }
 
         ctx.reset(naked_ctx);
@@ -599,21 +635,19 @@ void Command::Private::run()
 
         const QString errorString = start_uiserver();
         if (!errorString.isEmpty()) {
-            out.errorString = errorString;
-            goto leave;
+            return errorString;
         }
 
         // give it a bit of time to start up and try a couple of times
         for (int i = 0; err && i < 20; ++i) {
-            msleep(500);
+            QThread::msleep(500);
             err = assuan_socket_connect(ctx.get(), socketName.toUtf8().constData(), -1, 0);
         }
     }
 
     if (err) {
-        out.errorString = i18n("Could not connect to Kleopatra UI server at %1: %2",
-                               socketName, to_error_string(err));
-        goto leave;
+        return i18n("Could not connect to Kleopatra UI server at %1: %2",
+                    socketName, to_error_string(err));
     }
 
 #ifndef HAVE_ASSUAN2
@@ -621,13 +655,67 @@ void Command::Private::run()
     naked_ctx = 0;
 #endif
 
-    out.serverPid = -1;
-    err = my_assuan_transact(ctx, "GETINFO pid", &getinfo_pid_cb, &out.serverPid);
-    if (err || out.serverPid <= 0) {
-        out.errorString = i18n("Could not get the process-id of the Kleopatra UI server at %1: %2", socketName, to_error_string(err));
+    err = my_assuan_transact(ctx, "GETINFO pid", &getinfo_pid_cb, &serverPid);
+    if (err || serverPid <= 0) {
+        return i18n("Could not get the process-id of the Kleopatra UI server at %1: %2", socketName, to_error_string(err));
+    }
+
+    session.ctx = ctx;
+    session.serverPid = serverPid;
+    session.serverLocation = socketName;
+    return QString();
+}
+
+void Command::Private::run()
+{
+
+    // Take a snapshot of the input data, and clear the output data:
+    Inputs in;
+    Outputs out;
+    {
+        const QMutexLocker locker(&mutex);
+        in = inputs;
+        outputs = out;
+    }
+
+    out.canceled = false;
+
+    if (out.serverLocation.isEmpty()) {
+        out.serverLocation = default_socket_name();
+    }
+
+    // without a session, the connection is only used for this command
+    const std::shared_ptr<Session::Private> session = in.session ? in.session : std::make_shared<Session::Private>();
+    const QMutexLocker sessionLocker(&session->mutex);
+    const AssuanClientContext &ctx = session->ctx;
+    assuan_error_t err = 0;
+
+    inquire_data id = { &in.inquireData, &ctx };
+
+    const QString socketName = out.serverLocation;
+    if (socketName.isEmpty()) {
+        out.errorString = i18n("Invalid socket name!");
         goto leave;
     }
 
+    if (ctx && session->serverLocation == socketName) {
+        // clear what the previous command of the session left behind on the server
+        err = my_assuan_transact(ctx, "RESET");
+        if (err) {
+            qCDebug(LIBKLEOPATRACLIENTCORE_LOG) << "Lost session connection, reconnecting:" << to_error_string(err);
+            session->disconnect();
+        }
+    }
+
+    if (!ctx || session->serverLocation != socketName) {
+        out.errorString = connect_to_server(*session, socketName);
+        if (!out.errorString.isEmpty()) {
+            goto leave;
+        }
+    }
+
+    out.serverPid = session->serverPid;
+
     qCDebug(LIBKLEOPATRACLIENTCORE_LOG) << "Server PID =" << out.serverPid;
 
 #if defined(Q_OS_WIN)
@@ -641,11 +729,7 @@ void Command::Private::run()
     }
 
     if (in.parentWId) {
-#if defined(Q_OS_WIN32)
-        err = send_option(ctx, "window-id", QString::asprintf("%lx", reinterpret_cast<quintptr>(in.parentWId)));
-#else
-        err = send_option(ctx, "window-id", QString::asprintf("%lx", static_cast<unsigned long>(in.parentWId)));
-#endif
+        err = send_option(ctx, "window-id", window_id(in.parentWId));
         if (err) {
             qDebug("sending option window-id failed - ignoring");
         }
@@ -661,11 +745,21 @@ void Command::Private::run()
             }
         }
 
-    Q_FOREACH (const QString &filePath, in.filePaths)
-        if ((err = send_file(ctx, filePath))) {
-            out.errorString = i18n("Failed to send file path %1: %2", filePath, to_error_string(err));
+    if (in.filePaths.size() > 1) {
+        err = send_files(ctx, in.filePaths);
+        if (err && gpg_err_code(err) != GPG_ERR_ASS_UNKNOWN_CMD) {
+            out.errorString = i18n("Failed to send file paths: %1", to_error_string(err));
             goto leave;
         }
+    }
+    if (in.filePaths.size() <= 1 || err) {
+        // older servers only support FILE
+        Q_FOREACH (const QString &filePath, in.filePaths)
+            if ((err = send_file(ctx, filePath))) {
+                out.errorString = i18n("Failed to send file path %1: %2", filePath, to_error_string(err));
+                goto leave;
+            }
+    }
 
     Q_FOREACH (const QString &sender, in.senders)
         if ((err = send_sender(ctx, sender, in.areSendersInformative))) {
@@ -673,11 +767,21 @@ void Command::Private::run()
             goto leave;
         }
 
-    Q_FOREACH (const QString &recipient, in.recipients)
-        if ((err = send_recipient(ctx, recipient, in.areRecipientsInformative))) {
-            out.errorString = i18n("Failed to send recipient %1: %2", recipient, to_error_string(err));
+    if (in.recipients.size() > 1) {
+        err = send_recipients(ctx, in.recipients, in.areRecipientsInformative);
+        if (err && gpg_err_code(err) != GPG_ERR_ASS_UNKNOWN_CMD) {
+            out.errorString = i18n("Failed to send recipients: %1", to_error_string(err));
             goto leave;
         }
+    }
+    if (in.recipients.size() <= 1 || err) {
+        // older servers only support RECIPIENT
+        Q_FOREACH (const QString &recipient, in.recipients)
+            if ((err = send_recipient(ctx, recipient, in.areRecipientsInformative))) {
+                out.errorString = i18n("Failed to send recipient %1: %2", recipient, to_error_string(err));
+                goto leave;
+            }
+    }
 
 #if 0
     setup I / O;
@@ -698,3 +802,185 @@ leave:
     // copy outputs to where Command can see them:
     outputs = out;
 }
+
+void Command::Private::startAsync()
+{
+    if (isRunning() || (asyncClient && asyncClient->isRunning())) {
+        return;
+    }
+
+    // Take a snapshot of the input data, and clear the output data, as in run():
+    QString serverLocation;
+    {
+        const QMutexLocker locker(&mutex);
+        asyncInputs = inputs;
+        serverLocation = outputs.serverLocation;
+        outputs = Outputs();
+    }
+    asyncOutputs = Outputs();
+    asyncOutputs.canceled = false;
+    asyncOutputs.serverLocation = serverLocation.isEmpty() ? default_socket_name() : serverLocation;
+
+    const Inputs &in = asyncInputs;
+    const Outputs &out = asyncOutputs;
+
+    if (!asyncClient) {
+        asyncClient.reset(new AsyncClient);
+        connect(asyncClient.get(), &AsyncClient::finished, this, &Private::asyncFinished, Qt::DirectConnection);
+    }
+    AsyncClient *const client = asyncClient.get();
+
+    QMetaObject::invokeMethod(client, [this]() { Q_EMIT q->started(); }, Qt::QueuedConnection);
+
+    if (out.serverLocation.isEmpty()) {
+        asyncOutputs.errorString = i18n("Invalid socket name!");
+        QMetaObject::invokeMethod(client, [this]() { asyncFinished(); }, Qt::QueuedConnection);
+        return;
+    }
+
+    const auto pid = std::make_shared<QByteArray>();
+    client->addStep({"GETINFO pid",
+                     [pid](const QByteArray &data) { pid->append(data); },
+                     nullptr,
+                     [this, pid](gpg_error_t err) {
+                         asyncOutputs.serverPid = pid->toLongLong();
+                         if (err || asyncOutputs.serverPid <= 0) {
+                             asyncOutputs.errorString = i18n("Could not get the process-id of the Kleopatra UI server at %1: %2",
+                                                             asyncOutputs.serverLocation, to_error_string(err));
+                             return false;
+                         }
+                         qCDebug(LIBKLEOPATRACLIENTCORE_LOG) << "Server PID =" << asyncOutputs.serverPid;
+#if defined(Q_OS_WIN)
+                         if (!AllowSetForegroundWindow((pid_t)asyncOutputs.serverPid)) {
+                             qCDebug(LIBKLEOPATRACLIENTCORE_LOG) << "AllowSetForegroundWindow(" << asyncOutputs.serverPid << ") failed: " << GetLastError();
+                         }
+#endif
+                         return !asyncInputs.command.isEmpty();
+                     }});
+
+    if (in.parentWId) {
+        client->addStep({option_line("window-id", window_id(in.parentWId)), nullptr, nullptr, [](gpg_error_t err) {
+                             if (err) {
+                                 qDebug("sending option window-id failed - ignoring");
+                             }
+                             return true;
+                         }});
+    }
+
+    for (auto it = in.options.begin(), end = in.options.end(); it != end; ++it) {
+        const std::string name = it->first;
+        const bool critical = it->second.isCritical;
+        client->addStep({option_line(name.c_str(), it->second.hasValue ? it->second.value.toString() : QVariant()), nullptr, nullptr,
+                         [this, name, critical](gpg_error_t err) {
+                             if (err) {
+                                 if (critical) {
+                                     asyncOutputs.errorString = i18n("Failed to send critical option %1: %2", QString::fromLatin1(name.c_str()), to_error_string(err));
+                                     return false;
+                                 } else {
+                                     qCDebug(LIBKLEOPATRACLIENTCORE_LOG) << "Failed to send non-critical option" << name.c_str() << ":" << to_error_string(err);
+                                 }
+                             }
+                             return true;
+                         }});
+    }
+
+    const auto fileSteps = [this]() {
+        std::vector<AsyncClient::Step> steps;
+        Q_FOREACH (const QString &filePath, asyncInputs.filePaths)
+            steps.push_back({file_line(filePath), nullptr, nullptr, [this, filePath](gpg_error_t err) {
+                                 if (err) {
+                                     asyncOutputs.errorString = i18n("Failed to send file path %1: %2", filePath, to_error_string(err));
+                                     return false;
+                                 }
+                                 return true;
+                             }});
+        return steps;
+    };
+    if (in.filePaths.size() > 1) {
+        client->addStep({"FILES", nullptr, std::make_shared<const std::map<std::string, QByteArray>>(files_inquire_data(in.filePaths)),
+                         [this, client, fileSteps](gpg_error_t err) {
+                             if (err && gpg_err_code(err) == GPG_ERR_ASS_UNKNOWN_CMD) {
+                                 // older servers only support FILE
+                                 client->insertSteps(fileSteps());
+                             } else if (err) {
+                                 asyncOutputs.errorString = i18n("Failed to send file paths: %1", to_error_string(err));
+                                 return false;
+                             }
+                             return true;
+                         }});
+    } else {
+        for (const AsyncClient::Step &step : fileSteps()) {
+            client->addStep(step);
+        }
+    }
+
+    Q_FOREACH (const QString &sender, in.senders)
+        client->addStep({sender_line(sender, in.areSendersInformative), nullptr, nullptr, [this, sender](gpg_error_t err) {
+                             if (err) {
+                                 asyncOutputs.errorString = i18n("Failed to send sender %1: %2", sender, to_error_string(err));
+                                 return false;
+                             }
+                             return true;
+                         }});
+
+    const auto recipientSteps = [this]() {
+        std::vector<AsyncClient::Step> steps;
+        Q_FOREACH (const QString &recipient, asyncInputs.recipients)
+            steps.push_back({recipient_line(recipient, asyncInputs.areRecipientsInformative), nullptr, nullptr, [this, recipient](gpg_error_t err) {
+                                 if (err) {
+                                     asyncOutputs.errorString = i18n("Failed to send recipient %1: %2", recipient, to_error_string(err));
+                                     return false;
+                                 }
+                                 return true;
+                             }});
+        return steps;
+    };
+    if (in.recipients.size() > 1) {
+        client->addStep({in.areRecipientsInformative ? "RECIPIENTS --info" : "RECIPIENTS", nullptr,
+                         std::make_shared<const std::map<std::string, QByteArray>>(recipients_inquire_data(in.recipients)),
+                         [this, client, recipientSteps](gpg_error_t err) {
+                             if (err && gpg_err_code(err) == GPG_ERR_ASS_UNKNOWN_CMD) {
+                                 // older servers only support RECIPIENT
+                                 client->insertSteps(recipientSteps());
+                             } else if (err) {
+                                 asyncOutputs.errorString = i18n("Failed to send recipients: %1", to_error_string(err));
+                                 return false;
+                             }
+                             return true;
+                         }});
+    } else {
+        for (const AsyncClient::Step &step : recipientSteps()) {
+            client->addStep(step);
+        }
+    }
+
+    client->addStep({in.command,
+                     [this](const QByteArray &data) { asyncOutputs.data.append(data); },
+                     std::make_shared<const std::map<std::string, QByteArray>>(in.inquireData),
+                     [this](gpg_error_t err) {
+                         if (err) {
+                             if (gpg_err_code(err) == GPG_ERR_CANCELED) {
+                                 asyncOutputs.canceled = true;
+                             } else {
+                                 asyncOutputs.errorString = i18n("Command (%1) failed: %2", QString::fromLatin1(asyncInputs.command.constData()), to_error_string(err));
+                             }
+                             return false;
+                         }
+                         return true;
+                     }});
+
+    client->start(out.serverLocation, &start_uiserver);
+}
+
+void Command::Private::asyncFinished()
+{
+    if (asyncOutputs.errorString.isEmpty() && asyncClient) {
+        asyncOutputs.errorString = asyncClient->errorString();
+    }
+    {
+        const QMutexLocker locker(&mutex);
+        // copy outputs to where Command can see them:
+        outputs = asyncOutputs;
+    }
+    Q_EMIT q->finished();
+}
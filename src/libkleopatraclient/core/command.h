@@ -21,6 +21,8 @@ class QVariant;
 namespace KleopatraClientCopy
 {
 
+class Session;
+
 class KLEOPATRACLIENTCORE_EXPORT Command : public QObject
 {
     Q_OBJECT
@@ -34,6 +36,12 @@ public:
     void setServerLocation(const QString &location);
     QString serverLocation() const;
 
+    /**
+     * Runs the command over the connection of \a session instead of
+     * connecting to the server just for this command.
+     */
+    void setSession(const Session &session);
+
     bool waitForFinished();
     bool waitForFinished(unsigned long ms);
 
@@ -45,6 +53,14 @@ public:
 
 public Q_SLOTS:
     void start();
+    /**
+     * Like start(), but instead of running in a thread of its own, the
+     * command talks to the server over a non-blocking connection driven
+     * by the event loop of the current thread. This allows a single
+     * thread to have many commands outstanding at the same time.
+     * A session set with setSession() is not used.
+     */
+    void startInCurrentThread();
     void cancel();
 
 Q_SIGNALS:
@@ -9,6 +9,8 @@
 #pragma once
 
 #include "command.h"
+#include "session.h"
+#include "asyncclient_p.h"
 
 #include <QThread>
 #include <QRecursiveMutex>
@@ -19,6 +21,7 @@
 #include <QVariant>
 
 #include <map>
+#include <memory>
 #include <string>
 
 class KleopatraClientCopy::Command::Private : public QThread
@@ -33,7 +36,10 @@ public:
           q(qq),
           mutex(),
           inputs(),
-          outputs()
+          outputs(),
+          asyncClient(),
+          asyncInputs(),
+          asyncOutputs()
     {
 
     }
@@ -41,6 +47,9 @@ public:
 
 private:
     void init();
+    // runs the command with an AsyncClient instead of in this thread
+    void startAsync();
+    void asyncFinished();
 
 private:
     void run() override;
@@ -60,6 +69,7 @@ private:
         std::map<std::string, QByteArray> inquireData;
         WId parentWId;
         QByteArray command;
+        std::shared_ptr<Session::Private> session;
         bool areRecipientsInformative : 1;
         bool areSendersInformative    : 1;
     } inputs;
@@ -71,5 +81,11 @@ private:
         qint64 serverPid;
         QString serverLocation;
     } outputs;
+
+    // state of a command started with startAsync(), only used in the
+    // thread of asyncClient
+    std::unique_ptr<AsyncClient> asyncClient;
+    Inputs asyncInputs;
+    Outputs asyncOutputs;
 };
 
@@ -0,0 +1,47 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    session.cpp
+
+    This file is part of KleopatraClient, the Kleopatra interface library
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "session.h"
+#include "session_p.h"
+
+#include <QMutexLocker>
+
+using namespace KleopatraClientCopy;
+
+Session::Session()
+    : d(std::make_shared<Private>())
+{
+
+}
+
+Session::Session(const Session &other) = default;
+
+Session &Session::operator=(const Session &other) = default;
+
+Session::~Session() = default;
+
+bool Session::isConnected() const
+{
+    const QMutexLocker locker(&d->mutex);
+    return bool(d->ctx);
+}
+
+qint64 Session::serverPid() const
+{
+    const QMutexLocker locker(&d->mutex);
+    return d->ctx ? d->serverPid : 0;
+}
+
+void Session::disconnect()
+{
+    const QMutexLocker locker(&d->mutex);
+    d->disconnect();
+}
@@ -0,0 +1,61 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    core/session.h
+
+    This file is part of KleopatraClient, the Kleopatra interface library
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#pragma once
+
+#include "kleopatraclientcore_export.h"
+
+#include <QtGlobal>
+
+#include <memory>
+
+namespace KleopatraClientCopy
+{
+
+/**
+ * A connection to the Kleopatra UI server that is shared by several
+ * commands.
+ *
+ * Without a session, every Command connects to the server, looks up the
+ * server's process id, and disconnects again when it is done. Commands
+ * that are given the same session (see Command::setSession()) instead
+ * run one after another over the connection of the session; the server
+ * state left behind by the previous command is cleared with a RESET.
+ * If the connection is lost, the next command reconnects.
+ *
+ * Session is a handle: copies refer to the same connection, which is
+ * closed when the last copy and the last command using it are gone.
+ */
+class KLEOPATRACLIENTCORE_EXPORT Session
+{
+public:
+    Session();
+    Session(const Session &other);
+    Session &operator=(const Session &other);
+    ~Session();
+
+    /** Returns true if the session is currently connected to a server. */
+    bool isConnected() const;
+    /** Returns the process id of the server, or 0 if not connected. */
+    qint64 serverPid() const;
+
+    /**
+     * Closes the connection. Waits for a command currently using the
+     * session to finish.
+     */
+    void disconnect();
+
+    class Private;
+private:
+    friend class Command;
+    std::shared_ptr<Private> d;
+};
+
+}
+
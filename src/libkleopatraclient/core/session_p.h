@@ -0,0 +1,83 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    session_p.h
+
+    This file is part of KleopatraClient, the Kleopatra interface library
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+#pragma once
+
+#include "session.h"
+
+#include <QMutex>
+#include <QString>
+
+#include <assuan.h>
+#include <gpg-error.h>
+
+#include <memory>
+#include <type_traits>
+
+namespace KleopatraClientCopy
+{
+
+#ifdef HAVE_ASSUAN2
+// compatibility typedef - remove when we require assuan v2...
+using assuan_error_t = gpg_error_t;
+
+inline void my_assuan_release(assuan_context_t ctx)
+{
+    if (ctx) {
+        assuan_release(ctx);
+    }
+}
+#endif
+
+using AssuanContextBase = std::shared_ptr<std::remove_pointer<assuan_context_t>::type>;
+
+struct AssuanClientContext : AssuanContextBase {
+    AssuanClientContext() : AssuanContextBase() {}
+#ifndef HAVE_ASSUAN2
+    explicit AssuanClientContext(assuan_context_t ctx) : AssuanContextBase(ctx, &assuan_disconnect) {}
+    void reset(assuan_context_t ctx = nullptr)
+    {
+        AssuanContextBase::reset(ctx, &assuan_disconnect);
+    }
+#else
+    explicit AssuanClientContext(assuan_context_t ctx) : AssuanContextBase(ctx, &my_assuan_release) {}
+    void reset(assuan_context_t ctx = nullptr)
+    {
+        AssuanContextBase::reset(ctx, &my_assuan_release);
+    }
+#endif
+};
+
+class Session::Private
+{
+public:
+    Private()
+        : mutex(),
+          ctx(),
+          serverPid(0),
+          serverLocation()
+    {
+
+    }
+
+    void disconnect()
+    {
+        ctx.reset();
+        serverPid = 0;
+        serverLocation.clear();
+    }
+
+    // held by a command for as long as it uses the connection
+    QMutex mutex;
+    AssuanClientContext ctx;
+    qint64 serverPid;
+    QString serverLocation;
+};
+
+}
+
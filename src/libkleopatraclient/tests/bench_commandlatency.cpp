@@ -0,0 +1,106 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    tests/bench_commandlatency.cpp
+
+    This file is part of KleopatraClient, the Kleopatra interface library
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <libkleopatraclient/core/command.h>
+#include <libkleopatraclient/core/session.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace KleopatraClientCopy;
+
+namespace
+{
+// a command that is cheap for the server, so that the connection overhead dominates
+class GetInfoVersionCommand : public Command
+{
+public:
+    GetInfoVersionCommand() : Command()
+    {
+        setCommand("GETINFO version");
+    }
+};
+
+// runs count commands one after another and returns the average latency in ms,
+// or -1 on error
+double run(int count, const Session *session)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < count; ++i) {
+        GetInfoVersionCommand cmd;
+        if (session) {
+            cmd.setSession(*session);
+        }
+        cmd.start();
+        cmd.waitForFinished();
+        if (cmd.error()) {
+            fprintf(stderr, "command failed: %s\n", qPrintable(cmd.errorString()));
+            return -1;
+        }
+    }
+    return double(timer.nsecsElapsed()) / 1000000 / count;
+}
+
+// starts count commands at once in this thread and waits for all of them;
+// returns the average time per command in ms, or -1 on error
+double runConcurrently(int count)
+{
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<std::unique_ptr<GetInfoVersionCommand>> commands;
+    for (int i = 0; i < count; ++i) {
+        commands.emplace_back(new GetInfoVersionCommand);
+        commands.back()->startInCurrentThread();
+    }
+    for (const auto &cmd : commands) {
+        cmd->waitForFinished();
+        if (cmd->error()) {
+            fprintf(stderr, "command failed: %s\n", qPrintable(cmd->errorString()));
+            return -1;
+        }
+    }
+    return double(timer.nsecsElapsed()) / 1000000 / count;
+}
+}
+
+// usage: bench_commandlatency [count]
+// needs a running Kleopatra (or starts one)
+int main(int argc, char *argv[])
+{
+
+    QCoreApplication app(argc, argv);
+
+    const int count = argc > 1 ? qMax(1, atoi(argv[1])) : 100;
+
+    // warm up, so that starting the server isn't measured
+    const Session session;
+    if (run(1, &session) < 0) {
+        return 1;
+    }
+
+    const double unpooled = run(count, nullptr);
+    const double pooled = run(count, &session);
+    const double concurrent = runConcurrently(count);
+    if (unpooled < 0 || pooled < 0 || concurrent < 0) {
+        return 1;
+    }
+
+    printf("%d commands\n", count);
+    printf("  without session: %8.3f ms/command\n", unpooled);
+    printf("  with session:    %8.3f ms/command\n", pooled);
+    printf("  all at once:     %8.3f ms/command\n", concurrent);
+
+    return 0;
+
+}
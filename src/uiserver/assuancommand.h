@@ -23,6 +23,7 @@
 
 #include <qwindowdefs.h> // for WId
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <map>
@@ -30,6 +31,7 @@
 
 class QVariant;
 class QObject;
+class QIODevice;
 #include <QStringList>
 
 struct assuan_context_s;
@@ -145,6 +147,20 @@ class AssuanCommandFactory;
   You can do as many inquiries as you want, but only one at a
   time.
 
+  If the inquired data can be large, you can have it delivered in
+  chunks instead, so that you can process it incrementally without
+  holding a second copy of it:
+
+  \code
+  const int err = inquire( "DETACHED_SIGNATURE", this,
+                           [this]( int rc, const QByteArray &chunk, bool last ) { ... },
+                           0, 64 * 1024 );
+  \endcode
+
+  Likewise, data for the client can be written to
+  dataOutputDevice() as it is produced, instead of collecting it
+  for sendData().
+
   You should periodically send status updates to the client. You do
   that by calling sendStatus().
 
@@ -288,9 +304,18 @@ public:
     void sendStatus(const char *keyword, const QString &text);
     void sendStatusEncoded(const char *keyword, const std::string &text);
     void sendData(const QByteArray &data, bool moreToCome = false);
+    // writes are sent with sendData(), closing flushes
+    std::shared_ptr<QIODevice> dataOutputDevice();
 
     int inquire(const char *keyword, QObject *receiver, const char *slot, unsigned int maxSize = 0);
 
+    // called in the thread of the context object with consecutive chunks
+    // of at most chunkSize bytes, the last one with last == true; on
+    // error it is called once, with rc != 0
+    typedef std::function<void(int rc, const QByteArray &chunk, bool last)> InquiryChunkHandler;
+    int inquire(const char *keyword, QObject *context, const InquiryChunkHandler &handler,
+                unsigned int maxSize = 0, int chunkSize = 64 * 1024);
+
     void done(const GpgME::Error &err = GpgME::Error());
     void done(const GpgME::Error &err, const QString &details);
     void done(int err)
@@ -24,6 +24,7 @@
 #include <utils/output.h>
 #include <Libkleo/GnuPG>
 #include <utils/detail_p.h>
+#include <utils/fileinfocache.h>
 #include <utils/hex.h>
 #include <utils/log.h>
 #include <utils/kleo_assert.h>
@@ -41,7 +42,11 @@
 #include <KLocalizedString>
 #include <KWindowSystem>
 
+#include <QIODevice>
+#include <QMutex>
 #include <QSocketNotifier>
+#include <QThread>
+#include <QThreadPool>
 #include <QTimer>
 #include <QVariant>
 #include <QPointer>
@@ -76,6 +81,7 @@ static const unsigned int INIT_SOCKET_FLAGS = 3; // says info assuan...
 //static int(*USE_DEFAULT_HANDLER)(assuan_context_t,char*) = 0;
 static const int FOR_READING = 0;
 static const unsigned int MAX_ACTIVE_FDS = 32;
+static const unsigned int MAX_BULK_INQUIRY_SIZE = 64 * 1024 * 1024;
 
 #ifdef HAVE_ASSUAN2
 static void my_assuan_release(assuan_context_t ctx)
@@ -106,6 +112,14 @@ struct AssuanContext : AssuanContextBase {
     {
         AssuanContextBase::reset(ctx, &my_assuan_release);
     }
+    // keeps owner alive until the context is released, e.g. the hook of the
+    // log callback, which is still used by assuan_release()
+    void reset(assuan_context_t ctx, const std::shared_ptr<void> &owner)
+    {
+        AssuanContextBase::reset(ctx, [owner](assuan_context_t ctx) {
+            my_assuan_release(ctx);
+        });
+    }
 #endif
 };
 
@@ -187,6 +201,45 @@ static std::map<std::string, std::string> parse_commandline(const char *line)
     return result;
 }
 
+// throws if fi is not a file or directory the user may process
+static void check_file(const FileInfoCache::Info &fi)
+{
+    if (!fi.isAbsolute) {
+        throw Exception(gpg_error(GPG_ERR_INV_ARG), i18n("Only absolute file paths are allowed"));
+    }
+    if (!fi.exists) {
+        throw Exception(gpg_error(GPG_ERR_ENOENT), i18n("File \"%1\" does not exist", fi.absoluteFilePath));
+    }
+    if (!fi.isReadable || (fi.isDir && !fi.isExecutable)) {
+        throw Exception(gpg_error(GPG_ERR_EPERM), i18n("Cannot access file \"%1\"", fi.absoluteFilePath));
+    }
+}
+
+// throws if fi is not suitable for INPUT/OUTPUT/MESSAGE FILE=
+static void check_io_file(const FileInfoCache::Info &fi)
+{
+    if (!fi.isAbsolute) {
+        throw Exception(gpg_error(GPG_ERR_INV_ARG), i18n("Only absolute file paths are allowed"));
+    }
+    if (!fi.isFile) {
+        throw Exception(gpg_error(GPG_ERR_INV_ARG), i18n("Only files are allowed in INPUT/OUTPUT FILE"));
+    }
+}
+
+#ifdef HAVE_ASSUAN2
+// assuan_log_cb_t writing to the AsyncLog::Channel given as hook value;
+// called with the mutex of the connection locked, i.e. never concurrently
+static int log_to_channel(assuan_context_t, void *hook, unsigned int cat, const char *msg)
+{
+    if (!msg) {
+        // like assuan_set_log_stream(), only log the traffic
+        return cat == ASSUAN_LOG_CONTROL;
+    }
+    static_cast<AsyncLog::Channel *>(hook)->write(msg, strlen(msg));
+    return 0;
+}
+#endif
+
 static WId wid_from_string(const QString &winIdStr, bool *ok = nullptr)
 {
     return static_cast<WId>(winIdStr.toULongLong(ok, 16));
@@ -225,7 +278,7 @@ class AssuanServerConnection::Private : public QObject
     friend class ::Kleo::AssuanCommand;
     AssuanServerConnection *const q;
 public:
-    Private(assuan_fd_t fd_, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories_, AssuanServerConnection *qq);
+    Private(assuan_fd_t fd_, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories_, QThread *workerThread, AssuanServerConnection *qq);
     ~Private() override;
 
 Q_SIGNALS:
@@ -234,7 +287,10 @@ Q_SIGNALS:
 public Q_SLOTS:
     void slotReadActivity(int)
     {
-        Q_ASSERT(ctx);
+        const QMutexLocker locker(mutex.get());
+        if (closed || !ctx) {
+            return;
+        }
 #ifndef HAVE_ASSUAN2
         if (const int err = assuan_process_next(ctx.get())) {
 #else
@@ -243,9 +299,6 @@ public Q_SLOTS:
 #endif
             //if ( err == -1 || gpg_err_code(err) == GPG_ERR_EOF ) {
             topHalfDeletion();
-            if (nohupedCommands.empty()) {
-                bottomHalfDeletion();
-            }
             //} else {
             //assuan_process_done( ctx.get(), err );
             //return;
@@ -256,6 +309,31 @@ public Q_SLOTS:
     int startCommandBottomHalf();
 
 private:
+    // The commands, and the Input and Output objects they use, live in the
+    // thread of the AssuanServerConnection (the GUI thread), while this
+    // object may live in a worker thread.
+    template <typename Function>
+    void runInGuiThread(Function function)
+    {
+        QMetaObject::invokeMethod(q, std::move(function), Qt::QueuedConnection);
+    }
+
+    bool isClosed() const
+    {
+        const QMutexLocker locker(mutex.get());
+        return closed;
+    }
+
+    // for use outside of the Assuan handlers, which are called with the mutex locked
+    int processDone(int err, const QString &message = QString())
+    {
+        const QMutexLocker locker(mutex.get());
+        if (closed || !ctx) {
+            return err;
+        }
+        return message.isEmpty() ? assuan_process_done(ctx.get(), err) : assuan_process_done_msg(ctx.get(), err, message);
+    }
+
     void nohupDone(AssuanCommand *cmd)
     {
         const auto it = std::find_if(nohupedCommands.begin(), nohupedCommands.end(),
@@ -264,7 +342,7 @@ private:
                                      });
         Q_ASSERT(it != nohupedCommands.end());
         nohupedCommands.erase(it);
-        if (nohupedCommands.empty() && closed) {
+        if (nohupedCommands.empty() && isClosed()) {
             bottomHalfDeletion();
         }
     }
@@ -277,20 +355,37 @@ private:
         currentCommand.reset();
     }
 
+    // called in the reading thread with the mutex locked
     void topHalfDeletion()
+    {
+        for (const std::shared_ptr<QSocketNotifier> &sn : std::as_const(notifiers)) {
+            sn->setEnabled(false);
+        }
+        notifiers.clear();
+        closed = true;
+        runInGuiThread([this]() {
+            connectionClosed();
+        });
+    }
+
+    void connectionClosed()
     {
         if (currentCommand) {
             currentCommand->canceled();
         }
-        if (fd != ASSUAN_INVALID_FD) {
+        {
+            const QMutexLocker locker(mutex.get());
+            if (fd != ASSUAN_INVALID_FD) {
 #if defined(Q_OS_WIN32)
-            CloseHandle(fd);
+                CloseHandle(fd);
 #else
-            ::close(fd);
+                ::close(fd);
 #endif
+            }
+        }
+        if (nohupedCommands.empty()) {
+            bottomHalfDeletion();
         }
-        notifiers.clear();
-        closed = true;
     }
 
     void bottomHalfDeletion()
@@ -394,6 +489,8 @@ private:
         static const char capabilities[] =
             "SENDER=info\n"
             "RECIPIENT=info\n"
+            "RECIPIENTS=info\n"
+            "FILES\n"
             "SESSION\n"
             ;
         return assuan_process_done(ctx_, assuan_send_data(ctx_, capabilities, sizeof capabilities - 1));
@@ -490,8 +587,9 @@ private:
         AssuanServerConnection::Private &conn = *static_cast<AssuanServerConnection::Private *>(assuan_get_pointer(ctx_));
 
         char *binOpt = strstr(line_, "--binary");
+        const bool binary = binOpt && !in;
 
-        if (binOpt && !in) {
+        if (binary) {
             /* Note there is also --armor and --base64 allowed but we don't need
              * to parse those because they are default.
              * We remove it here so that it is not parsed as an Option.*/
@@ -505,8 +603,6 @@ private:
                 throw gpg_error(GPG_ERR_ASS_SYNTAX);
             }
 
-            std::shared_ptr< typename Input_or_Output<in>::type > io;
-
             if (options.count("FD")) {
 
                 if (options.count("FILE")) {
@@ -529,7 +625,7 @@ private:
 #endif
                 }
 
-                io = Input_or_Output<in>::type::createFromPipeDevice(fd, in ? i18n("Message #%1", (conn.*which).size() + 1) : QString());
+                conn.addIO<in>(which, fd, QString(), in ? i18n("Message #%1", (conn.*which).size() + 1) : QString(), binary);
 
                 options.erase("FD");
 
@@ -547,13 +643,17 @@ private:
                 if (!fi.isAbsolute()) {
                     throw Exception(gpg_error(GPG_ERR_INV_ARG), i18n("Only absolute file paths are allowed"));
                 }
-                if (!fi.isFile()) {
-                    throw Exception(gpg_error(GPG_ERR_INV_ARG), i18n("Only files are allowed in INPUT/OUTPUT FILE"));
-                } else {
-                    io = Input_or_Output<in>::type::createFromFile(fi.absoluteFilePath(), true);
-                }
 
                 options.erase("FILE");
+                if (options.size()) {
+                    throw gpg_error(GPG_ERR_UNKNOWN_OPTION);
+                }
+
+                // Stat'ing the file may block for a long time (think of
+                // network file systems), so the file is only checked and
+                // opened when a command uses it, see AssuanCommandFactory::_handle().
+                conn.addPendingFileIO(which, fi.absoluteFilePath(), binary);
+                return assuan_process_done(conn.ctx.get(), 0);
 
             } else {
 
@@ -565,17 +665,8 @@ private:
                 throw gpg_error(GPG_ERR_UNKNOWN_OPTION);
             }
 
-            (conn.*which).push_back(io);
-
-            if (binOpt && !in) {
-                auto out = reinterpret_cast <Output *>(io.get());
-                out->setBinaryOpt(true);
-                qCDebug(KLEOPATRA_LOG) << "Configured output for binary data";
-            }
-
-            qCDebug(KLEOPATRA_LOG) << "AssuanServerConnection: added" << io->label();
-
-            return assuan_process_done(conn.ctx.get(), 0);
+            // assuan_process_done() is called by addIO()
+            return 0;
         } catch (const GpgME::Exception &e) {
             return assuan_process_done_msg(conn.ctx.get(), e.error().encodedError(), e.message().c_str());
         } catch (const std::exception &) {
@@ -588,6 +679,110 @@ private:
 
     }
 
+    // INPUT/OUTPUT/MESSAGE FILE= whose Input or Output object is created
+    // when the next command is started, at position in the vector
+    struct PendingFileIO {
+        std::vector< std::shared_ptr<Input> > Private::*inputs; // nullptr for OUTPUT
+        size_t position;
+        QString filePath;
+        bool binary;
+    };
+
+    size_t numPendingFileIOs(std::vector< std::shared_ptr<Input> > Private::*which) const
+    {
+        return std::count_if(pendingFileIOs.begin(), pendingFileIOs.end(), [which](const PendingFileIO &io) {
+            return io.inputs == which;
+        });
+    }
+
+    // called in the Assuan handlers, with the mutex locked
+    void addPendingFileIO(std::vector< std::shared_ptr<Input> > Private::*which, const QString &filePath, bool)
+    {
+        pendingFileIOs.push_back({which, (this->*which).size() + numPendingFileIOs(which), filePath, false});
+    }
+
+    void addPendingFileIO(std::vector< std::shared_ptr<Output> > Private::*, const QString &filePath, bool binary)
+    {
+        pendingFileIOs.push_back({nullptr, outputs.size() + numPendingFileIOs(nullptr), filePath, binary});
+    }
+
+    // Creates the Input and Output objects for the pending INPUT/OUTPUT/MESSAGE
+    // FILE= and adds them to the connection. Throws if a file cannot be opened.
+    void insertPendingFileIOs(const std::vector<PendingFileIO> &pending)
+    {
+        std::vector< std::shared_ptr<Input> > fileInputs(pending.size());
+        std::vector< std::shared_ptr<Output> > fileOutputs(pending.size());
+        for (size_t i = 0; i < pending.size(); ++i) {
+            if (pending[i].inputs) {
+                fileInputs[i] = Input::createFromFile(pending[i].filePath, true);
+            } else {
+                fileOutputs[i] = Output::createFromFile(pending[i].filePath, true);
+                if (pending[i].binary) {
+                    fileOutputs[i]->setBinaryOpt(true);
+                    qCDebug(KLEOPATRA_LOG) << "Configured output for binary data";
+                }
+            }
+        }
+
+        const QMutexLocker locker(mutex.get());
+        // the positions are ascending per vector, so inserting in order works
+        for (size_t i = 0; i < pending.size(); ++i) {
+            if (pending[i].inputs) {
+                auto &v = this->*pending[i].inputs;
+                v.insert(v.begin() + std::min(pending[i].position, v.size()), fileInputs[i]);
+                qCDebug(KLEOPATRA_LOG) << "AssuanServerConnection: added" << fileInputs[i]->label();
+            } else {
+                outputs.insert(outputs.begin() + std::min(pending[i].position, outputs.size()), fileOutputs[i]);
+                qCDebug(KLEOPATRA_LOG) << "AssuanServerConnection: added" << fileOutputs[i]->label();
+            }
+        }
+    }
+
+    // Creates the Input or Output object in the GUI thread and finishes
+    // the INPUT/OUTPUT/MESSAGE command. Note that the options are
+    // validated before, so that the object is created last.
+    template <bool in, typename T_memptr>
+    void addIO(T_memptr which, assuan_fd_t fd, const QString &filePath, const QString &label, bool binary)
+    {
+        runInGuiThread([this, which, fd, filePath, label, binary]() {
+            using IO = typename Input_or_Output<in>::type;
+            std::shared_ptr<IO> io;
+            int err = 0;
+            QString errorMessage;
+            try {
+                io = fd != ASSUAN_INVALID_FD ? IO::createFromPipeDevice(fd, label) : IO::createFromFile(filePath, true);
+            } catch (const GpgME::Exception &e) {
+                err = e.error().encodedError();
+                errorMessage = QString::fromUtf8(e.message().c_str());
+            } catch (const std::exception &) {
+                err = gpg_error(GPG_ERR_ASS_SYNTAX);
+            } catch (...) {
+                err = gpg_error(GPG_ERR_UNEXPECTED);
+                errorMessage = QStringLiteral("unknown exception caught");
+            }
+            if (err) {
+                processDone(err, errorMessage);
+                return;
+            }
+
+            if (binary) {
+                auto out = reinterpret_cast <Output *>(io.get());
+                out->setBinaryOpt(true);
+                qCDebug(KLEOPATRA_LOG) << "Configured output for binary data";
+            }
+
+            const QMutexLocker locker(mutex.get());
+            if (closed || !ctx) {
+                return;
+            }
+            (this->*which).push_back(io);
+
+            qCDebug(KLEOPATRA_LOG) << "AssuanServerConnection: added" << io->label();
+
+            assuan_process_done(ctx.get(), 0);
+        });
+    }
+
 #ifndef HAVE_ASSUAN2
     static int input_handler(assuan_context_t ctx, char *line)
     {
@@ -633,13 +828,9 @@ private:
             if (!fi.isAbsolute()) {
                 throw Exception(gpg_error(GPG_ERR_INV_ARG), i18n("Only absolute file paths are allowed"));
             }
-            if (!fi.exists()) {
-                throw gpg_error(GPG_ERR_ENOENT);
-            }
-            if (!fi.isReadable() || (fi.isDir() && !fi.isExecutable())) {
-                throw gpg_error(GPG_ERR_EPERM);
-            }
 
+            // checked when a command uses it, like the files given with FILES
+            conn.uncheckedFiles.push_back(conn.files.size());
             conn.files.push_back(fi.absoluteFilePath());
 
             return assuan_process_done(conn.ctx.get(), 0);
@@ -652,6 +843,91 @@ private:
         }
     }
 
+    // Bulk variants of FILE and RECIPIENT: the command inquires all values
+    // at once, which saves a round-trip per value. The handler is called
+    // with the inquired data and has to call assuan_process_done().
+    using BulkDataHandler = std::function<int(Private &, const QByteArray &)>;
+
+    struct BulkInquiry {
+        Private *conn;
+        BulkDataHandler handler;
+    };
+
+#if defined(HAVE_ASSUAN2) || defined(HAVE_NEW_STYLE_ASSUAN_INQUIRE_EXT)
+# ifndef HAVE_ASSUAN2
+    static int bulk_inquiry_done(void *cb_data, int rc, unsigned char *buffer, size_t buflen)
+# else
+    static gpg_error_t bulk_inquiry_done(void *cb_data, gpg_error_t rc, unsigned char *buffer, size_t buflen)
+# endif
+    {
+        Q_ASSERT(cb_data);
+        const std::unique_ptr<BulkInquiry> inquiry(static_cast<BulkInquiry *>(cb_data));
+        if (rc) {
+            assuan_process_done(inquiry->conn->ctx.get(), rc);
+        } else {
+            inquiry->handler(*inquiry->conn, QByteArray::fromRawData(reinterpret_cast<const char *>(buffer), buflen));
+        }
+        std::free(buffer);
+        // an error here would end the connection, it has been reported above
+        return 0;
+    }
+#endif
+
+    int inquireBulkData(const char *keyword, BulkDataHandler handler)
+    {
+#if defined(HAVE_ASSUAN2) || defined(HAVE_NEW_STYLE_ASSUAN_INQUIRE_EXT)
+        std::unique_ptr<BulkInquiry> inquiry(new BulkInquiry{this, std::move(handler)});
+        if (const gpg_error_t err = assuan_inquire_ext(ctx.get(), keyword, MAX_BULK_INQUIRY_SIZE, &bulk_inquiry_done, inquiry.get())) {
+            return assuan_process_done(ctx.get(), err);
+        }
+        inquiry.release();
+        return 0;
+#else
+        Q_UNUSED(keyword)
+        Q_UNUSED(handler)
+        return assuan_process_done(ctx.get(), gpg_error(GPG_ERR_NOT_SUPPORTED));   // libassuan too old
+#endif
+    }
+
+    // format: FILES, then inquires FILES: <file name>\0<file name>\0...
+    // (the file names are not hex-encoded). The files are only checked
+    // when a command uses them, see AssuanCommandFactory::_handle().
+#ifndef HAVE_ASSUAN2
+    static int files_handler(assuan_context_t ctx_, char *line)
+    {
+#else
+    static gpg_error_t files_handler(assuan_context_t ctx_, char *line)
+    {
+#endif
+        Q_ASSERT(assuan_get_pointer(ctx_));
+        AssuanServerConnection::Private &conn = *static_cast<AssuanServerConnection::Private *>(assuan_get_pointer(ctx_));
+
+        if (!QByteArray(line).trimmed().isEmpty()) {
+            static const QString errorString = i18n("FILES does not take arguments");
+            return assuan_process_done_msg(ctx_, gpg_error(GPG_ERR_ASS_PARAMETER), errorString);
+        }
+
+        return conn.inquireBulkData("FILES", [](Private &connection, const QByteArray &data) -> int {
+            std::vector<QString> files;
+            for (const QByteArray &name : data.split('\0')) {
+                if (name.isEmpty()) {
+                    continue;
+                }
+                const QFileInfo fi(QFile::decodeName(name));
+                if (!fi.isAbsolute())
+                    return assuan_process_done_msg(connection.ctx.get(), gpg_error(GPG_ERR_INV_ARG),
+                                                   i18n("Only absolute file paths are allowed"));
+                files.push_back(fi.absoluteFilePath());
+            }
+            connection.files.reserve(connection.files.size() + files.size());
+            for (QString &file : files) {
+                connection.uncheckedFiles.push_back(connection.files.size());
+                connection.files.push_back(std::move(file));
+            }
+            return assuan_process_done(connection.ctx.get(), 0);
+        });
+    }
+
     static bool parse_informative(const char *&begin, GpgME::Protocol &protocol)
     {
         protocol = GpgME::UnknownProtocol;
@@ -743,6 +1019,50 @@ private:
         return recipient_sender_handler(&Private::recipients, &Private::informativeRecipients, ctx, line);
     }
 
+    // format: RECIPIENTS [--info] [--protocol=...], then inquires
+    // RECIPIENTS: one RFC-2822 mailbox per line
+#ifndef HAVE_ASSUAN2
+    static int recipients_handler(assuan_context_t ctx_, char *line)
+    {
+#else
+    static gpg_error_t recipients_handler(assuan_context_t ctx_, char *line)
+    {
+#endif
+        Q_ASSERT(assuan_get_pointer(ctx_));
+        AssuanServerConnection::Private &conn = *static_cast<AssuanServerConnection::Private *>(assuan_get_pointer(ctx_));
+
+        const char *begin = line ? line : "";
+        GpgME::Protocol proto = GpgME::UnknownProtocol;
+        const bool informative = parse_informative(begin, proto);
+        if (*begin) {
+            static const QString errorString = i18n("RECIPIENTS only takes the --info and --protocol options");
+            return assuan_process_done_msg(ctx_, gpg_error(GPG_ERR_ASS_PARAMETER), errorString);
+        }
+
+        return conn.inquireBulkData("RECIPIENTS", [informative](Private &connection, const QByteArray &data) -> int {
+            if (!connection.recipients.empty() && informative != connection.informativeRecipients)
+                return assuan_process_done_msg(connection.ctx.get(), gpg_error(GPG_ERR_CONFLICT),
+                                               i18n("Cannot mix --info with non-info SENDER or RECIPIENT"));
+            std::vector<KMime::Types::Mailbox> mailboxes;
+            for (const QByteArray &line : data.split('\n')) {
+                const QByteArray address = line.trimmed();
+                if (address.isEmpty()) {
+                    continue;
+                }
+                const char *begin     = address.constData();
+                const char *const end = begin + address.size();
+                KMime::Types::Mailbox mb;
+                if (!KMime::HeaderParsing::parseMailbox(begin, end, mb) || begin != end)
+                    return assuan_process_done_msg(connection.ctx.get(), gpg_error(GPG_ERR_INV_ARG),
+                                                   i18n("\"%1\" is not a valid RFC-2822 mailbox", QString::fromUtf8(address)));
+                mailboxes.push_back(mb);
+            }
+            connection.informativeRecipients = informative;
+            connection.recipients.insert(connection.recipients.end(), mailboxes.begin(), mailboxes.end());
+            return assuan_process_done(connection.ctx.get(), 0);
+        });
+    }
+
 #ifndef HAVE_ASSUAN2
     static int sender_handler(assuan_context_t ctx, char *line)
     {
@@ -829,18 +1149,31 @@ private:
         sessionId = 0;
         mementos.clear();
         files.clear();
-        std::for_each(inputs.begin(), inputs.end(), std::mem_fn(&Input::finalize));
+        uncheckedFiles.clear();
+        pendingFileIOs.clear();
+        const auto finalize = [oldInputs = std::move(inputs), oldOutputs = std::move(outputs), oldMessages = std::move(messages)]() {
+            std::for_each(oldInputs.begin(), oldInputs.end(), std::mem_fn(&Input::finalize));
+            std::for_each(oldOutputs.begin(), oldOutputs.end(), std::mem_fn(&Output::finalize));
+            std::for_each(oldMessages.begin(), oldMessages.end(), std::mem_fn(&Input::finalize));
+        };
         inputs.clear();
-        std::for_each(outputs.begin(), outputs.end(), std::mem_fn(&Output::finalize));
         outputs.clear();
-        std::for_each(messages.begin(), messages.end(), std::mem_fn(&Input::finalize));
         messages.clear();
+        if (QThread::currentThread() == q->thread()) {
+            finalize();
+        } else {
+            runInGuiThread(finalize);
+        }
         bias = GpgME::UnknownProtocol;
     }
 
+    // guards ctx and everything the Assuan handlers touch; shared with the
+    // commands, which may outlive the connection
+    const std::shared_ptr<QMutex> mutex;
     assuan_fd_t fd;
+    std::shared_ptr<AsyncLog::Channel> logChannel; // also kept alive by ctx
     AssuanContext ctx;
-    bool closed                : 1;
+    bool closed; // not a bit-field, it's written in the reading thread
     bool cryptoCommandsEnabled : 1;
     bool commandWaitingForCryptoCommandsEnabled : 1;
     bool currentCommandIsNohup : 1;
@@ -858,24 +1191,28 @@ private:
     std::vector< std::shared_ptr<Input> > inputs, messages;
     std::vector< std::shared_ptr<Output> > outputs;
     std::vector<QString> files;
+    std::vector<size_t> uncheckedFiles; // indexes into files
+    std::vector<PendingFileIO> pendingFileIOs;
     std::map< QByteArray, std::shared_ptr<AssuanCommand::Memento> > mementos;
 };
 
 void AssuanServerConnection::Private::cleanup()
 {
     Q_ASSERT(nohupedCommands.empty());
-    reset();
     currentCommand.reset();
     currentCommandIsNohup = false;
     commandWaitingForCryptoCommandsEnabled = false;
+    const QMutexLocker locker(mutex.get());
+    reset();
     notifiers.clear();
     ctx.reset();
     fd = ASSUAN_INVALID_FD;
 }
 
-AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories_, AssuanServerConnection *qq)
+AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories_, QThread *workerThread, AssuanServerConnection *qq)
     : QObject(),
       q(qq),
+      mutex(std::make_shared<QMutex>()),
       fd(fd_),
       closed(false),
       cryptoCommandsEnabled(false),
@@ -900,11 +1237,21 @@ AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std
     if (const gpg_error_t err = assuan_init_socket_server_ext(&naked_ctx, fd, INIT_SOCKET_FLAGS))
 #else
     {
+        // log the traffic of each connection to a channel of its own,
+        // instead of having all connections write to the same FILE
+        static QAtomicInt connectionCounter;
+        logChannel = Log::instance()->createAssuanLogChannel("connection-" + QByteArray::number(connectionCounter.fetchAndAddRelaxed(1) + 1));
         assuan_context_t naked_ctx = nullptr;
-        if (const gpg_error_t err = assuan_new(&naked_ctx)) {
+        if (logChannel) {
+            if (const gpg_error_t err = assuan_new_ext(&naked_ctx, assuan_get_gpg_err_source(), assuan_get_malloc_hooks(),
+                                                       &log_to_channel, logChannel.get())) {
+                throw Exception(err, "assuan_new_ext");
+            }
+        } else if (const gpg_error_t err = assuan_new(&naked_ctx)) {
             throw Exception(err, "assuan_new");
         }
-        ctx.reset(naked_ctx);
+        // the commands may keep using the context after the connection is gone
+        ctx.reset(naked_ctx, logChannel);
     }
     if (const gpg_error_t err = assuan_init_socket_server(ctx.get(), fd, INIT_SOCKET_FLAGS))
 #endif
@@ -917,8 +1264,10 @@ AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std
     // for callbacks, associate the context with this connection:
     assuan_set_pointer(ctx.get(), this);
 
-    FILE *const logFile = Log::instance()->logFile();
-    assuan_set_log_stream(ctx.get(), logFile ? logFile : stderr);
+    if (!logChannel) {
+        FILE *const logFile = Log::instance()->logFile();
+        assuan_set_log_stream(ctx.get(), logFile ? logFile : stderr);
+    }
 
     // register FDs with the event loop:
     assuan_fd_t fds[MAX_ACTIVE_FDS];
@@ -963,6 +1312,12 @@ AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std
     if (const gpg_error_t err = assuan_register_command(ctx.get(), "FILE", file_handler, ""))
 #endif
         throw Exception(err, "register \"FILE\" handler");
+#ifndef HAVE_ASSUAN2
+    if (const gpg_error_t err = assuan_register_command(ctx.get(), "FILES", files_handler))
+#else
+    if (const gpg_error_t err = assuan_register_command(ctx.get(), "FILES", files_handler, ""))
+#endif
+        throw Exception(err, "register \"FILES\" handler");
 
     // register user-defined commands:
     for (std::shared_ptr<AssuanCommandFactory> fac : std::as_const(factories))
@@ -997,6 +1352,12 @@ AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std
     if (const gpg_error_t err = assuan_register_command(ctx.get(), "RECIPIENT", recipient_handler, ""))
 #endif
         throw Exception(err, "register \"RECIPIENT\" handler");
+#ifndef HAVE_ASSUAN2
+    if (const gpg_error_t err = assuan_register_command(ctx.get(), "RECIPIENTS", recipients_handler))
+#else
+    if (const gpg_error_t err = assuan_register_command(ctx.get(), "RECIPIENTS", recipients_handler, ""))
+#endif
+        throw Exception(err, "register \"RECIPIENTS\" handler");
 #ifndef HAVE_ASSUAN2
     if (const gpg_error_t err = assuan_register_command(ctx.get(), "SENDER", sender_handler))
 #else
@@ -1033,6 +1394,13 @@ AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std
     if (const gpg_error_t err = assuan_accept(ctx.get())) {
         throw Exception(err, "assuan_accept");
     }
+
+    if (workerThread) {
+        for (const std::shared_ptr<QSocketNotifier> &sn : std::as_const(notifiers)) {
+            sn->moveToThread(workerThread);
+        }
+        moveToThread(workerThread);
+    }
 }
 
 AssuanServerConnection::Private::~Private()
@@ -1040,8 +1408,8 @@ AssuanServerConnection::Private::~Private()
     cleanup();
 }
 
-AssuanServerConnection::AssuanServerConnection(assuan_fd_t fd, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories, QObject *p)
-    : QObject(p), d(new Private(fd, factories, this))
+AssuanServerConnection::AssuanServerConnection(assuan_fd_t fd, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories, QThread *workerThread, QObject *p)
+    : QObject(p), d(new Private(fd, factories, workerThread, this))
 {
 
 }
@@ -1055,7 +1423,9 @@ void AssuanServerConnection::enableCryptoCommands(bool on)
     }
     d->cryptoCommandsEnabled = on;
     if (d->commandWaitingForCryptoCommandsEnabled) {
-        QTimer::singleShot(0, d.get(), &Private::startCommandBottomHalf);
+        QTimer::singleShot(0, this, [this]() {
+            d->startCommandBottomHalf();
+        });
     }
 }
 
@@ -1094,9 +1464,10 @@ public:
     {
         Q_ASSERT(cb_data);
         auto this_ = static_cast<InquiryHandler *>(cb_data);
-        Q_EMIT this_->signal(rc, QByteArray::fromRawData(reinterpret_cast<const char *>(buffer), buflen), this_->keyword);
+        // called in the reading thread, so the data is delivered queued and has to be copied
+        Q_EMIT this_->signal(rc, QByteArray(reinterpret_cast<const char *>(buffer), buflen), this_->keyword);
         std::free(buffer);
-        delete this_;
+        this_->deleteLater();
         return 0;
     }
 # else
@@ -1104,9 +1475,9 @@ public:
     {
         Q_ASSERT(cb_data);
         InquiryHandler *this_ = static_cast<InquiryHandler *>(cb_data);
-        Q_EMIT this_->signal(rc, QByteArray::fromRawData(reinterpret_cast<const char *>(this_->buffer), this_->buflen), this_->keyword);
+        Q_EMIT this_->signal(rc, QByteArray(reinterpret_cast<const char *>(this_->buffer), this_->buflen), this_->keyword);
         std::free(this_->buffer);
-        delete this_;
+        this_->deleteLater();
         return 0;
     }
 # endif
@@ -1126,6 +1497,138 @@ Q_SIGNALS:
 
 } // namespace Kleo
 
+namespace
+{
+
+// hands the inquired data to the handler in chunks, instead of copying
+// all of it into one QByteArray
+void deliver_chunks(const AssuanCommand::InquiryChunkHandler &handler, int rc,
+                    const std::shared_ptr<unsigned char> &buffer, size_t buflen, size_t chunkSize)
+{
+    if (rc) {
+        handler(rc, QByteArray(), true);
+        return;
+    }
+    const char *data = reinterpret_cast<const char *>(buffer.get());
+    do {
+        const size_t n = std::min(buflen, chunkSize);
+        handler(0, QByteArray(data, n), n == buflen);
+        data += n;
+        buflen -= n;
+    } while (buflen);
+}
+
+#if defined(HAVE_ASSUAN2) || defined(HAVE_ASSUAN_INQUIRE_EXT)
+struct ChunkedInquiryHandler {
+    QPointer<QObject> context;
+    AssuanCommand::InquiryChunkHandler handler;
+    size_t chunkSize;
+# if !defined(HAVE_ASSUAN2) && !defined(HAVE_NEW_STYLE_ASSUAN_INQUIRE_EXT)
+    unsigned char *buffer = nullptr;
+    size_t buflen = 0;
+# endif
+
+    // called in the reading thread; the buffer is passed on to the GUI
+    // thread, which frees it after the last chunk. The context may be
+    // deleted in the GUI thread at any time, so it's only checked there.
+    void deliver(int rc, unsigned char *buffer, size_t buflen)
+    {
+        const std::shared_ptr<unsigned char> data(buffer, &std::free);
+        const QPointer<QObject> context_ = context;
+        const auto handler_ = handler;
+        const size_t chunkSize_ = chunkSize;
+        QMetaObject::invokeMethod(qApp, [context_, handler_, rc, data, buflen, chunkSize_]() {
+            if (context_) {
+                deliver_chunks(handler_, rc, data, buflen, chunkSize_);
+            }
+        }, Qt::QueuedConnection);
+        delete this;
+    }
+
+# if defined(HAVE_ASSUAN2) || defined(HAVE_NEW_STYLE_ASSUAN_INQUIRE_EXT)
+#  ifndef HAVE_ASSUAN2
+    static int handler_cb(void *cb_data, int rc, unsigned char *buffer, size_t buflen)
+#  else
+    static gpg_error_t handler_cb(void *cb_data, gpg_error_t rc, unsigned char *buffer, size_t buflen)
+#  endif
+    {
+        Q_ASSERT(cb_data);
+        static_cast<ChunkedInquiryHandler *>(cb_data)->deliver(rc, buffer, buflen);
+        return 0;
+    }
+# else
+    static int handler_cb(void *cb_data, int rc)
+    {
+        Q_ASSERT(cb_data);
+        auto this_ = static_cast<ChunkedInquiryHandler *>(cb_data);
+        this_->deliver(rc, this_->buffer, this_->buflen);
+        return 0;
+    }
+# endif
+};
+#endif // defined(HAVE_ASSUAN2) || defined(HAVE_ASSUAN_INQUIRE_EXT)
+
+// a write-only device sending everything written to it as data to the client
+class DataOutputDevice : public QIODevice
+{
+public:
+    explicit DataOutputDevice(const std::shared_ptr<AssuanCommand> &command)
+        : QIODevice(), m_command(command)
+    {
+        open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+
+    void close() override
+    {
+        if (isOpen()) {
+            if (const std::shared_ptr<AssuanCommand> command = m_command.lock()) {
+                try {
+                    command->sendData(QByteArray(), false);
+                } catch (const Exception &e) {
+                    qCDebug(KLEOPATRA_LOG) << e.message();
+                }
+            }
+        }
+        QIODevice::close();
+    }
+
+protected:
+    qint64 readData(char *, qint64) override
+    {
+        return -1;
+    }
+
+    qint64 writeData(const char *data, qint64 size) override
+    {
+        const std::shared_ptr<AssuanCommand> command = m_command.lock();
+        if (!command) {
+            setErrorString(i18n("Cannot send data"));
+            return -1;
+        }
+        try {
+            command->sendData(QByteArray::fromRawData(data, size), true);
+        } catch (const Exception &e) {
+            setErrorString(e.message());
+            return -1;
+        }
+        // sent synchronously; report it the way asynchronous devices do
+        QMetaObject::invokeMethod(this, [this, size]() {
+            Q_EMIT bytesWritten(size);
+        }, Qt::QueuedConnection);
+        return size;
+    }
+
+private:
+    const std::weak_ptr<AssuanCommand> m_command;
+};
+
+}
+
 class AssuanCommand::Private
 {
 public:
@@ -1150,6 +1653,8 @@ public:
     unsigned int sessionId;
     QByteArray utf8ErrorKeepAlive;
     AssuanContext ctx;
+    std::shared_ptr<QMutex> mutex; // the connection's, guards ctx
+    std::shared_ptr<QIODevice> dataOutput;
     bool done;
     bool nohup;
 };
@@ -1252,8 +1757,9 @@ const std::map< QByteArray, std::shared_ptr<AssuanCommand::Memento> > &AssuanCom
 
 bool AssuanCommand::hasMemento(const QByteArray &tag) const
 {
+    const QMutexLocker locker(d->mutex.get());
     if (const unsigned int id = sessionId()) {
-        return SessionDataHandler::instance()->sessionData(id)->mementos.count(tag) || mementos().count(tag);
+        return SessionDataHandler::instance()->sessionData(id)->hasMemento(tag) || mementos().count(tag);
     } else {
         return mementos().count(tag);
     }
@@ -1261,12 +1767,10 @@ bool AssuanCommand::hasMemento(const QByteArray &tag) const
 
 std::shared_ptr<AssuanCommand::Memento> AssuanCommand::memento(const QByteArray &tag) const
 {
+    const QMutexLocker locker(d->mutex.get());
     if (const unsigned int id = sessionId()) {
-        const std::shared_ptr<SessionDataHandler> sdh = SessionDataHandler::instance();
-        const std::shared_ptr<SessionData> sd = sdh->sessionData(id);
-        const auto it = sd->mementos.find(tag);
-        if (it != sd->mementos.end()) {
-            return it->second;
+        if (const std::shared_ptr<Memento> mem = SessionDataHandler::instance()->sessionData(id)->memento(tag)) {
+            return mem;
         }
     }
     const auto it = mementos().find(tag);
@@ -1289,8 +1793,9 @@ QByteArray AssuanCommand::registerMemento(const QByteArray &tag, const std::shar
     Q_ASSERT(assuan_get_pointer(d->ctx.get()));
     AssuanServerConnection::Private &conn = *static_cast<AssuanServerConnection::Private *>(assuan_get_pointer(d->ctx.get()));
 
+    const QMutexLocker locker(d->mutex.get());
     if (const unsigned int id = sessionId()) {
-        SessionDataHandler::instance()->sessionData(id)->mementos[tag] = mem;
+        SessionDataHandler::instance()->sessionData(id)->setMemento(tag, mem);
     } else {
         conn.mementos[tag] = mem;
     }
@@ -1303,9 +1808,10 @@ void AssuanCommand::removeMemento(const QByteArray &tag)
     Q_ASSERT(assuan_get_pointer(d->ctx.get()));
     AssuanServerConnection::Private &conn = *static_cast<AssuanServerConnection::Private *>(assuan_get_pointer(d->ctx.get()));
 
+    const QMutexLocker locker(d->mutex.get());
     conn.mementos.erase(tag);
     if (const unsigned int id = sessionId()) {
-        SessionDataHandler::instance()->sessionData(id)->mementos.erase(tag);
+        SessionDataHandler::instance()->sessionData(id)->removeMemento(tag);
     }
 }
 
@@ -1347,6 +1853,7 @@ void AssuanCommand::sendStatusEncoded(const char *keyword, const std::string &te
     if (d->nohup) {
         return;
     }
+    const QMutexLocker locker(d->mutex.get());
     if (const int err = assuan_write_status(d->ctx.get(), keyword, text.c_str())) {
         throw Exception(err, i18n("Cannot send \"%1\" status", QString::fromLatin1(keyword)));
     }
@@ -1357,6 +1864,7 @@ void  AssuanCommand::sendData(const QByteArray &data, bool moreToCome)
     if (d->nohup) {
         return;
     }
+    const QMutexLocker locker(d->mutex.get());
     if (const gpg_error_t err = assuan_send_data(d->ctx.get(), data.constData(), data.size())) {
         throw Exception(err, i18n("Cannot send data"));
     }
@@ -1366,6 +1874,45 @@ void  AssuanCommand::sendData(const QByteArray &data, bool moreToCome)
         }
 }
 
+std::shared_ptr<QIODevice> AssuanCommand::dataOutputDevice()
+{
+    if (!d->dataOutput) {
+        d->dataOutput = std::make_shared<DataOutputDevice>(shared_from_this());
+    }
+    return d->dataOutput;
+}
+
+int AssuanCommand::inquire(const char *keyword, QObject *context, const InquiryChunkHandler &handler, unsigned int maxSize, int chunkSize)
+{
+    Q_ASSERT(keyword);
+    Q_ASSERT(context);
+    Q_ASSERT(handler);
+    Q_ASSERT(chunkSize > 0);
+
+    if (d->nohup) {
+        return makeError(GPG_ERR_INV_OP);
+    }
+
+#if defined(HAVE_ASSUAN2) || defined(HAVE_ASSUAN_INQUIRE_EXT)
+    std::unique_ptr<ChunkedInquiryHandler> ih(new ChunkedInquiryHandler);
+    ih->context = context;
+    ih->handler = handler;
+    ih->chunkSize = chunkSize;
+    const QMutexLocker locker(d->mutex.get());
+    if (const gpg_error_t err = assuan_inquire_ext(d->ctx.get(), keyword,
+# if !defined(HAVE_ASSUAN2) && !defined(HAVE_NEW_STYLE_ASSUAN_INQUIRE_EXT)
+                                &ih->buffer, &ih->buflen,
+# endif
+                                maxSize, ChunkedInquiryHandler::handler_cb, ih.get())) {
+        return err;
+    }
+    ih.release();
+    return 0;
+#else
+    return makeError(GPG_ERR_NOT_SUPPORTED);   // libassuan too old
+#endif // defined(HAVE_ASSUAN2) || defined(HAVE_ASSUAN_INQUIRE_EXT)
+}
+
 int AssuanCommand::inquire(const char *keyword, QObject *receiver, const char *slot, unsigned int maxSize)
 {
     Q_ASSERT(keyword);
@@ -1379,6 +1926,7 @@ int AssuanCommand::inquire(const char *keyword, QObject *receiver, const char *s
 #if defined(HAVE_ASSUAN2) || defined(HAVE_ASSUAN_INQUIRE_EXT)
     std::unique_ptr<InquiryHandler> ih(new InquiryHandler(keyword, receiver));
     receiver->connect(ih.get(), SIGNAL(signal(int,QByteArray,QByteArray)), slot);
+    const QMutexLocker locker(d->mutex.get());
     if (const gpg_error_t err = assuan_inquire_ext(d->ctx.get(), keyword,
 # if !defined(HAVE_ASSUAN2) && !defined(HAVE_NEW_STYLE_ASSUAN_INQUIRE_EXT)
                                 &ih->buffer, &ih->buflen,
@@ -1399,6 +1947,7 @@ void AssuanCommand::done(const GpgME::Error &err, const QString &details)
         qCDebug(KLEOPATRA_LOG) << "Error: " << details;
         d->utf8ErrorKeepAlive = details.toUtf8();
         if (!d->nohup) {
+            const QMutexLocker locker(d->mutex.get());
             assuan_set_error(d->ctx.get(), err.encodedError(), d->utf8ErrorKeepAlive.constData());
         }
     }
@@ -1425,6 +1974,10 @@ void AssuanCommand::done(const GpgME::Error &err)
     d->inputs.clear();
     d->outputs.clear();
     d->files.clear();
+    if (d->dataOutput) {
+        d->dataOutput->close(); // flushes
+        d->dataOutput.reset();
+    }
 
     // oh, hack :(
     Q_ASSERT(assuan_get_pointer(d->ctx.get()));
@@ -1435,10 +1988,17 @@ void AssuanCommand::done(const GpgME::Error &err)
         return;
     }
 
-    const gpg_error_t rc = assuan_process_done(d->ctx.get(), err.encodedError());
-    if (gpg_err_code(rc) != GPG_ERR_NO_ERROR)
-        qFatal("AssuanCommand::done: assuan_process_done returned error %d (%s)",
-               static_cast<int>(rc), gpg_strerror(rc));
+    {
+        const QMutexLocker locker(d->mutex.get());
+        if (conn.closed) {
+            // the connection is being torn down in the reading thread
+            return;
+        }
+        const gpg_error_t rc = assuan_process_done(d->ctx.get(), err.encodedError());
+        if (gpg_err_code(rc) != GPG_ERR_NO_ERROR)
+            qFatal("AssuanCommand::done: assuan_process_done returned error %d (%s)",
+                   static_cast<int>(rc), gpg_strerror(rc));
+    }
 
     d->utf8ErrorKeepAlive.clear();
 
@@ -1508,41 +2068,114 @@ gpg_error_t AssuanCommandFactory::_handle(assuan_context_t ctx, char *line, cons
         kleo_assert(*it);
         kleo_assert(qstricmp((*it)->name(), commandName) == 0);
 
-        const std::shared_ptr<AssuanCommand> cmd = (*it)->create();
-        kleo_assert(cmd);
-
-        cmd->d->ctx     = conn.ctx;
-        cmd->d->options = conn.options;
-        cmd->d->inputs.swap(conn.inputs);     kleo_assert(conn.inputs.empty());
-        cmd->d->messages.swap(conn.messages); kleo_assert(conn.messages.empty());
-        cmd->d->outputs.swap(conn.outputs);   kleo_assert(conn.outputs.empty());
-        cmd->d->files.swap(conn.files);       kleo_assert(conn.files.empty());
-        cmd->d->senders.swap(conn.senders);   kleo_assert(conn.senders.empty());
-        cmd->d->recipients.swap(conn.recipients); kleo_assert(conn.recipients.empty());
-        cmd->d->informativeRecipients = conn.informativeRecipients;
-        cmd->d->informativeSenders    = conn.informativeSenders;
-        cmd->d->bias                  = conn.bias;
-        cmd->d->sessionTitle          = conn.sessionTitle;
-        cmd->d->sessionId             = conn.sessionId;
+        const std::shared_ptr<AssuanCommandFactory> factory = *it;
+
+        // the files given with FILE and FILES, and INPUT/OUTPUT/MESSAGE FILE=,
+        // are checked now that they are used
+        std::vector<QString> filesToCheck;
+        filesToCheck.reserve(conn.uncheckedFiles.size());
+        for (const size_t i : std::as_const(conn.uncheckedFiles)) {
+            filesToCheck.push_back(conn.files[i]);
+        }
+        conn.uncheckedFiles.clear();
+        std::vector<AssuanServerConnection::Private::PendingFileIO> pendingFileIOs;
+        pendingFileIOs.swap(conn.pendingFileIOs);
 
+        std::map<std::string, QVariant> options = conn.options;
         const std::map<std::string, std::string> cmdline_options = parse_commandline(line);
         for (auto it = cmdline_options.begin(), end = cmdline_options.end(); it != end; ++it) {
-            cmd->d->options[it->first] = QString::fromUtf8(it->second.c_str());
+            options[it->first] = QString::fromUtf8(it->second.c_str());
         }
 
         bool nohup = false;
-        if (cmd->d->options.count("nohup")) {
-            if (!cmd->d->options["nohup"].toString().isEmpty()) {
+        if (options.count("nohup")) {
+            if (!options["nohup"].toString().isEmpty()) {
                 return assuan_process_done_msg(conn.ctx.get(), gpg_error(GPG_ERR_ASS_PARAMETER), "--nohup takes no argument");
             }
             nohup = true;
-            cmd->d->options.erase("nohup");
+            options.erase("nohup");
         }
 
-        conn.currentCommand = cmd;
-        conn.currentCommandIsNohup = nohup;
+        // Commands create dialogs and controllers, so they are created and
+        // started in the GUI thread. The client waits for the command to
+        // finish, so the connection state doesn't change in the meantime.
+        AssuanServerConnection::Private *const connp = &conn;
+        const auto start = [connp, factory, options, nohup, pendingFileIOs]() {
+            try {
+                connp->insertPendingFileIOs(pendingFileIOs);
+
+                const std::shared_ptr<AssuanCommand> cmd = factory->create();
+                kleo_assert(cmd);
+
+                {
+                    const QMutexLocker locker(connp->mutex.get());
+                    if (connp->closed) {
+                        return;
+                    }
+                    cmd->d->ctx     = connp->ctx;
+                    cmd->d->mutex   = connp->mutex;
+                    cmd->d->options = options;
+                    cmd->d->inputs.swap(connp->inputs);     kleo_assert(connp->inputs.empty());
+                    cmd->d->messages.swap(connp->messages); kleo_assert(connp->messages.empty());
+                    cmd->d->outputs.swap(connp->outputs);   kleo_assert(connp->outputs.empty());
+                    cmd->d->files.swap(connp->files);       kleo_assert(connp->files.empty());
+                    cmd->d->senders.swap(connp->senders);   kleo_assert(connp->senders.empty());
+                    cmd->d->recipients.swap(connp->recipients); kleo_assert(connp->recipients.empty());
+                    cmd->d->informativeRecipients = connp->informativeRecipients;
+                    cmd->d->informativeSenders    = connp->informativeSenders;
+                    cmd->d->bias                  = connp->bias;
+                    cmd->d->sessionTitle          = connp->sessionTitle;
+                    cmd->d->sessionId             = connp->sessionId;
+                }
 
-        QTimer::singleShot(0, &conn, &AssuanServerConnection::Private::startCommandBottomHalf);
+                connp->currentCommand = cmd;
+                connp->currentCommandIsNohup = nohup;
+
+                connp->startCommandBottomHalf();
+            } catch (const Exception &e) {
+                connp->processDone(e.error_code(), e.message());
+            } catch (const std::exception &e) {
+                connp->processDone(gpg_error(GPG_ERR_UNEXPECTED), QString::fromLocal8Bit(e.what()));
+            } catch (...) {
+                connp->processDone(gpg_error(GPG_ERR_UNEXPECTED), i18n("Caught unknown exception"));
+            }
+        };
+
+        if (filesToCheck.empty() && pendingFileIOs.empty()) {
+            conn.runInGuiThread(start);
+            return 0;
+        }
+
+        // Stat the files in one batch in a thread of the pool: neither the
+        // GUI thread nor the thread serving the other connections may block
+        // on a slow file system. The connection may go away in the meantime.
+        const QPointer<AssuanServerConnection> guard(conn.q);
+        QThreadPool::globalInstance()->start([guard, connp, start, filesToCheck, pendingFileIOs]() {
+            int err = 0;
+            QString errorMessage;
+            try {
+                FileInfoCache &cache = FileInfoCache::instance();
+                for (const QString &file : filesToCheck) {
+                    check_file(cache.info(file));
+                }
+                for (const auto &io : pendingFileIOs) {
+                    check_io_file(cache.info(io.filePath));
+                }
+            } catch (const Exception &e) {
+                err = e.error_code();
+                errorMessage = e.message();
+            }
+            QMetaObject::invokeMethod(QCoreApplication::instance(), [guard, connp, start, err, errorMessage]() {
+                if (!guard) {
+                    return;
+                }
+                if (err) {
+                    connp->processDone(err, errorMessage);
+                } else {
+                    start();
+                }
+            }, Qt::QueuedConnection);
+        });
 
         return 0;
 
@@ -1580,7 +2213,7 @@ int AssuanServerConnection::Private::startCommandBottomHalf()
             if (cmd->isDone()) {
                 return err;
             } else {
-                return assuan_process_done(ctx.get(), err);
+                return processDone(err);
             }
         }
 
@@ -1591,18 +2224,18 @@ int AssuanServerConnection::Private::startCommandBottomHalf()
         if (nohup) {
             cmd->setNohup(true);
             nohupedCommands.push_back(cmd);
-            return assuan_process_done_msg(ctx.get(), 0, "Command put in the background to continue executing after connection end.");
+            return processDone(0, QStringLiteral("Command put in the background to continue executing after connection end."));
         } else {
             currentCommand = cmd;
             return 0;
         }
 
     } catch (const Exception &e) {
-        return assuan_process_done_msg(ctx.get(), e.error_code(), e.message());
+        return processDone(e.error_code(), e.message());
     } catch (const std::exception &e) {
-        return assuan_process_done_msg(ctx.get(), gpg_error(GPG_ERR_UNEXPECTED), e.what());
+        return processDone(gpg_error(GPG_ERR_UNEXPECTED), QString::fromLocal8Bit(e.what()));
     } catch (...) {
-        return assuan_process_done_msg(ctx.get(), gpg_error(GPG_ERR_UNEXPECTED), i18n("Caught unknown exception"));
+        return processDone(gpg_error(GPG_ERR_UNEXPECTED), i18n("Caught unknown exception"));
     }
 
 }
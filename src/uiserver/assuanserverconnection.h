@@ -19,6 +19,8 @@
 #include <string>
 #include <vector>
 
+class QThread;
+
 namespace Kleo
 {
 
@@ -28,7 +30,13 @@ class AssuanServerConnection : public QObject
 {
     Q_OBJECT
 public:
-    AssuanServerConnection(assuan_fd_t fd, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories, QObject *parent = nullptr);
+    /**
+     * Creates a connection for the client socket @p fd. If @p workerThread
+     * is given, the socket is read and the Assuan protocol is handled in
+     * that thread; the commands themselves are always created and started
+     * in the thread the connection is created in.
+     */
+    AssuanServerConnection(assuan_fd_t fd, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories, QThread *workerThread = nullptr, QObject *parent = nullptr);
     ~AssuanServerConnection() override;
 
 public Q_SLOTS:
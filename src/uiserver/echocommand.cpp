@@ -31,11 +31,15 @@ using namespace Kleo;
 
 static const char option_prefix[] = "prefix";
 
+// inquired data is echoed in chunks that fit into a status line
+static const int ECHOINQ_CHUNK_SIZE = 512;
+
 class EchoCommand::Private
 {
 public:
     int operationsInFlight = 0;
     QByteArray buffer;
+    std::shared_ptr<QIODevice> output;
 };
 
 EchoCommand::EchoCommand()
@@ -49,10 +53,6 @@ int EchoCommand::doStart()
     const std::vector< std::shared_ptr<Input> > in = inputs(), msg = messages();
     const std::vector< std::shared_ptr<Output> > out = outputs();
 
-    if (!in.empty() && out.empty()) {
-        return makeError(GPG_ERR_NOT_SUPPORTED);
-    }
-
     if (!msg.empty()) {
         return makeError(GPG_ERR_NOT_SUPPORTED);
     }
@@ -79,16 +79,20 @@ int EchoCommand::doStart()
     // 2. if --inquire was given, inquire more data from the client:
     if (!keyword.empty()) {
         if (const int err = inquire(keyword.c_str(), this,
-                                    SLOT(slotInquireData(int,QByteArray)))) {
+                                    [this](int rc, const QByteArray &chunk, bool last) {
+                                        slotInquireData(rc, chunk, last);
+                                    }, 0, ECHOINQ_CHUNK_SIZE)) {
             return err;
         } else {
             ++d->operationsInFlight;
         }
     }
 
-    // 3. if INPUT was given, start the data pump for input->output
+    // 3. if INPUT was given, start the data pump for input->output,
+    //    or input->data channel if there's no OUTPUT
     if (const std::shared_ptr<QIODevice> i = in.at(0)->ioDevice()) {
-        const std::shared_ptr<QIODevice> o = out.at(0)->ioDevice();
+        const std::shared_ptr<QIODevice> o = out.empty() ? dataOutputDevice() : out.at(0)->ioDevice();
+        d->output = o;
 
         ++d->operationsInFlight;
 
@@ -111,10 +115,12 @@ void EchoCommand::doCanceled()
 
 }
 
-void EchoCommand::slotInquireData(int rc, const QByteArray &data)
+void EchoCommand::slotInquireData(int rc, const QByteArray &data, bool last)
 {
 
-    --d->operationsInFlight;
+    if (rc || last) {
+        --d->operationsInFlight;
+    }
 
     if (rc) {
         done(rc);
@@ -122,8 +128,10 @@ void EchoCommand::slotInquireData(int rc, const QByteArray &data)
     }
 
     try {
-        sendStatus("ECHOINQ", QLatin1String(data));
-        if (!d->operationsInFlight) {
+        if (!data.isEmpty() || last) {
+            sendStatus("ECHOINQ", QLatin1String(data));
+        }
+        if (last && !d->operationsInFlight) {
             done();
         }
     } catch (const Exception &e) {
@@ -163,7 +171,7 @@ void EchoCommand::slotInputReadyRead()
 
 void EchoCommand::slotOutputBytesWritten()
 {
-    const std::shared_ptr<QIODevice> out = outputs().at(0)->ioDevice();
+    const std::shared_ptr<QIODevice> out = d->output;
     Q_ASSERT(out);
 
     if (!d->buffer.isEmpty()) {
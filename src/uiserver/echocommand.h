@@ -28,14 +28,14 @@ namespace Kleo
 
   The ECHO command is a simple tool for testing. If a bulk input
   channel has been set up by the client, ECHO will read data from
-  it, and pipe it right back into the bulk output channel. It is
-  an error for an input channel to exist without an output
-  channel.
+  it, and pipe it right back into the bulk output channel, or, if
+  there is none, into the data channel.
 
   ECHO will also send back any non-option command line arguments
   in a status message. If the --inquire command line option has
   been given, ECHO will inquire with that keyword, and send the
-  received data back on the status channel.
+  received data back on the status channel, in chunks of at most
+  512 bytes.
 */
 class EchoCommand : public QObject, public AssuanCommandMixin<EchoCommand>
 {
@@ -54,7 +54,7 @@ private:
     void doCanceled() override;
 
 private Q_SLOTS:
-    void slotInquireData(int, const QByteArray &);
+    void slotInquireData(int, const QByteArray &, bool);
     void slotInputReadyRead();
     void slotOutputBytesWritten();
 
@@ -13,44 +13,85 @@
 
 #include "kleopatra_debug.h"
 
-#include <QMutex>
+#include <QCoreApplication>
+#include <QMutexLocker>
 
 
 using namespace Kleo;
 
 static const int GARBAGE_COLLECTION_INTERVAL = 60000; // 1min
 
-static QMutex mutex;
-
 SessionData::SessionData()
-    : mementos(),
+    : mutex(),
+      mementos(),
       ref(0),
       ripe(false)
 {
 
 }
 
+bool SessionData::hasMemento(const QByteArray &tag) const
+{
+    const QMutexLocker locker(&mutex);
+    return mementos.count(tag);
+}
+
+std::shared_ptr<AssuanCommand::Memento> SessionData::memento(const QByteArray &tag) const
+{
+    const QMutexLocker locker(&mutex);
+    const auto it = mementos.find(tag);
+    if (it == mementos.end()) {
+        return std::shared_ptr<AssuanCommand::Memento>();
+    } else {
+        return it->second;
+    }
+}
+
+void SessionData::setMemento(const QByteArray &tag, const std::shared_ptr<AssuanCommand::Memento> &mem)
+{
+    const QMutexLocker locker(&mutex);
+    mementos[tag] = mem;
+}
+
+void SessionData::removeMemento(const QByteArray &tag)
+{
+    const QMutexLocker locker(&mutex);
+    mementos.erase(tag);
+}
+
 // static
 std::shared_ptr<SessionDataHandler> SessionDataHandler::instance()
 {
-    mutex.lock();
     static SessionDataHandler handler;
-    return std::shared_ptr<SessionDataHandler>(&handler, [](SessionDataHandler*) { mutex.unlock(); });
+    // the handler does its own locking
+    return std::shared_ptr<SessionDataHandler>(&handler, [](SessionDataHandler*) {});
 }
 
 SessionDataHandler::SessionDataHandler()
     : QObject(),
-      data(),
-      timer()
+      shards(),
+      timer(),
+      nextShard(0),
+      idleSessionsSeen(false)
 {
-    timer.setInterval(GARBAGE_COLLECTION_INTERVAL);
+    // visit every shard once per interval
+    timer.setInterval(GARBAGE_COLLECTION_INTERVAL / NumShards);
     timer.setSingleShot(false);
+    connect(&timer, &QTimer::timeout, this, &SessionDataHandler::slotCollectGarbage);
+
+    // instance() may be called first from a connection's thread
+    if (const QCoreApplication *const app = QCoreApplication::instance()) {
+        moveToThread(app->thread());
+        timer.moveToThread(app->thread());
+    }
 }
 
 void SessionDataHandler::enterSession(unsigned int id)
 {
     qCDebug(KLEOPATRA_LOG) << id;
-    const std::shared_ptr<SessionData> sd = sessionDataInternal(id);
+    Shard &s = shard(id);
+    const QMutexLocker locker(&s.mutex);
+    const std::shared_ptr<SessionData> sd = sessionDataInternal(s, id);
     Q_ASSERT(sd);
     ++sd->ref;
     sd->ripe = false;
@@ -59,54 +100,76 @@ void SessionDataHandler::enterSession(unsigned int id)
 void SessionDataHandler::exitSession(unsigned int id)
 {
     qCDebug(KLEOPATRA_LOG) << id;
-    const std::shared_ptr<SessionData> sd = sessionDataInternal(id);
+    Shard &s = shard(id);
+    const QMutexLocker locker(&s.mutex);
+    const std::shared_ptr<SessionData> sd = sessionDataInternal(s, id);
     Q_ASSERT(sd);
     if (--sd->ref <= 0) {
         sd->ref = 0;
         sd->ripe = false;
-        if (!timer.isActive()) {
-            QMetaObject::invokeMethod(&timer, "start", Qt::QueuedConnection);
-        }
+        QMetaObject::invokeMethod(this, "slotSessionIdle", Qt::QueuedConnection);
     }
 }
 
-std::shared_ptr<SessionData> SessionDataHandler::sessionDataInternal(unsigned int id) const
+std::shared_ptr<SessionData> SessionDataHandler::sessionDataInternal(Shard &shard, unsigned int id) const
 {
     auto
-    it = data.lower_bound(id);
-    if (it == data.end() || it->first != id) {
+    it = shard.data.lower_bound(id);
+    if (it == shard.data.end() || it->first != id) {
         const std::shared_ptr<SessionData> sd(new SessionData);
-        it = data.insert(it, std::make_pair(id, sd));
+        it = shard.data.insert(it, std::make_pair(id, sd));
     }
     return it->second;
 }
 
 std::shared_ptr<SessionData> SessionDataHandler::sessionData(unsigned int id) const
 {
-    return sessionDataInternal(id);
+    Shard &s = shard(id);
+    const QMutexLocker locker(&s.mutex);
+    return sessionDataInternal(s, id);
 }
 
 void SessionDataHandler::clear()
 {
-    data.clear();
+    for (Shard &s : shards) {
+        const QMutexLocker locker(&s.mutex);
+        s.data.clear();
+    }
+}
+
+void SessionDataHandler::slotSessionIdle()
+{
+    // keeps the current round of garbage collection from stopping the timer
+    idleSessionsSeen = true;
+    if (!timer.isActive()) {
+        timer.start();
+    }
 }
 
 void SessionDataHandler::slotCollectGarbage()
 {
-    const QMutexLocker locker(&mutex);
-    unsigned int alive = 0;
-    auto it = data.begin(), end = data.end();
-    while (it != end)
-        if (it->second->ripe) {
-            data.erase(it++);
-        } else if (!it->second->ref) {
-            it->second->ripe = true;
-            ++it;
-        } else {
-            ++alive;
-            ++it;
+    Shard &s = shards[nextShard];
+    {
+        const QMutexLocker locker(&s.mutex);
+        auto it = s.data.begin(), end = s.data.end();
+        while (it != end)
+            if (it->second->ripe) {
+                s.data.erase(it++);
+            } else if (!it->second->ref) {
+                it->second->ripe = true;
+                idleSessionsSeen = true;
+                ++it;
+            } else {
+                ++it;
+            }
+    }
+
+    nextShard = (nextShard + 1) % NumShards;
+    if (nextShard == 0) {
+        // stop after a full round without unused sessions
+        if (!idleSessionsSeen) {
+            timer.stop();
         }
-    if (alive == data.size()) {
-        QMetaObject::invokeMethod(&timer, "stop", Qt::QueuedConnection);
+        idleSessionsSeen = false;
     }
 }
@@ -13,6 +13,7 @@
 
 #include "assuancommand.h"
 
+#include <QMutex>
 #include <QTimer>
 
 #include <memory>
@@ -26,16 +27,29 @@ class SessionDataHandler;
 class SessionData
 {
 public:
-
-    std::map< QByteArray, std::shared_ptr<AssuanCommand::Memento> > mementos;
+    bool hasMemento(const QByteArray &tag) const;
+    std::shared_ptr<AssuanCommand::Memento> memento(const QByteArray &tag) const;
+    void setMemento(const QByteArray &tag, const std::shared_ptr<AssuanCommand::Memento> &mem);
+    void removeMemento(const QByteArray &tag);
 
 private:
     friend class ::Kleo::SessionDataHandler;
     SessionData();
+    mutable QMutex mutex; // guards mementos
+    std::map< QByteArray, std::shared_ptr<AssuanCommand::Memento> > mementos;
+    // guarded by the mutex of the handler's shard:
     int ref;
     bool ripe;
 };
 
+/*!
+  Keeps the data of the sessions of all connections.
+
+  The sessions are spread over a number of shards by id, each with a
+  lock of its own, so that commands of different sessions don't
+  contend. Unused sessions expire after one to two minutes; the
+  garbage collector visits one shard at a time.
+*/
 class SessionDataHandler : public QObject
 {
     Q_OBJECT
@@ -51,14 +65,28 @@ public:
     void clear();
 
 private Q_SLOTS:
+    void slotSessionIdle();
     void slotCollectGarbage();
 
 private:
-    mutable std::map< unsigned int, std::shared_ptr<SessionData> > data;
+    struct Shard {
+        QMutex mutex;
+        std::map< unsigned int, std::shared_ptr<SessionData> > data;
+    };
+    static const unsigned int NumShards = 16;
+
+    mutable Shard shards[NumShards];
     QTimer timer;
+    // only used in the thread of the handler:
+    unsigned int nextShard;
+    bool idleSessionsSeen;
 
 private:
-    std::shared_ptr<SessionData> sessionDataInternal(unsigned int) const;
+    Shard &shard(unsigned int id) const
+    {
+        return shards[id % NumShards];
+    }
+    std::shared_ptr<SessionData> sessionDataInternal(Shard &shard, unsigned int id) const;
     SessionDataHandler();
 };
 
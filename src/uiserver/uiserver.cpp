@@ -36,6 +36,8 @@
 
 using namespace Kleo;
 
+static const int MAX_CONNECTION_THREADS = 4;
+
 // static
 void UiServer::setLogStream(FILE *stream)
 {
@@ -48,6 +50,8 @@ UiServer::Private::Private(UiServer *qq)
       file(),
       factories(),
       connections(),
+      connectionThreads(),
+      nextConnectionThread(0),
       suggestedSocketName(),
       actualSocketName(),
       cryptoCommandsEnabled(false)
@@ -60,6 +64,33 @@ UiServer::Private::Private(UiServer *qq)
 #endif
 }
 
+UiServer::Private::~Private()
+{
+    // the connections must not be processed while they are destroyed
+    for (const std::unique_ptr<QThread> &thread : std::as_const(connectionThreads)) {
+        thread->quit();
+    }
+    for (const std::unique_ptr<QThread> &thread : std::as_const(connectionThreads)) {
+        thread->wait();
+    }
+}
+
+// Returns the thread the next client connection is handled in. The
+// threads are started on demand and assigned round-robin, so that the
+// Assuan protocol of many parallel connections is handled outside of the
+// GUI thread.
+QThread *UiServer::Private::connectionThread()
+{
+    if (connectionThreads.size() < static_cast<size_t>(std::min(std::max(QThread::idealThreadCount(), 1), MAX_CONNECTION_THREADS))) {
+        std::unique_ptr<QThread> thread(new QThread);
+        thread->setObjectName(QStringLiteral("UiServer connection thread %1").arg(connectionThreads.size() + 1));
+        thread->start();
+        connectionThreads.push_back(std::move(thread));
+        return connectionThreads.back().get();
+    }
+    return connectionThreads[nextConnectionThread++ % connectionThreads.size()].get();
+}
+
 bool UiServer::Private::isStaleAssuanSocket(const QString &fileName)
 {
     assuan_context_t ctx = nullptr;
@@ -203,7 +234,7 @@ void UiServer::Private::incomingConnection(qintptr fd)
             return;
         }
 #endif
-        const std::shared_ptr<AssuanServerConnection> c(new AssuanServerConnection((assuan_fd_t)fd, factories));
+        const std::shared_ptr<AssuanServerConnection> c(new AssuanServerConnection((assuan_fd_t)fd, factories, connectionThread()));
         connect(c.get(), &AssuanServerConnection::closed,
                 this, &Private::slotConnectionClosed);
         connect(c.get(), &AssuanServerConnection::startKeyManagerRequested,
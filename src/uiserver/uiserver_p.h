@@ -17,6 +17,7 @@
 
 #include <QTcpServer>
 #include <QFile>
+#include <QThread>
 
 #include <kleo-assuan.h>
 
@@ -43,6 +44,7 @@ class UiServer::Private : public QTcpServer
     UiServer *const q;
 public:
     explicit Private(UiServer *qq);
+    ~Private() override;
     static bool isStaleAssuanSocket(const QString &socketName);
 
 private:
@@ -52,6 +54,7 @@ private:
     QString makeFileName(const QString &hint = QString()) const;
     void ensureDirectoryExists(const QString &path) const;
     static QString systemErrorString();
+    QThread *connectionThread();
 
 protected:
     void incomingConnection(qintptr fd) override;
@@ -63,6 +66,8 @@ private:
     QFile file;
     std::vector< std::shared_ptr<AssuanCommandFactory> > factories;
     std::vector< std::shared_ptr<AssuanServerConnection> > connections;
+    std::vector< std::unique_ptr<QThread> > connectionThreads;
+    unsigned int nextConnectionThread;
     QString suggestedSocketName;
     QString actualSocketName;
     assuan_sock_nonce_t nonce;
@@ -0,0 +1,282 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/asynclog.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "asynclog.h"
+
+#include "kleopatra_debug.h"
+
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+
+using namespace Kleo;
+
+// how often the background thread writes out the channels, in ms
+static const unsigned long FLUSH_INTERVAL = 250;
+
+static size_t round_up_to_power_of_two(size_t size)
+{
+    size_t result = 1024;
+    while (result < size) {
+        result <<= 1;
+    }
+    return result;
+}
+
+AsyncLog::Channel::Channel(const QByteArray &name, size_t bufferSize, const std::shared_ptr<QWaitCondition> &wakeUp)
+    : m_name(name),
+      m_size(round_up_to_power_of_two(bufferSize)),
+      m_buffer(new char[m_size]),
+      m_wakeUp(wakeUp),
+      m_writePos(0),
+      m_readPos(0),
+      m_dropped(0)
+{
+
+}
+
+AsyncLog::Channel::~Channel() {}
+
+QByteArray AsyncLog::Channel::name() const
+{
+    return m_name;
+}
+
+void AsyncLog::Channel::write(const char *data, size_t size)
+{
+    const size_t writePos = m_writePos.load(std::memory_order_relaxed);
+    const size_t readPos = m_readPos.load(std::memory_order_acquire);
+    const size_t used = writePos - readPos;
+    if (size > m_size - used) {
+        m_dropped.fetch_add(size, std::memory_order_relaxed);
+        return;
+    }
+
+    const size_t offset = writePos & (m_size - 1);
+    const size_t first = std::min(size, m_size - offset);
+    std::memcpy(m_buffer.get() + offset, data, first);
+    std::memcpy(m_buffer.get(), data + first, size - first);
+    m_writePos.store(writePos + size, std::memory_order_release);
+
+    // don't wait for the next regular flush if the buffer fills up; a
+    // wake-up that is lost because the thread isn't waiting doesn't matter
+    if (used < m_size / 2 && used + size >= m_size / 2) {
+        m_wakeUp->wakeOne();
+    }
+}
+
+QByteArray AsyncLog::Channel::take()
+{
+    const size_t readPos = m_readPos.load(std::memory_order_relaxed);
+    const size_t writePos = m_writePos.load(std::memory_order_acquire);
+    const size_t size = writePos - readPos;
+    if (!size) {
+        return QByteArray();
+    }
+
+    QByteArray result(int(size), Qt::Uninitialized);
+    const size_t offset = readPos & (m_size - 1);
+    const size_t first = std::min(size, m_size - offset);
+    std::memcpy(result.data(), m_buffer.get() + offset, first);
+    std::memcpy(result.data() + first, m_buffer.get(), size - first);
+    m_readPos.store(writePos, std::memory_order_release);
+    return result;
+}
+
+quint64 AsyncLog::Channel::takeDropped()
+{
+    return m_dropped.exchange(0, std::memory_order_relaxed);
+}
+
+class AsyncLog::Private
+{
+    friend class ::Kleo::AsyncLog;
+    AsyncLog *const q;
+public:
+    explicit Private(AsyncLog *qq, const QString &fileName, qint64 maxFileSize);
+    ~Private();
+
+private:
+    void run();
+    void flush(const std::vector<std::shared_ptr<Channel>> &channels);
+    void writeChannel(Channel *channel, const QByteArray &data);
+    void openFile();
+    void rotate();
+
+private:
+    const QString fileName;
+    const qint64 maxFileSize;
+    QFile file;
+
+    QMutex mutex; // guards channels and stopping
+    const std::shared_ptr<QWaitCondition> wakeUp;
+    std::vector<std::shared_ptr<Channel>> channels;
+    bool stopping;
+
+    // only used by the background thread
+    std::map<const Channel *, bool> atLineStart;
+
+    std::unique_ptr<QThread> thread;
+};
+
+AsyncLog::Private::Private(AsyncLog *qq, const QString &fileName_, qint64 maxFileSize_)
+    : q(qq),
+      fileName(fileName_),
+      maxFileSize(maxFileSize_),
+      file(fileName_),
+      mutex(),
+      wakeUp(std::make_shared<QWaitCondition>()),
+      channels(),
+      stopping(false),
+      atLineStart(),
+      thread()
+{
+    openFile();
+    thread.reset(QThread::create([this]() {
+        run();
+    }));
+    thread->setObjectName(QStringLiteral("AsyncLog"));
+    thread->start(QThread::LowPriority);
+}
+
+AsyncLog::Private::~Private()
+{
+    {
+        const QMutexLocker locker(&mutex);
+        stopping = true;
+    }
+    wakeUp->wakeAll();
+    thread->wait();
+}
+
+void AsyncLog::Private::openFile()
+{
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCWarning(KLEOPATRA_LOG) << "AsyncLog: could not open" << fileName << ":" << file.errorString();
+    }
+}
+
+void AsyncLog::Private::rotate()
+{
+    file.close();
+    const QString rotated = fileName + QLatin1String(".1");
+    QFile::remove(rotated);
+    QFile::rename(fileName, rotated);
+    openFile();
+}
+
+void AsyncLog::Private::run()
+{
+    std::vector<std::shared_ptr<Channel>> current;
+    bool stop = false;
+    while (!stop) {
+        {
+            QMutexLocker locker(&mutex);
+            if (!stopping) {
+                wakeUp->wait(&mutex, FLUSH_INTERVAL);
+            }
+            stop = stopping;
+            current = channels;
+        }
+
+        flush(current);
+        current.clear();
+
+        // forget the channels nobody writes to anymore, after writing out
+        // what was written to them since the flush above
+        const QMutexLocker locker(&mutex);
+        const auto unused = std::stable_partition(channels.begin(), channels.end(), [](const std::shared_ptr<Channel> &channel) {
+            return channel.use_count() > 1;
+        });
+        if (unused != channels.end()) {
+            const std::vector<std::shared_ptr<Channel>> released(unused, channels.end());
+            flush(released);
+            for (const std::shared_ptr<Channel> &channel : released) {
+                atLineStart.erase(channel.get());
+            }
+            channels.erase(unused, channels.end());
+        }
+    }
+}
+
+void AsyncLog::Private::flush(const std::vector<std::shared_ptr<Channel>> &channels)
+{
+    bool written = false;
+    for (const std::shared_ptr<Channel> &channel : channels) {
+        if (const quint64 dropped = channel->takeDropped()) {
+            writeChannel(channel.get(), "[" + QByteArray::number(dropped) + " bytes of log messages dropped]\n");
+            written = true;
+        }
+        const QByteArray data = channel->take();
+        if (!data.isEmpty()) {
+            writeChannel(channel.get(), data);
+            written = true;
+        }
+    }
+    if (!written || !file.isOpen()) {
+        return;
+    }
+    file.flush();
+    if (maxFileSize > 0 && file.size() > maxFileSize) {
+        rotate();
+    }
+}
+
+void AsyncLog::Private::writeChannel(Channel *channel, const QByteArray &data)
+{
+    if (!file.isOpen()) {
+        return;
+    }
+    const QByteArray prefix = channel->name() + ": ";
+    auto lineStart = atLineStart.emplace(channel, true).first;
+    QByteArray out;
+    out.reserve(data.size() + prefix.size() * (data.count('\n') + 1));
+    for (const char ch : data) {
+        if (lineStart->second) {
+            out += prefix;
+            lineStart->second = false;
+        }
+        out += ch;
+        if (ch == '\n') {
+            lineStart->second = true;
+        }
+    }
+    file.write(out);
+}
+
+AsyncLog::AsyncLog(const QString &fileName, qint64 maxFileSize)
+    : d(new Private(this, fileName, maxFileSize))
+{
+
+}
+
+AsyncLog::~AsyncLog() {}
+
+QString AsyncLog::fileName() const
+{
+    return d->fileName;
+}
+
+std::shared_ptr<AsyncLog::Channel> AsyncLog::createChannel(const QByteArray &name, size_t bufferSize)
+{
+    const auto channel = std::make_shared<Channel>(name, bufferSize, d->wakeUp);
+    const QMutexLocker locker(&d->mutex);
+    d->channels.push_back(channel);
+    return channel;
+}
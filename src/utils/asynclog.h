@@ -0,0 +1,92 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/asynclog.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <utils/pimpl_ptr.h>
+
+#include <QByteArray>
+
+#include <atomic>
+#include <memory>
+
+class QString;
+class QWaitCondition;
+
+namespace Kleo
+{
+
+/**
+ * A log file that is written by a background thread.
+ *
+ * Writers get a Channel each, a fixed-size ring buffer that is filled
+ * without taking any lock. The background thread periodically moves the
+ * contents of all channels to the log file, prefixing each line with the
+ * name of the channel. If a channel overflows, messages are dropped (and
+ * the number of dropped bytes is logged) instead of blocking the writer.
+ *
+ * The log file is rotated when it grows larger than the given size: it is
+ * renamed to \c fileName.1, replacing an older rotated log.
+ */
+class AsyncLog
+{
+public:
+    class Channel
+    {
+    public:
+        Channel(const QByteArray &name, size_t bufferSize, const std::shared_ptr<QWaitCondition> &wakeUp);
+        ~Channel();
+
+        QByteArray name() const;
+
+        /**
+         * Appends \a data to the buffer. Must not be called concurrently
+         * for the same channel, but may be called concurrently with
+         * take(). Messages that don't fit are dropped as a whole.
+         */
+        void write(const char *data, size_t size);
+
+        // for the background thread
+        QByteArray take();
+        quint64 takeDropped();
+
+    private:
+        const QByteArray m_name;
+        const size_t m_size; // a power of two
+        const std::unique_ptr<char[]> m_buffer;
+        const std::shared_ptr<QWaitCondition> m_wakeUp;
+        // both only ever increase; the fill level is m_writePos - m_readPos
+        std::atomic<size_t> m_writePos;
+        std::atomic<size_t> m_readPos;
+        std::atomic<quint64> m_dropped;
+
+        Q_DISABLE_COPY(Channel)
+    };
+
+    explicit AsyncLog(const QString &fileName, qint64 maxFileSize = 16 * 1024 * 1024);
+    /** Writes what is left in the channels and stops the background thread. */
+    ~AsyncLog();
+
+    QString fileName() const;
+
+    /**
+     * Returns a new channel. The channel is written out until it is
+     * released by all users and it is empty.
+     */
+    std::shared_ptr<Channel> createChannel(const QByteArray &name, size_t bufferSize = 64 * 1024);
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+
+    Q_DISABLE_COPY(AsyncLog)
+};
+
+}
+
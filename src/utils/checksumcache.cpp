@@ -0,0 +1,144 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumcache.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "checksumcache.h"
+
+#include "kleopatra_debug.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#else
+#include <QDateTime>
+#endif
+
+using namespace Kleo;
+
+static const quint32 CACHE_MAGIC = 0x4b6c6543; // "KleC"
+static const quint32 CACHE_VERSION = 1;
+
+static QString cache_file_name(const QString &sumFile)
+{
+    const QByteArray key = QFileInfo(sumFile).absoluteFilePath().toUtf8();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+           + QLatin1String("/checksums/")
+           + QString::fromLatin1(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex());
+}
+
+ChecksumCache::ChecksumCache(const QString &sumFile, QCryptographicHash::Algorithm algorithm)
+    : m_cacheFile(cache_file_name(sumFile)),
+      m_algorithm(algorithm),
+      m_entries()
+{
+
+}
+
+// static
+ChecksumCache::Stamp ChecksumCache::stamp(const QString &fileName)
+{
+    Stamp result;
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(fileName).constData(), &st) == 0 && S_ISREG(st.st_mode)) {
+        result.size = st.st_size;
+#ifdef Q_OS_LINUX
+        result.mtime = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#else
+        result.mtime = qint64(st.st_mtime) * 1000000000;
+#endif
+        result.inode = st.st_ino;
+    }
+#else
+    const QFileInfo fi(fileName);
+    if (fi.isFile()) {
+        result.size = fi.size();
+        result.mtime = fi.lastModified().toMSecsSinceEpoch() * 1000000;
+    }
+#endif
+    return result;
+}
+
+QByteArray ChecksumCache::checksum(const QString &fileName, const Stamp &stamp) const
+{
+    if (!stamp.isValid()) {
+        return QByteArray();
+    }
+    const auto it = m_entries.constFind(fileName);
+    if (it == m_entries.constEnd() || !(it->stamp == stamp)) {
+        return QByteArray();
+    }
+    return it->checksum;
+}
+
+void ChecksumCache::insert(const QString &fileName, const Stamp &stamp, const QByteArray &checksum)
+{
+    if (stamp.isValid() && !checksum.isEmpty()) {
+        m_entries.insert(fileName, {stamp, checksum});
+    }
+}
+
+void ChecksumCache::clear()
+{
+    m_entries.clear();
+}
+
+bool ChecksumCache::load()
+{
+    m_entries.clear();
+
+    QFile f(m_cacheFile);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream s(&f);
+    quint32 magic, version, algorithm, count;
+    s >> magic >> version >> algorithm >> count;
+    if (s.status() != QDataStream::Ok || magic != CACHE_MAGIC || version != CACHE_VERSION || algorithm != quint32(m_algorithm)) {
+        qCDebug(KLEOPATRA_LOG) << "ignoring incompatible checksum cache" << m_cacheFile;
+        return false;
+    }
+    m_entries.reserve(count);
+    for (quint32 i = 0; i < count && s.status() == QDataStream::Ok; ++i) {
+        QString fileName;
+        Entry entry;
+        s >> fileName >> entry.stamp.size >> entry.stamp.mtime >> entry.stamp.inode >> entry.checksum;
+        m_entries.insert(fileName, entry);
+    }
+    if (s.status() != QDataStream::Ok) {
+        qCDebug(KLEOPATRA_LOG) << "ignoring corrupt checksum cache" << m_cacheFile;
+        m_entries.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ChecksumCache::save() const
+{
+    if (!QDir().mkpath(QFileInfo(m_cacheFile).absolutePath())) {
+        return false;
+    }
+    QSaveFile f(m_cacheFile);
+    if (!f.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    QDataStream s(&f);
+    s << CACHE_MAGIC << CACHE_VERSION << quint32(m_algorithm) << quint32(m_entries.size());
+    for (auto it = m_entries.cbegin(), end = m_entries.cend(); it != end; ++it) {
+        s << it.key() << it->stamp.size << it->stamp.mtime << it->stamp.inode << it->checksum;
+    }
+    return s.status() == QDataStream::Ok && f.commit();
+}
@@ -0,0 +1,76 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumcache.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QHash>
+#include <QString>
+
+namespace Kleo
+{
+
+/**
+ * Remembers the checksums computed for the files listed in a checksum
+ * file, together with the size, modification time and inode each file
+ * had when it was hashed. This allows to skip files which didn't change
+ * since the checksum file was last written.
+ *
+ * The cache is kept in the user's cache directory, not next to the
+ * checksum file, so that the checksummed directories are not polluted.
+ */
+class ChecksumCache
+{
+public:
+    struct Stamp {
+        qint64 size = -1;
+        qint64 mtime = 0; // nanoseconds, if the platform provides them
+        quint64 inode = 0;
+
+        bool isValid() const
+        {
+            return size >= 0;
+        }
+        bool operator==(const Stamp &other) const
+        {
+            return size == other.size && mtime == other.mtime && inode == other.inode;
+        }
+    };
+
+    ChecksumCache(const QString &sumFile, QCryptographicHash::Algorithm algorithm);
+
+    static Stamp stamp(const QString &fileName);
+
+    /**
+     * Returns the cached checksum of \a fileName (as listed in the sum file),
+     * or an empty QByteArray if there is none or if the file changed since
+     * it was hashed, i.e. \a stamp doesn't match the cached stamp.
+     */
+    QByteArray checksum(const QString &fileName, const Stamp &stamp) const;
+
+    void insert(const QString &fileName, const Stamp &stamp, const QByteArray &checksum);
+    void clear();
+
+    bool load();
+    bool save() const;
+
+private:
+    struct Entry {
+        Stamp stamp;
+        QByteArray checksum;
+    };
+
+    QString m_cacheFile;
+    QCryptographicHash::Algorithm m_algorithm;
+    QHash<QString, Entry> m_entries;
+};
+
+}
+
@@ -0,0 +1,218 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumengine.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "checksumengine.h"
+
+#include <Libkleo/ChecksumDefinition>
+
+#include <KLocalizedString>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QThreadPool>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+using namespace Kleo;
+
+static const size_t BUFFER_SIZE = 1024 * 1024;
+static const size_t BUFFER_ALIGNMENT = 4096;
+static const int PROGRESS_INTERVAL = 100; // ms
+
+static const struct {
+    const char *program;
+    QCryptographicHash::Algorithm algorithm;
+} builtinPrograms[] = {
+    { "md5sum",    QCryptographicHash::Md5    },
+    { "sha1sum",   QCryptographicHash::Sha1   },
+    { "sha224sum", QCryptographicHash::Sha224 },
+    { "sha256sum", QCryptographicHash::Sha256 },
+    { "sha384sum", QCryptographicHash::Sha384 },
+    { "sha512sum", QCryptographicHash::Sha512 },
+};
+static const size_t numBuiltinPrograms = sizeof builtinPrograms / sizeof * builtinPrograms;
+
+static bool program2algorithm(const QString &command, QCryptographicHash::Algorithm *algorithm)
+{
+    const QString program = QFileInfo(command).baseName();
+    for (unsigned int i = 0; i < numBuiltinPrograms; ++i)
+        if (program.compare(QLatin1String(builtinPrograms[i].program), Qt::CaseInsensitive) == 0) {
+            *algorithm = builtinPrograms[i].algorithm;
+            return true;
+        }
+    return false;
+}
+
+namespace
+{
+// page-aligned read buffer, so the kernel can copy whole pages
+class AlignedBuffer
+{
+public:
+    AlignedBuffer()
+        : m_storage(new char[BUFFER_SIZE + BUFFER_ALIGNMENT])
+    {
+        void *p = m_storage.get();
+        size_t space = BUFFER_SIZE + BUFFER_ALIGNMENT;
+        m_data = static_cast<char *>(std::align(BUFFER_ALIGNMENT, BUFFER_SIZE, p, space));
+    }
+
+    char *data() const
+    {
+        return m_data;
+    }
+
+private:
+    std::unique_ptr<char[]> m_storage;
+    char *m_data;
+};
+}
+
+static ChecksumEngine::Result hash_file(const ChecksumEngine::Job &job, const AlignedBuffer &buffer,
+                                        std::atomic<quint64> &bytesDone, const std::atomic<bool> &abort)
+{
+    ChecksumEngine::Result result;
+
+    QFile f(job.fileName);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        result.errorString = i18n("Failed to open %1: %2", job.fileName, f.errorString());
+        return result;
+    }
+#ifdef Q_OS_LINUX
+    (void)posix_fadvise(f.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    QCryptographicHash hash(job.algorithm);
+    while (!abort) {
+        const qint64 n = f.read(buffer.data(), BUFFER_SIZE);
+        if (n < 0) {
+            result.errorString = i18n("Failed to read %1: %2", job.fileName, f.errorString());
+            return result;
+        }
+        if (n == 0) {
+            result.checksum = hash.result().toHex();
+            break;
+        }
+        hash.addData(buffer.data(), static_cast<int>(n));
+        bytesDone += n;
+    }
+    return result;
+}
+
+ChecksumEngine::ChecksumEngine()
+    : m_maxThreadCount(qMax(1, QThread::idealThreadCount()))
+{
+
+}
+
+ChecksumEngine::~ChecksumEngine() {}
+
+void ChecksumEngine::setMaxThreadCount(int count)
+{
+    m_maxThreadCount = qMax(1, count);
+}
+
+int ChecksumEngine::maxThreadCount() const
+{
+    return m_maxThreadCount;
+}
+
+std::vector<ChecksumEngine::Result> ChecksumEngine::run(const std::vector<Job> &jobs,
+                                                        const std::function<void(quint64)> &progress,
+                                                        const std::function<bool()> &canceled,
+                                                        const std::function<void(size_t, const Result &)> &finished) const
+{
+    std::vector<Result> results(jobs.size());
+    if (jobs.empty()) {
+        return results;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<quint64> bytesDone(0);
+    std::atomic<bool> abort(false);
+
+    // Use a private pool: the global one is shared with QGpgME's jobs.
+    QThreadPool pool;
+    const int numWorkers = static_cast<int>(std::min<size_t>(m_maxThreadCount, jobs.size()));
+    pool.setMaxThreadCount(numWorkers);
+    for (int i = 0; i < numWorkers; ++i) {
+        pool.start([&]() {
+            const AlignedBuffer buffer;
+            for (size_t idx = next++; idx < jobs.size() && !abort; idx = next++) {
+                results[idx] = hash_file(jobs[idx], buffer, bytesDone, abort);
+                if (finished && results[idx].isDone()) {
+                    finished(idx, results[idx]);
+                }
+            }
+        });
+    }
+
+    while (!pool.waitForDone(PROGRESS_INTERVAL)) {
+        if (canceled && canceled()) {
+            abort = true;
+        }
+        if (progress) {
+            progress(bytesDone);
+        }
+    }
+    if (progress) {
+        progress(bytesDone);
+    }
+
+    return results;
+}
+
+// static
+bool ChecksumEngine::algorithmFor(const std::shared_ptr<ChecksumDefinition> &checksumDefinition,
+                                  QCryptographicHash::Algorithm *algorithm)
+{
+    if (!checksumDefinition || !algorithm) {
+        return false;
+    }
+    QCryptographicHash::Algorithm createAlgorithm, verifyAlgorithm;
+    if (!program2algorithm(checksumDefinition->createCommand(), &createAlgorithm) ||
+            !program2algorithm(checksumDefinition->verifyCommand(), &verifyAlgorithm) ||
+            createAlgorithm != verifyAlgorithm) {
+        return false;
+    }
+    *algorithm = createAlgorithm;
+    return true;
+}
+
+// static
+QByteArray ChecksumEngine::formatLine(const QString &fileName, const QByteArray &checksum, bool binary)
+{
+    QByteArray name = QFile::encodeName(fileName);
+    const bool escape = name.contains('\\') || name.contains('\n');
+    if (escape) {
+        name.replace('\\', "\\\\");
+        name.replace('\n', "\\n");
+    }
+
+    QByteArray line;
+    line.reserve(checksum.size() + name.size() + 4);
+    if (escape) {
+        line += '\\';
+    }
+    line += checksum;
+    line += ' ';
+    line += binary ? '*' : ' ';
+    line += name;
+    line += '\n';
+    return line;
+}
@@ -0,0 +1,90 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumengine.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace Kleo
+{
+class ChecksumDefinition;
+}
+
+namespace Kleo
+{
+
+/**
+ * In-process replacement for the sha*sum-style programs referenced by
+ * ChecksumDefinitions. Files are hashed on a private pool of worker
+ * threads; the thread calling run() only does progress reporting.
+ */
+class ChecksumEngine
+{
+public:
+    struct Job {
+        QString fileName;
+        QCryptographicHash::Algorithm algorithm;
+    };
+
+    struct Result {
+        QByteArray checksum; // lower-case hex, empty if not (yet) hashed
+        QString errorString;
+
+        bool isDone() const
+        {
+            return !checksum.isEmpty() || !errorString.isEmpty();
+        }
+    };
+
+    ChecksumEngine();
+    ~ChecksumEngine();
+
+    void setMaxThreadCount(int count);
+    int maxThreadCount() const;
+
+    /**
+     * Hashes all \a jobs and blocks until they are done or \a canceled
+     * returned true. \a progress receives the number of bytes hashed so
+     * far; both callbacks are invoked on the calling thread only.
+     * \a finished is invoked with the index of the job as soon as it is
+     * done, on the worker thread that hashed it.
+     * Jobs not processed due to cancellation have a Result for which
+     * isDone() returns false.
+     */
+    std::vector<Result> run(const std::vector<Job> &jobs,
+                            const std::function<void(quint64)> &progress = {},
+                            const std::function<bool()> &canceled = {},
+                            const std::function<void(size_t, const Result &)> &finished = {}) const;
+
+    /**
+     * Returns whether \a checksumDefinition uses one of the well-known
+     * checksum programs (md5sum, sha1sum, sha256sum, ...) for both
+     * creation and verification, and if so, the matching \a algorithm.
+     */
+    static bool algorithmFor(const std::shared_ptr<ChecksumDefinition> &checksumDefinition,
+                             QCryptographicHash::Algorithm *algorithm);
+
+    /**
+     * Formats one line of a checksum file exactly like the coreutils
+     * programs do, including the escaping of backslashes and newlines.
+     */
+    static QByteArray formatLine(const QString &fileName, const QByteArray &checksum, bool binary);
+
+private:
+    int m_maxThreadCount;
+};
+
+}
+
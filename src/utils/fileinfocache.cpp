@@ -0,0 +1,86 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/fileinfocache.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "fileinfocache.h"
+
+#include <QFileInfo>
+#include <QMutexLocker>
+
+using namespace Kleo;
+
+static const qint64 MAX_AGE = 2000; // ms
+static const int MAX_ENTRIES = 256;
+
+// static
+FileInfoCache &FileInfoCache::instance()
+{
+    static FileInfoCache cache;
+    return cache;
+}
+
+FileInfoCache::FileInfoCache()
+    : m_clock(),
+      m_mutex(),
+      m_entries()
+{
+    m_clock.start();
+}
+
+FileInfoCache::Info FileInfoCache::info(const QString &path)
+{
+    // monotonic, so that changes of the system time don't keep entries alive
+    const qint64 now = m_clock.elapsed();
+    {
+        const QMutexLocker locker(&m_mutex);
+        const auto it = m_entries.constFind(path);
+        if (it != m_entries.constEnd() && now - it->timestamp < MAX_AGE) {
+            return it->info;
+        }
+    }
+
+    // stat without holding the lock, this may take a while on network file systems
+    const QFileInfo fi(path);
+    Info info;
+    info.absoluteFilePath = fi.absoluteFilePath();
+    info.isAbsolute = fi.isAbsolute();
+    info.exists = fi.exists();
+    info.isFile = fi.isFile();
+    info.isDir = fi.isDir();
+    info.isReadable = fi.isReadable();
+    info.isExecutable = fi.isExecutable();
+
+    const QMutexLocker locker(&m_mutex);
+    if (!info.exists) {
+        // files that are about to be created are looked up again
+        m_entries.remove(path);
+        return info;
+    }
+    if (m_entries.size() >= MAX_ENTRIES) {
+        for (auto it = m_entries.begin(); it != m_entries.end();) {
+            if (now - it->timestamp >= MAX_AGE) {
+                it = m_entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (m_entries.size() >= MAX_ENTRIES) {
+            m_entries.clear();
+        }
+    }
+    m_entries.insert(path, {info, now});
+    return info;
+}
+
+void FileInfoCache::clear()
+{
+    const QMutexLocker locker(&m_mutex);
+    m_entries.clear();
+}
@@ -0,0 +1,63 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/fileinfocache.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+namespace Kleo
+{
+
+/**
+ * A small, thread-safe cache of file metadata.
+ *
+ * Used to validate the file paths given by UI server clients, which often
+ * name the same files several times in quick succession (FILE, then
+ * INPUT FILE=, from several connections). Entries expire after a short
+ * time, so that changes on disk are noticed. Files that don't exist are
+ * not cached.
+ */
+class FileInfoCache
+{
+public:
+    struct Info {
+        QString absoluteFilePath;
+        bool isAbsolute = false;
+        bool exists = false;
+        bool isFile = false;
+        bool isDir = false;
+        bool isReadable = false;
+        bool isExecutable = false;
+    };
+
+    static FileInfoCache &instance();
+
+    /** Returns the metadata of \a path; stats the file unless cached. */
+    Info info(const QString &path);
+
+    void clear();
+
+private:
+    FileInfoCache();
+
+    struct Entry {
+        Info info;
+        // milliseconds on m_clock
+        qint64 timestamp = 0;
+    };
+    QElapsedTimer m_clock;
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+};
+
+}
+
@@ -18,6 +18,19 @@
 #include <QString>
 #include <QByteArray>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define HEX_HAVE_SSE2
+# include <emmintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
+#if defined(HEX_HAVE_SSE2) && defined(__GNUC__)
+// AVX2 is chosen at runtime, so the rest of the file needn't require it
+# define HEX_HAVE_AVX2
+# include <immintrin.h>
+#endif
+
 using namespace Kleo;
 
 static unsigned char unhex(unsigned char ch)
@@ -37,63 +50,271 @@ static unsigned char unhex(unsigned char ch)
                          QString::fromLatin1(&cch, 1)));
 }
 
-std::string Kleo::hexdecode(const std::string &in)
+// hexencode() passes these through unchanged; of the others, '"', '#',
+// '$', '%', '\'', '+' and '=' are %-escaped, everything else becomes '+'
+static bool is_clean(unsigned char ch)
 {
-    std::string result;
-    result.reserve(in.size());
-    for (std::string::const_iterator it = in.begin(), end = in.end(); it != end; ++it)
-        if (*it == '%') {
-            ++it;
-            unsigned char ch = '\0';
-            if (it == end)
-                throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
-                                i18n("Premature end of hex-encoded char in input stream"));
-            ch |= unhex(*it) << 4;
+    switch (ch) {
+    case '"':
+    case '#':
+    case '$':
+    case '%':
+    case '\'':
+    case '+':
+    case '=':
+        return false;
+    default:
+        return (ch >= '!' && ch <= '~') || ch > 0xA0;
+    }
+}
+
+static bool is_escaped(unsigned char ch)
+{
+    return ch == '"' || ch == '#' || ch == '$' || ch == '%' || ch == '\'' || ch == '+' || ch == '=';
+}
+
+//
+// The encoder and decoder copy runs of bytes that need no treatment
+// wholesale. These functions return the length of the run at begin;
+// the SSE2 and AVX2 variants examine 16 or 32 bytes at once.
+//
+
+static size_t encode_run_scalar(const char *begin, const char *end)
+{
+    const char *p = begin;
+    while (p != end && is_clean(*p)) {
+        ++p;
+    }
+    return p - begin;
+}
+
+static size_t decode_run_scalar(const char *begin, const char *end)
+{
+    const char *p = begin;
+    while (p != end && *p != '%' && *p != '+') {
+        ++p;
+    }
+    return p - begin;
+}
+
+#ifdef HEX_HAVE_SSE2
+
+static int count_trailing_zeros(unsigned int mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// sets all bits of the bytes of v that hexencode() passes through unchanged
+static inline __m128i clean_bytes_sse2(__m128i v)
+{
+    const __m128i escaped = _mm_or_si128(
+        // '"', '#', '$', '%'
+        _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('!')), _mm_cmplt_epi8(v, _mm_set1_epi8('&'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('+')), _mm_cmpeq_epi8(v, _mm_set1_epi8('=')))));
+    // signed compares: '!'..'~' are the positive bytes > ' ' and < 0x7F,
+    // 0xA1..0xFF the negative ones > (char)0xA0
+    const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(' ')), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+    const __m128i high = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(char(0xA0))), _mm_cmplt_epi8(v, _mm_setzero_si128()));
+    return _mm_or_si128(_mm_andnot_si128(escaped, printable), high);
+}
+
+static size_t encode_run_sse2(const char *begin, const char *end)
+{
+    const char *p = begin;
+    for (; end - p >= 16; p += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        const unsigned int mask = _mm_movemask_epi8(clean_bytes_sse2(v));
+        if (mask != 0xFFFF) {
+            return p - begin + count_trailing_zeros(~mask);
+        }
+    }
+    return p - begin + encode_run_scalar(p, end);
+}
+
+static size_t decode_run_sse2(const char *begin, const char *end)
+{
+    const char *p = begin;
+    for (; end - p >= 16; p += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        const unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('%')),
+                                                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('+'))));
+        if (mask) {
+            return p - begin + count_trailing_zeros(mask);
+        }
+    }
+    return p - begin + decode_run_scalar(p, end);
+}
+
+#endif // HEX_HAVE_SSE2
+
+#ifdef HEX_HAVE_AVX2
+
+__attribute__((target("avx2")))
+static size_t encode_run_avx2(const char *begin, const char *end)
+{
+    const char *p = begin;
+    for (; end - p >= 32; p += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        const __m256i escaped = _mm256_or_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('!')), _mm256_cmpgt_epi8(_mm256_set1_epi8('&'), v)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('+')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('=')))));
+        const __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7F), v));
+        const __m256i high = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(char(0xA0))), _mm256_cmpgt_epi8(_mm256_setzero_si256(), v));
+        const unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_andnot_si256(escaped, printable), high));
+        if (mask != 0xFFFFFFFFu) {
+            return p - begin + count_trailing_zeros(~mask);
+        }
+    }
+    return p - begin + encode_run_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static size_t decode_run_avx2(const char *begin, const char *end)
+{
+    const char *p = begin;
+    for (; end - p >= 32; p += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        const unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('%')),
+                                                                       _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+'))));
+        if (mask) {
+            return p - begin + count_trailing_zeros(mask);
+        }
+    }
+    return p - begin + decode_run_sse2(p, end);
+}
+
+#endif // HEX_HAVE_AVX2
+
+using RunFunction = size_t (*)(const char *, const char *);
+
+static RunFunction select_encode_run()
+{
+#ifdef HEX_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return &encode_run_avx2;
+    }
+#endif
+#ifdef HEX_HAVE_SSE2
+    return &encode_run_sse2;
+#else
+    return &encode_run_scalar;
+#endif
+}
+
+static RunFunction select_decode_run()
+{
+#ifdef HEX_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return &decode_run_avx2;
+    }
+#endif
+#ifdef HEX_HAVE_SSE2
+    return &decode_run_sse2;
+#else
+    return &decode_run_scalar;
+#endif
+}
+
+static size_t encode_run(const char *begin, const char *end)
+{
+    static const RunFunction run = select_encode_run();
+    return run(begin, end);
+}
+
+static size_t decode_run(const char *begin, const char *end)
+{
+    static const RunFunction run = select_decode_run();
+    return run(begin, end);
+}
+
+static void append(std::string &out, const char *data, size_t size)
+{
+    out.append(data, size);
+}
+
+static void append(QByteArray &out, const char *data, size_t size)
+{
+    out.append(data, static_cast<int>(size));
+}
+
+template <typename Out>
+static void decode(const char *it, const char *end, Out &result)
+{
+    result.reserve(end - it);
+    while (it != end) {
+        const size_t n = decode_run(it, end);
+        append(result, it, n);
+        it += n;
+        if (it == end) {
+            break;
+        }
+        if (*it == '+') {
+            result.push_back(' ');
             ++it;
-            if (it == end)
-                throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
-                                i18n("Premature end of hex-encoded char in input stream"));
-            ch |= unhex(*it);
-            result.push_back(ch);
-        } else if (*it == '+') {
-            result += ' ';
-        } else  {
-            result.push_back(*it);
+            continue;
         }
-    return result;
+        // '%'
+        ++it;
+        unsigned char ch = '\0';
+        if (it == end)
+            throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
+                            i18n("Premature end of hex-encoded char in input stream"));
+        ch |= unhex(*it) << 4;
+        ++it;
+        if (it == end)
+            throw Exception(gpg_error(GPG_ERR_ASS_SYNTAX),
+                            i18n("Premature end of hex-encoded char in input stream"));
+        ch |= unhex(*it);
+        ++it;
+        result.push_back(ch);
+    }
 }
 
-std::string Kleo::hexencode(const std::string &in)
+template <typename Out>
+static void encode(const char *it, const char *end, Out &result)
 {
-    std::string result;
-    result.reserve(3 * in.size());
+    // most input is clean, so don't reserve for the worst case
+    result.reserve(end - it);
 
     static const char hex[] = "0123456789ABCDEF";
 
-    for (std::string::const_iterator it = in.begin(), end = in.end(); it != end; ++it)
-        switch (const unsigned char ch = *it) {
-        default:
-            if ((ch >= '!' && ch <= '~') || ch > 0xA0) {
-                result += ch;
-                break;
-            }
-        // else fall through
-        case ' ':
-            result += '+';
-            break;
-        case '"':
-        case '#':
-        case '$':
-        case '%':
-        case '\'':
-        case '+':
-        case '=':
-            result += '%';
-            result += hex[(ch & 0xF0) >> 4 ];
-            result += hex[(ch & 0x0F)      ];
+    while (it != end) {
+        const size_t n = encode_run(it, end);
+        append(result, it, n);
+        it += n;
+        if (it == end) {
             break;
         }
+        const unsigned char ch = *it++;
+        if (is_escaped(ch)) {
+            result.push_back('%');
+            result.push_back(hex[(ch & 0xF0) >> 4 ]);
+            result.push_back(hex[(ch & 0x0F)      ]);
+        } else {
+            result.push_back('+');
+        }
+    }
+}
 
+std::string Kleo::hexdecode(const std::string &in)
+{
+    std::string result;
+    decode(in.data(), in.data() + in.size(), result);
+    return result;
+}
+
+std::string Kleo::hexencode(const std::string &in)
+{
+    std::string result;
+    encode(in.data(), in.data() + in.size(), result);
     return result;
 }
 
@@ -113,13 +334,15 @@ std::string Kleo::hexencode(const char *in)
     return hexencode(std::string(in));
 }
 
+// like the other overloads, these stop at the first NUL
 QByteArray Kleo::hexdecode(const QByteArray &in)
 {
     if (in.isNull()) {
         return QByteArray();
     }
-    const std::string result = hexdecode(std::string(in.constData()));
-    return QByteArray(result.data(), result.size());
+    QByteArray result("", 0); // not null, even if empty
+    decode(in.constData(), in.constData() + qstrlen(in.constData()), result);
+    return result;
 }
 
 QByteArray Kleo::hexencode(const QByteArray &in)
@@ -127,6 +350,7 @@ QByteArray Kleo::hexencode(const QByteArray &in)
     if (in.isNull()) {
         return QByteArray();
     }
-    const std::string result = hexencode(std::string(in.constData()));
-    return QByteArray(result.data(), result.size());
+    QByteArray result("", 0); // not null, even if empty
+    encode(in.constData(), in.constData() + qstrlen(in.constData()), result);
+    return result;
 }
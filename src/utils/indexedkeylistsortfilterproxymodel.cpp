@@ -0,0 +1,116 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/indexedkeylistsortfilterproxymodel.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "indexedkeylistsortfilterproxymodel.h"
+
+#include "tags.h"
+
+#include <Libkleo/KeyList>
+#include <Libkleo/KeyListModel>
+
+#include <gpgme++/key.h>
+
+using namespace Kleo;
+
+IndexedKeyListSortFilterProxyModel::IndexedKeyListSortFilterProxyModel(QObject *parent)
+    : KeyListSortFilterProxyModel(parent),
+      m_stringFilter(),
+      m_matches(),
+      m_matchesGeneration(0),
+      m_matchesValid(false)
+{
+    // start building the index before the first search
+    KeySearchIndex::instance();
+}
+
+IndexedKeyListSortFilterProxyModel::IndexedKeyListSortFilterProxyModel(const IndexedKeyListSortFilterProxyModel &other)
+    : KeyListSortFilterProxyModel(other),
+      m_stringFilter(other.m_stringFilter),
+      m_matches(),
+      m_matchesGeneration(0),
+      m_matchesValid(false)
+{
+
+}
+
+IndexedKeyListSortFilterProxyModel::~IndexedKeyListSortFilterProxyModel() {}
+
+IndexedKeyListSortFilterProxyModel *IndexedKeyListSortFilterProxyModel::clone() const
+{
+    return new IndexedKeyListSortFilterProxyModel(*this);
+}
+
+void IndexedKeyListSortFilterProxyModel::setStringFilter(const QString &text)
+{
+    m_stringFilter = text;
+    m_matchesValid = false;
+    setFilterFixedString(text);
+}
+
+QString IndexedKeyListSortFilterProxyModel::stringFilter() const
+{
+    return m_stringFilter;
+}
+
+void IndexedKeyListSortFilterProxyModel::updateMatches() const
+{
+    KeySearchIndex &index = KeySearchIndex::instance();
+    const quint64 generation = index.generation();
+    if (m_matchesValid && generation == m_matchesGeneration) {
+        return;
+    }
+    m_matchesGeneration = generation;
+    m_matchesValid = true;
+
+    // the index covers what KeyListSortFilterProxyModel matches the text
+    // against, except for the tags
+    const int column = filterKeyColumn();
+    if ((column == 0 && !Tags::tagsEnabled()) || column == KeyList::Summary) {
+        m_matches = index.search(m_stringFilter);
+    } else {
+        m_matches = KeySearchIndex::Matches();
+    }
+}
+
+bool IndexedKeyListSortFilterProxyModel::mayMatch(int source_row, const QModelIndex &source_parent) const
+{
+    if (m_stringFilter.isEmpty()) {
+        return true;
+    }
+    updateMatches();
+    if (!m_matches.isRestrictive()) {
+        return true;
+    }
+    const auto klm = dynamic_cast<const KeyListModelInterface *>(sourceModel());
+    if (!klm) {
+        return true;
+    }
+    // groups are not indexed
+    const GpgME::Key key = klm->key(sourceModel()->index(source_row, 0, source_parent));
+    return key.isNull() || m_matches.mayMatch(key);
+}
+
+bool IndexedKeyListSortFilterProxyModel::filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
+{
+    if (mayMatch(source_row, source_parent)) {
+        return KeyListSortFilterProxyModel::filterAcceptsRow(source_row, source_parent);
+    }
+    // KeyListSortFilterProxyModel keeps the parents of matching children
+    const QModelIndex index = sourceModel()->index(source_row, 0, source_parent);
+    for (int i = 0, end = sourceModel()->rowCount(index); i != end; ++i) {
+        if (filterAcceptsRow(i, index)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#include "moc_indexedkeylistsortfilterproxymodel.cpp"
@@ -0,0 +1,59 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/indexedkeylistsortfilterproxymodel.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#pragma once
+
+#include "keysearchindex.h"
+
+#include <Libkleo/KeyListSortFilterProxyModel>
+
+#include <QString>
+
+namespace Kleo
+{
+
+/**
+ * A KeyListSortFilterProxyModel that asks the shared KeySearchIndex which
+ * keys can match the filter text before matching the text against them,
+ * so that typing in a filter doesn't look at all user IDs of all keys.
+ *
+ * The filter text must be set with setStringFilter(). The index is only
+ * used for filtering the first column or the summary column.
+ */
+class IndexedKeyListSortFilterProxyModel : public KeyListSortFilterProxyModel
+{
+    Q_OBJECT
+public:
+    explicit IndexedKeyListSortFilterProxyModel(QObject *parent = nullptr);
+    ~IndexedKeyListSortFilterProxyModel() override;
+
+    IndexedKeyListSortFilterProxyModel *clone() const override;
+
+    /** Sets \a text as fixed string filter, see setFilterFixedString(). */
+    void setStringFilter(const QString &text);
+    QString stringFilter() const;
+
+protected:
+    IndexedKeyListSortFilterProxyModel(const IndexedKeyListSortFilterProxyModel &);
+
+    bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const override;
+
+private:
+    bool mayMatch(int source_row, const QModelIndex &source_parent) const;
+    void updateMatches() const;
+
+private:
+    QString m_stringFilter;
+    mutable KeySearchIndex::Matches m_matches;
+    mutable quint64 m_matchesGeneration;
+    mutable bool m_matchesValid;
+};
+
+}
+
@@ -34,8 +34,21 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QProcess>
+#include <QStorageInfo>
 
+#include <algorithm>
 #include <cerrno>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 using namespace Kleo;
 
@@ -99,6 +112,173 @@ private:
 #endif
 };
 
+#ifdef Q_OS_UNIX
+// Smaller files are read with QFile; mapping them isn't worth the set-up costs.
+static const qint64 MAP_THRESHOLD = 1024 * 1024;
+// The amount of data the kernel is asked to read ahead.
+static const qint64 READAHEAD_WINDOW = 8 * 1024 * 1024;
+
+static bool is_network_file_system(const QByteArray &type)
+{
+    static const char *const networkFileSystems[] = {
+        "nfs", "nfs4", "cifs", "smbfs", "smb3", "9p", "afs", "ceph", "glusterfs", "lustre", "ncpfs", "davfs",
+    };
+    return type.startsWith("fuse") // e.g. sshfs
+           || std::any_of(std::begin(networkFileSystems), std::end(networkFileSystems),
+                          [&type](const char *fs) { return type == fs; });
+}
+
+// Accessing a mapping beyond the end of a file that was truncated after it
+// was mapped raises SIGBUS. While a thread copies from a mapping, it points
+// this to where the handler jumps back to. Volatile, so that the compiler
+// doesn't drop the stores around the copy.
+static thread_local sigjmp_buf *volatile t_mappingFaultJump = nullptr;
+static struct sigaction s_previousSigbusAction;
+
+static void sigbus_handler(int, siginfo_t *, void *)
+{
+    if (sigjmp_buf *const jump = t_mappingFaultJump) {
+        t_mappingFaultJump = nullptr;
+        siglongjmp(*jump, 1);
+    }
+    // not ours: let the faulting instruction run into the previous handler
+    sigaction(SIGBUS, &s_previousSigbusAction, nullptr);
+}
+
+// (re)installs sigbus_handler, e.g. after a crash handler replaced it
+static bool install_sigbus_handler()
+{
+    static QMutex mutex;
+    const QMutexLocker locker(&mutex);
+    struct sigaction current;
+    if (sigaction(SIGBUS, nullptr, &current) != 0) {
+        return false;
+    }
+    if ((current.sa_flags & SA_SIGINFO) && current.sa_sigaction == &sigbus_handler) {
+        return true;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_sigaction = &sigbus_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    s_previousSigbusAction = current;
+    return sigaction(SIGBUS, &action, nullptr) == 0;
+}
+
+// Exposes a file mapped into memory as a random-access QIODevice, so that
+// reads are plain copies from the page cache instead of read(2) calls.
+// Only used for large files on local file systems. If the file is truncated
+// while it is read, the SIGBUS of accessing the missing pages is turned into
+// a read error.
+class MappedFileDevice : public QIODevice
+{
+public:
+    static std::shared_ptr<MappedFileDevice> create(const QString &fileName)
+    {
+        const QFileInfo fi(fileName);
+        if (!fi.isFile() || fi.size() < MAP_THRESHOLD || is_network_file_system(QStorageInfo(fi.absolutePath()).fileSystemType())) {
+            return std::shared_ptr<MappedFileDevice>();
+        }
+        if (!install_sigbus_handler()) {
+            return std::shared_ptr<MappedFileDevice>();
+        }
+        std::shared_ptr<MappedFileDevice> device(new MappedFileDevice(fileName));
+        if (!device->m_data) {
+            return std::shared_ptr<MappedFileDevice>();
+        }
+        return device;
+    }
+
+    bool isSequential() const override
+    {
+        return false;
+    }
+    qint64 size() const override
+    {
+        return m_size;
+    }
+    void close() override
+    {
+        QIODevice::close();
+        if (m_data) {
+            m_file.unmap(m_data);
+            m_data = nullptr;
+        }
+        m_file.close();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        if (m_truncated) {
+            return -1;
+        }
+        const qint64 offset = pos();
+        const qint64 numRead = std::min(maxSize, m_size - offset);
+        if (!m_data || numRead <= 0) {
+            return 0;
+        }
+        adviseReadahead(offset + numRead);
+        // restore the signal mask, SIGBUS is blocked in the handler
+        sigjmp_buf jump;
+        if (sigsetjmp(jump, 1)) {
+            m_truncated = true;
+            setErrorString(i18n("The file %1 was truncated while it was read.", m_file.fileName()));
+            return -1;
+        }
+        t_mappingFaultJump = &jump;
+        memcpy(data, m_data + offset, numRead);
+        t_mappingFaultJump = nullptr;
+        return numRead;
+    }
+    qint64 writeData(const char *, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    explicit MappedFileDevice(const QString &fileName)
+        : QIODevice(), m_file(fileName), m_data(nullptr), m_size(0), m_advised(0), m_truncated(false)
+    {
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            return;
+        }
+        m_size = m_file.size();
+        m_data = m_file.map(0, m_size);
+        if (!m_data) {
+            qCDebug(KLEOPATRA_LOG) << "Could not map" << fileName << ":" << m_file.errorString();
+            return;
+        }
+        posix_madvise(m_data, m_size, POSIX_MADV_SEQUENTIAL);
+        adviseReadahead(0);
+        // the QIODevice buffer would only add another copy
+        setOpenMode(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    // asks the kernel to read the window following offset, if that
+    // wasn't done yet
+    void adviseReadahead(qint64 offset)
+    {
+        if (offset < m_advised - READAHEAD_WINDOW / 2 || m_advised >= m_size) {
+            return;
+        }
+        const qint64 pageSize = sysconf(_SC_PAGESIZE);
+        const qint64 begin = m_advised / pageSize * pageSize;
+        const qint64 end = std::min(offset + READAHEAD_WINDOW, m_size);
+        posix_madvise(m_data + begin, end - begin, POSIX_MADV_WILLNEED);
+        m_advised = end;
+    }
+
+private:
+    QFile m_file;
+    uchar *m_data;
+    qint64 m_size;
+    qint64 m_advised; // end of the region for which readahead was requested
+    bool m_truncated;
+};
+#endif // Q_OS_UNIX
+
 class FileInput : public InputImplBase
 {
 public:
@@ -242,6 +422,12 @@ FileInput::FileInput(const QString &fileName)
     : InputImplBase(),
       m_io(), m_fileName(fileName)
 {
+#ifdef Q_OS_UNIX
+    if (const std::shared_ptr<MappedFileDevice> mapped = MappedFileDevice::create(fileName)) {
+        m_io = Log::instance()->createIOLogger(mapped, QStringLiteral("file-in"), Log::Read);
+        return;
+    }
+#endif
     std::shared_ptr<QFile> file(new QFile(fileName));
 
     errno = 0;
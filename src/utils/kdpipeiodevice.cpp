@@ -30,6 +30,13 @@
 # include <errno.h>
 #endif
 
+#ifdef Q_OS_LINUX
+# include <QSocketNotifier>
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/ioctl.h>
+#endif
+
 #ifndef KDAB_CHECK_THIS
 # define KDAB_CHECK_CTOR (void)1
 # define KDAB_CHECK_DTOR KDAB_CHECK_CTOR
@@ -45,6 +52,7 @@ const bool ALLOW_QIODEVICE_BUFFERING = true;
 namespace
 {
 KDPipeIODevice::DebugLevel s_debugLevel = KDPipeIODevice::NoDebug;
+int s_pipeBufferSize = 1024 * 1024;
 }
 
 #define QDebug if( s_debugLevel == KDPipeIODevice::NoDebug ){}else qDebug
@@ -204,6 +212,277 @@ Writer::Writer(int fd_, Qt::HANDLE handle_) : QThread(),
 
 Writer::~Writer() {}
 
+#ifdef Q_OS_LINUX
+namespace
+{
+
+// A socket notifier on its own duplicate of the descriptor, so that it can
+// be deleted (in its thread) after the descriptor has been closed.
+class PipeNotifier : public QSocketNotifier
+{
+public:
+    PipeNotifier(int fd, QObject *parent = nullptr)
+        : QSocketNotifier(fd, QSocketNotifier::Read, parent)
+    {
+    }
+    ~PipeNotifier() override
+    {
+        setEnabled(false);
+        ::close(socket());
+    }
+};
+
+// Reads from and writes to the pipe in the thread calling readData() and
+// writeData(), directly from/into the caller's buffer. There are no helper
+// threads and no intermediate ring buffer; readyRead() is driven by a socket
+// notifier. Like the Reader/Writer threads, this assumes a single consumer.
+class DirectPipe
+{
+public:
+    DirectPipe(KDPipeIODevice *q, int fd, QIODevice::OpenMode mode);
+    ~DirectPipe();
+
+    qint64 bytesAvailable() const;
+    bool canReadLine();
+    bool atEnd();
+    bool waitForReadyRead(int msecs);
+    bool readWouldBlock();
+    bool writeWouldBlock() const;
+
+    qint64 read(char *data, qint64 maxSize);
+    qint64 write(const char *data, qint64 size);
+
+private:
+    int bytesInPipe() const;
+    bool poll(short events, int msecs) const;
+    void fillPeekBuffer();
+    void resumeNotifier();
+
+private:
+    KDPipeIODevice *const q;
+    const int fd;
+    const QIODevice::OpenMode mode;
+    PipeNotifier *notifier;
+    QAtomicInt notifierPaused;
+    mutable QMutex mutex; // protects peeked, eof and error
+    QByteArray peeked;    // read by canReadLine(), but not yet by the consumer
+    bool eof;
+    bool error;
+};
+
+}
+
+DirectPipe::DirectPipe(KDPipeIODevice *qq, int fd_, QIODevice::OpenMode mode_)
+    : q(qq),
+      fd(fd_),
+      mode(mode_),
+      notifier(nullptr),
+      notifierPaused(0),
+      mutex(),
+      peeked(),
+      eof(false),
+      error(false)
+{
+#ifdef F_SETPIPE_SZ
+    if (s_pipeBufferSize > 0 && ::fcntl(fd, F_SETPIPE_SZ, s_pipeBufferSize) < 0) {
+        QDebug("%p: DirectPipe: could not set pipe size of fd %d: %s", (void *)this, fd, strerror(errno));
+    }
+#endif
+    if (mode & QIODevice::ReadOnly) {
+        // read() must not block the consumer when the pipe is empty
+        const int flags = ::fcntl(fd, F_GETFL);
+        if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            QDebug("%p: DirectPipe: could not make fd %d non-blocking: %s", (void *)this, fd, strerror(errno));
+        }
+        const int notifierFd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (notifierFd >= 0) {
+            notifier = new PipeNotifier(notifierFd);
+            QObject::connect(notifier, &QSocketNotifier::activated, q, [this]() {
+                // wait for the consumer to read before reporting readyRead() again
+                notifier->setEnabled(false);
+                notifierPaused.storeRelease(1);
+                Q_EMIT q->readyRead();
+            });
+        }
+    }
+}
+
+DirectPipe::~DirectPipe()
+{
+    if (notifier) {
+        // the connection refers to this; the notifier itself has to be
+        // deleted in its thread
+        QObject::disconnect(notifier, nullptr, q, nullptr);
+        notifier->deleteLater();
+    }
+}
+
+int DirectPipe::bytesInPipe() const
+{
+    int n = 0;
+    if (::ioctl(fd, FIONREAD, &n) < 0) {
+        return 0;
+    }
+    return n;
+}
+
+bool DirectPipe::poll(short events, int msecs) const
+{
+    struct pollfd pfd = { fd, events, 0 };
+    int rc;
+    do {
+        rc = ::poll(&pfd, 1, msecs);
+    } while (rc == -1 && errno == EINTR);
+    // POLLHUP and POLLERR are reported as ready, too; the next read or
+    // write reports eof or the error
+    return rc > 0;
+}
+
+void DirectPipe::fillPeekBuffer()
+{
+    const int n = eof || error ? 0 : bytesInPipe();
+    if (n <= 0) {
+        resumeNotifier();
+        return;
+    }
+    const int oldSize = peeked.size();
+    peeked.resize(oldSize + n);
+    qint64 numRead;
+    do {
+        numRead = ::read(fd, peeked.data() + oldSize, n);
+    } while (numRead == -1 && errno == EINTR);
+    peeked.resize(oldSize + std::max<qint64>(numRead, 0));
+    // the pipe is drained, so the next data has to be reported
+    resumeNotifier();
+}
+
+void DirectPipe::resumeNotifier()
+{
+    if (notifier && notifierPaused.testAndSetOrdered(1, 0)) {
+        PipeNotifier *const n = notifier;
+        QMetaObject::invokeMethod(n, [n]() { n->setEnabled(true); }, Qt::QueuedConnection);
+    }
+}
+
+qint64 DirectPipe::bytesAvailable() const
+{
+    if (!(mode & QIODevice::ReadOnly)) {
+        return 0;
+    }
+    const QMutexLocker locker(&mutex);
+    return peeked.size() + bytesInPipe();
+}
+
+bool DirectPipe::canReadLine()
+{
+    const QMutexLocker locker(&mutex);
+    fillPeekBuffer();
+    return peeked.contains('\n');
+}
+
+bool DirectPipe::atEnd()
+{
+    const QMutexLocker locker(&mutex);
+    if (!peeked.isEmpty()) {
+        return false;
+    }
+    if (!eof && !error && poll(POLLIN, 0) && bytesInPipe() == 0) {
+        // readable, but nothing to read: the writer has closed the pipe
+        eof = true;
+    }
+    return eof || error;
+}
+
+bool DirectPipe::waitForReadyRead(int msecs)
+{
+    {
+        const QMutexLocker locker(&mutex);
+        if (!peeked.isEmpty() || eof || error) {
+            return true;
+        }
+    }
+    return poll(POLLIN, msecs);
+}
+
+bool DirectPipe::readWouldBlock()
+{
+    const QMutexLocker locker(&mutex);
+    return peeked.isEmpty() && !eof && !error && !poll(POLLIN, 0);
+}
+
+bool DirectPipe::writeWouldBlock() const
+{
+    return !poll(POLLOUT, 0);
+}
+
+qint64 DirectPipe::read(char *data, qint64 maxSize)
+{
+    {
+        const QMutexLocker locker(&mutex);
+        if (!peeked.isEmpty()) {
+            const qint64 numRead = std::min<qint64>(maxSize, peeked.size());
+            memcpy(data, peeked.constData(), numRead);
+            peeked.remove(0, numRead);
+            resumeNotifier();
+            return numRead;
+        }
+        if (eof) {
+            return 0;
+        }
+        if (error) {
+            return -1;
+        }
+    }
+    if (maxSize == 0) {
+        return 0;
+    }
+
+    qint64 numRead;
+    do {
+        numRead = ::read(fd, data, maxSize);
+    } while (numRead == -1 && errno == EINTR);
+    const int readErrno = errno;
+
+    const QMutexLocker locker(&mutex);
+    if (numRead < 0 && (readErrno == EAGAIN || readErrno == EWOULDBLOCK)) {
+        // nothing to read right now; readyRead() reports new data
+        resumeNotifier();
+        return 0;
+    }
+    if (numRead < 0) {
+        QDebug("%p: DirectPipe::read: got error: %s", (void *)this, strerror(readErrno));
+        error = true;
+        return -1;
+    }
+    if (numRead == 0) {
+        QDebug("%p: DirectPipe::read: eof detected", (void *)this);
+        eof = true;
+        return 0;
+    }
+    resumeNotifier();
+    return numRead;
+}
+
+qint64 DirectPipe::write(const char *data, qint64 size)
+{
+    qint64 numWritten;
+    do {
+        numWritten = ::write(fd, data, size);
+    } while (numWritten == -1 && errno == EINTR);
+
+    if (numWritten < 0) {
+        QDebug("%p: DirectPipe::write: got error: %s", (void *)this, strerror(errno));
+        return -1;
+    }
+    // never emit bytesWritten() from within write()
+    KDPipeIODevice *const device = q;
+    QMetaObject::invokeMethod(device, [device, numWritten]() {
+        Q_EMIT device->bytesWritten(numWritten);
+    }, Qt::QueuedConnection);
+    return numWritten;
+}
+#endif // Q_OS_LINUX
+
 class KDPipeIODevice::Private : public QObject
 {
     Q_OBJECT
@@ -227,6 +506,9 @@ private:
     Qt::HANDLE handle;
     Reader *reader;
     Writer *writer;
+#ifdef Q_OS_LINUX
+    DirectPipe *direct;
+#endif
     bool triedToStartReader;
     bool triedToStartWriter;
 };
@@ -241,11 +523,24 @@ void KDPipeIODevice::setDebugLevel(KDPipeIODevice::DebugLevel level)
     s_debugLevel = level;
 }
 
+int KDPipeIODevice::pipeBufferSize()
+{
+    return s_pipeBufferSize;
+}
+
+void KDPipeIODevice::setPipeBufferSize(int size)
+{
+    s_pipeBufferSize = std::max(size, 0);
+}
+
 KDPipeIODevice::Private::Private(KDPipeIODevice *qq) : QObject(qq), q(qq),
     fd(-1),
     handle(nullptr),
     reader(nullptr),
     writer(nullptr),
+#ifdef Q_OS_LINUX
+    direct(nullptr),
+#endif
     triedToStartReader(false),
     triedToStartWriter(false)
 {
@@ -391,6 +686,15 @@ bool KDPipeIODevice::Private::doOpen(int fd_, Qt::HANDLE handle_, OpenMode mode_
         return false;    // need to have at least read -or- write
     }
 
+#ifdef Q_OS_LINUX
+    direct = new DirectPipe(q, fd_, mode_);
+    QDebug("KDPipeIODevice::doOpen (%p): created direct pipe (%p) for fd %d", (void *)this,
+           (void *)direct, fd_);
+    fd = fd_;
+    handle = handle_;
+    q->setOpenMode(mode_ | Unbuffered);
+    return true;
+#else
     std::unique_ptr<Reader> reader_;
     std::unique_ptr<Writer> writer_;
 
@@ -417,6 +721,7 @@ bool KDPipeIODevice::Private::doOpen(int fd_, Qt::HANDLE handle_, OpenMode mode_
 
     q->setOpenMode(mode_ | Unbuffered);
     return true;
+#endif
 }
 
 int KDPipeIODevice::descriptor() const
@@ -435,6 +740,11 @@ qint64 KDPipeIODevice::bytesAvailable() const
 {
     KDAB_CHECK_THIS;
     const qint64 base = QIODevice::bytesAvailable();
+#ifdef Q_OS_LINUX
+    if (d->direct) {
+        return base + d->direct->bytesAvailable();
+    }
+#endif
     if (!d->triedToStartReader) {
         d->startReaderThread();
         return base;
@@ -453,6 +763,7 @@ qint64 KDPipeIODevice::bytesToWrite() const
     KDAB_CHECK_THIS;
     d->startWriterThread();
     const qint64 base = QIODevice::bytesToWrite();
+    // d->direct writes synchronously, so there's nothing pending
     if (d->writer) {
         synchronized(d->writer) return base + d->writer->bytesInBuffer();
     }
@@ -466,6 +777,11 @@ bool KDPipeIODevice::canReadLine() const
     if (QIODevice::canReadLine()) {
         return true;
     }
+#ifdef Q_OS_LINUX
+    if (d->direct) {
+        return d->direct->canReadLine();
+    }
+#endif
     if (d->reader) {
         synchronized(d->reader) return d->reader->bufferContains('\n');
     }
@@ -488,6 +804,11 @@ bool KDPipeIODevice::atEnd() const
     if (!isOpen()) {
         return true;
     }
+#ifdef Q_OS_LINUX
+    if (d->direct) {
+        return d->direct->atEnd();
+    }
+#endif
     if (d->reader->eofShortCut) {
         return true;
     }
@@ -530,6 +851,11 @@ bool KDPipeIODevice::waitForReadyRead(int msecs)
             return true;
         }
     }
+#ifdef Q_OS_LINUX
+    if (d->direct) {
+        return d->direct->waitForReadyRead(msecs);
+    }
+#endif
     Reader *const r = d->reader;
     if (!r || r->eofShortCut) {
         return true;
@@ -561,6 +887,11 @@ private:
 
 bool KDPipeIODevice::readWouldBlock() const
 {
+#ifdef Q_OS_LINUX
+    if (d->direct) {
+        return d->direct->readWouldBlock();
+    }
+#endif
     d->startReaderThread();
     LOCKED(d->reader);
     return d->reader->bufferEmpty() && !d->reader->eof && !d->reader->error;
@@ -568,6 +899,11 @@ bool KDPipeIODevice::readWouldBlock() const
 
 bool KDPipeIODevice::writeWouldBlock() const
 {
+#ifdef Q_OS_LINUX
+    if (d->direct) {
+        return d->direct->writeWouldBlock();
+    }
+#endif
     d->startWriterThread();
     LOCKED(d->writer);
     return !d->writer->bufferEmpty() && !d->writer->error;
@@ -577,6 +913,16 @@ qint64 KDPipeIODevice::readData(char *data, qint64 maxSize)
 {
     KDAB_CHECK_THIS;
     QDebug("%p: KDPipeIODevice::readData: data=%s, maxSize=%lld", (void *)this, data, maxSize);
+#ifdef Q_OS_LINUX
+    if (d->direct) {
+        // Consumers in other threads, like gpgme's data callbacks, take 0 for
+        // EOF; they may block. The thread of the device waits for readyRead().
+        if (QThread::currentThread() != thread()) {
+            d->direct->waitForReadyRead(-1);
+        }
+        return d->direct->read(data, maxSize);
+    }
+#endif
     d->startReaderThread();
     Reader *const r = d->reader;
 
@@ -656,6 +1002,11 @@ qint64 Reader::readData(char *data, qint64 maxSize)
 qint64 KDPipeIODevice::writeData(const char *data, qint64 size)
 {
     KDAB_CHECK_THIS;
+#ifdef Q_OS_LINUX
+    if (d->direct) {
+        return d->direct->write(data, size);
+    }
+#endif
     d->startWriterThread();
     Writer *const w = d->writer;
 
@@ -751,6 +1102,10 @@ void KDPipeIODevice::close()
     }
     waitAndDelete(d->reader);
 #undef waitAndDelete
+#ifdef Q_OS_LINUX
+    delete d->direct;
+    d->direct = nullptr;
+#endif
 #ifdef Q_OS_WIN32
     if (d->fd != -1) {
         _close(d->fd);
@@ -23,6 +23,14 @@ public:
     static DebugLevel debugLevel();
     static void setDebugLevel(DebugLevel level);
 
+    /**
+     * The size (in bytes) the kernel buffer of opened pipes is enlarged to.
+     * Larger buffers mean fewer wake-ups when streaming large amounts of
+     * data. Only used on Linux; 0 keeps the system default.
+     */
+    static int pipeBufferSize();
+    static void setPipeBufferSize(int size);
+
     explicit KDPipeIODevice(QObject *parent = nullptr);
     explicit KDPipeIODevice(int fd, OpenMode = ReadOnly, QObject *parent = nullptr);
     explicit KDPipeIODevice(Qt::HANDLE handle, OpenMode = ReadOnly, QObject *parent = nullptr);
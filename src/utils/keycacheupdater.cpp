@@ -0,0 +1,301 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/keycacheupdater.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "keycacheupdater.h"
+
+#include <Libkleo/FileSystemWatcher>
+#include <Libkleo/KeyCache>
+
+#include <QGpgME/KeyListJob>
+#include <QGpgME/Protocol>
+
+#include <gpgme++/context.h>
+#include <gpgme++/key.h>
+#include <gpgme++/keylistresult.h>
+
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+
+#include "kleopatra_debug.h"
+
+using namespace Kleo;
+using namespace GpgME;
+
+// announcements older than this are not related to the changes reported
+// by the file system watcher (which waits a second before reporting)
+static const qint64 ANNOUNCEMENT_LIFETIME = 5000; // ms
+// the fingerprints are passed on the command line of gpg and gpgsm
+static const int MAX_CHANGED_KEYS = 500;
+
+static QPointer<KeyCacheUpdater> s_instance;
+
+class KeyCacheUpdater::Private
+{
+    friend class ::Kleo::KeyCacheUpdater;
+    KeyCacheUpdater *const q;
+public:
+    Private(KeyCacheUpdater *qq, const std::shared_ptr<KeyCache> &cache, const std::shared_ptr<FileSystemWatcher> &watcher);
+
+private:
+    void announce(const QStringList &fingerprints, Protocol protocol);
+    void clearAnnouncements();
+    void slotFileSystemChanged();
+    void reloadAll();
+    void startKeyListing(Protocol protocol, const QStringList &fingerprints);
+    void keyListingDone(const KeyListResult &result, const std::vector<Key> &keys, const QString &, const Error &);
+    void updateDone();
+    void setWatching(bool watching);
+
+private:
+    const std::shared_ptr<KeyCache> cache;
+    const std::shared_ptr<FileSystemWatcher> watcher;
+
+    // the announced changes
+    QSet<QString> openPGPFingerprints;
+    QSet<QString> cmsFingerprints;
+    bool unknownChanges;
+    QElapsedTimer lastAnnouncement;
+
+    // the update in progress
+    int runningJobs;
+    QSet<QString> listedFingerprints;
+    std::vector<Key> listedKeys;
+    bool listingFailed;
+    bool reloading;
+    bool changedWhileUpdating;
+    bool watcherEnabled;
+};
+
+KeyCacheUpdater::Private::Private(KeyCacheUpdater *qq, const std::shared_ptr<KeyCache> &cache_, const std::shared_ptr<FileSystemWatcher> &watcher_)
+    : q(qq),
+      cache(cache_),
+      watcher(watcher_),
+      unknownChanges(false),
+      runningJobs(0),
+      listingFailed(false),
+      reloading(false),
+      changedWhileUpdating(false),
+      watcherEnabled(true)
+{
+
+}
+
+void KeyCacheUpdater::Private::announce(const QStringList &fingerprints, Protocol protocol)
+{
+    if (protocol != CMS) {
+        openPGPFingerprints.unite(QSet<QString>(fingerprints.begin(), fingerprints.end()));
+    }
+    if (protocol != OpenPGP) {
+        cmsFingerprints.unite(QSet<QString>(fingerprints.begin(), fingerprints.end()));
+    }
+    lastAnnouncement.start();
+}
+
+void KeyCacheUpdater::Private::clearAnnouncements()
+{
+    openPGPFingerprints.clear();
+    cmsFingerprints.clear();
+    unknownChanges = false;
+    lastAnnouncement.invalidate();
+}
+
+void KeyCacheUpdater::Private::slotFileSystemChanged()
+{
+    if (reloading || runningJobs) {
+        changedWhileUpdating = true;
+        return;
+    }
+
+    const bool announced = lastAnnouncement.isValid() && !lastAnnouncement.hasExpired(ANNOUNCEMENT_LIFETIME)
+                           && (!openPGPFingerprints.isEmpty() || !cmsFingerprints.isEmpty());
+    const QStringList openPGP = openPGPFingerprints.values();
+    const QStringList cms = cmsFingerprints.values();
+    // certificates of unknown protocol are in both sets, but count once
+    QSet<QString> fingerprints = openPGPFingerprints;
+    fingerprints.unite(cmsFingerprints);
+    const bool unknown = unknownChanges;
+    clearAnnouncements();
+
+    if (!announced || unknown || fingerprints.size() > MAX_CHANGED_KEYS) {
+        reloadAll();
+        return;
+    }
+
+    qCDebug(KLEOPATRA_LOG) << "KeyCacheUpdater: listing" << openPGP.size() << "OpenPGP and" << cms.size() << "S/MIME certificates";
+    setWatching(false);
+    listedFingerprints = fingerprints;
+    listedKeys.clear();
+    if (!openPGP.isEmpty()) {
+        startKeyListing(OpenPGP, openPGP);
+    }
+    if (!cms.isEmpty()) {
+        startKeyListing(CMS, cms);
+    }
+    if (!runningJobs) {
+        // no backend; better safe than sorry
+        setWatching(true);
+        reloadAll();
+    }
+}
+
+void KeyCacheUpdater::Private::reloadAll()
+{
+    qCDebug(KLEOPATRA_LOG) << "KeyCacheUpdater: reloading all certificates";
+    // the reload picks up all changes announced so far
+    clearAnnouncements();
+    reloading = true;
+    setWatching(false);
+    cache->reload();
+}
+
+void KeyCacheUpdater::Private::startKeyListing(Protocol protocol, const QStringList &fingerprints)
+{
+    const auto backend = protocol == OpenPGP ? QGpgME::openpgp() : QGpgME::smime();
+    QGpgME::KeyListJob *const job = backend ? backend->keyListJob(false, true, true) : nullptr;
+    if (!job) {
+        return;
+    }
+    // like the listing of the KeyCache, so that hasSecret() is set
+    QGpgME::Job::context(job)->addKeyListMode(GpgME::WithSecret);
+    // Old connect here because of Windows.
+    QObject::connect(job, SIGNAL(result(GpgME::KeyListResult,std::vector<GpgME::Key>,QString,GpgME::Error)),
+                     q, SLOT(keyListingDone(GpgME::KeyListResult,std::vector<GpgME::Key>,QString,GpgME::Error)));
+    if (const Error err = job->start(fingerprints)) {
+        qCDebug(KLEOPATRA_LOG) << "KeyCacheUpdater: listing failed:" << err.asString();
+        return;
+    }
+    ++runningJobs;
+}
+
+void KeyCacheUpdater::Private::keyListingDone(const KeyListResult &result, const std::vector<Key> &keys, const QString &, const Error &)
+{
+    if (result.error() && !result.error().isCanceled()) {
+        // we can't tell which certificates are gone
+        qCDebug(KLEOPATRA_LOG) << "KeyCacheUpdater: listing failed:" << result.error().asString();
+        listingFailed = true;
+    }
+    listedKeys.insert(listedKeys.end(), keys.begin(), keys.end());
+    if (--runningJobs) {
+        return;
+    }
+
+    if (listingFailed) {
+        listingFailed = false;
+        listedFingerprints.clear();
+        listedKeys.clear();
+        reloadAll();
+        return;
+    }
+
+    // the announced certificates that weren't found are gone
+    for (const Key &key : std::as_const(listedKeys)) {
+        listedFingerprints.remove(QString::fromLatin1(key.primaryFingerprint()));
+    }
+    std::vector<Key> removed;
+    for (const QString &fingerprint : std::as_const(listedFingerprints)) {
+        const Key key = cache->findByFingerprint(fingerprint.toLatin1().constData());
+        if (!key.isNull()) {
+            removed.push_back(key);
+        }
+    }
+    if (!removed.empty()) {
+        cache->remove(removed);
+    }
+    if (!listedKeys.empty()) {
+        cache->insert(listedKeys);
+    }
+    listedFingerprints.clear();
+    listedKeys.clear();
+
+    updateDone();
+}
+
+void KeyCacheUpdater::Private::updateDone()
+{
+    reloading = false;
+    setWatching(true);
+    if (changedWhileUpdating) {
+        changedWhileUpdating = false;
+        slotFileSystemChanged();
+    }
+}
+
+void KeyCacheUpdater::Private::setWatching(bool watching)
+{
+    // the listings update the trust database themselves
+    watcher->setEnabled(watching && watcherEnabled);
+}
+
+KeyCacheUpdater::KeyCacheUpdater(const std::shared_ptr<KeyCache> &cache, const std::shared_ptr<FileSystemWatcher> &watcher, QObject *parent)
+    : QObject(parent), d(new Private(this, cache, watcher))
+{
+    Q_ASSERT(!s_instance);
+    s_instance = this;
+
+    connect(watcher.get(), &FileSystemWatcher::triggered, this, [this]() {
+        d->slotFileSystemChanged();
+    });
+    connect(cache.get(), &KeyCache::keyListingDone, this, [this]() {
+        // announcements made during a full reload are covered by it, too
+        d->clearAnnouncements();
+        if (d->reloading) {
+            d->updateDone();
+        }
+    });
+}
+
+KeyCacheUpdater::~KeyCacheUpdater() {}
+
+// static
+void KeyCacheUpdater::keysChanged(const std::vector<Key> &keys)
+{
+    if (!s_instance) {
+        return;
+    }
+    QStringList openPGP, cms;
+    for (const Key &key : keys) {
+        if (key.primaryFingerprint()) {
+            (key.protocol() == CMS ? cms : openPGP).push_back(QString::fromLatin1(key.primaryFingerprint()));
+        }
+    }
+    s_instance->d->announce(openPGP, OpenPGP);
+    s_instance->d->announce(cms, CMS);
+}
+
+// static
+void KeyCacheUpdater::keysChanged(const QStringList &fingerprints, Protocol protocol)
+{
+    if (s_instance) {
+        s_instance->d->announce(fingerprints, protocol);
+    }
+}
+
+// static
+void KeyCacheUpdater::unknownKeysChanged()
+{
+    if (s_instance) {
+        s_instance->d->unknownChanges = true;
+        s_instance->d->lastAnnouncement.start();
+    }
+}
+
+// static
+void KeyCacheUpdater::enableFileSystemWatcher(bool enable)
+{
+    if (s_instance) {
+        s_instance->d->watcherEnabled = enable;
+        s_instance->d->setWatching(enable && !s_instance->d->reloading && !s_instance->d->runningJobs);
+    }
+}
+
+#include "moc_keycacheupdater.cpp"
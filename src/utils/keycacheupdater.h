@@ -0,0 +1,72 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/keycacheupdater.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QObject>
+
+#include <utils/pimpl_ptr.h>
+
+#include <gpgme++/global.h>
+
+#include <memory>
+#include <vector>
+
+class QStringList;
+
+namespace GpgME
+{
+class Key;
+}
+
+namespace Kleo
+{
+
+class FileSystemWatcher;
+class KeyCache;
+
+/**
+ * Updates the key cache after changes in the GnuPG home directory.
+ *
+ * Operations of Kleopatra that change certificates announce them with
+ * keysChanged(). When the file system watcher reports changes shortly
+ * afterwards, only the announced certificates are listed again and
+ * updated in the key cache (or removed from it, if they are gone).
+ * Changes nobody announced, e.g. by gpg on the command line, and changes
+ * announced with unknownKeysChanged() lead to a full reload of the cache.
+ */
+class KeyCacheUpdater : public QObject
+{
+    Q_OBJECT
+public:
+    KeyCacheUpdater(const std::shared_ptr<KeyCache> &cache, const std::shared_ptr<FileSystemWatcher> &watcher, QObject *parent = nullptr);
+    ~KeyCacheUpdater() override;
+
+    /** Announces changes of the certificates \a keys. */
+    static void keysChanged(const std::vector<GpgME::Key> &keys);
+    /** Announces changes of the certificates with the given fingerprints. */
+    static void keysChanged(const QStringList &fingerprints, GpgME::Protocol protocol = GpgME::UnknownProtocol);
+    /**
+     * Announces changes that may affect other certificates than the changed
+     * ones, e.g. changes of the owner trust, which affect the validity of
+     * the certificates signed by the owner.
+     */
+    static void unknownKeysChanged();
+
+    /** Ignores changes in the GnuPG home directory while \a enable is false. */
+    static void enableFileSystemWatcher(bool enable);
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+    Q_PRIVATE_SLOT(d, void keyListingDone(GpgME::KeyListResult, std::vector<GpgME::Key>, QString, GpgME::Error))
+};
+
+}
+
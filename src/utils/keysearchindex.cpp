@@ -0,0 +1,352 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/keysearchindex.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "keysearchindex.h"
+
+#include <Libkleo/Formatting>
+#include <Libkleo/KeyCache>
+
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include <QTimer>
+
+#include <algorithm>
+#include <iterator>
+
+using namespace Kleo;
+using namespace GpgME;
+
+// rebuild the index instead of accumulating more removed keys than this
+static const size_t MAX_REMOVED_KEYS = 1024;
+// the time spent on building the index per iteration of the event loop
+static const qint64 MAX_INDEXING_TIME = 20; // ms
+
+static quint64 trigram(const QChar *c)
+{
+    return quint64(c[0].unicode()) << 32 | quint64(c[1].unicode()) << 16 | quint64(c[2].unicode());
+}
+
+static void addTrigrams(const QString &text, std::vector<quint64> &trigrams)
+{
+    const QString folded = text.toCaseFolded();
+    for (int i = 0; i + 3 <= folded.size(); ++i) {
+        trigrams.push_back(trigram(folded.constData() + i));
+    }
+}
+
+// everything KeyListSortFilterProxyModel may match the filter text
+// against, in the first column or in the summary column
+static std::vector<quint64> trigramsOf(const Key &key)
+{
+    std::vector<quint64> result;
+    for (const UserID &uid : key.userIDs()) {
+        addTrigrams(QString::fromUtf8(uid.id()), result);
+        addTrigrams(Formatting::prettyUserID(uid), result);
+        addTrigrams(QString::fromUtf8(uid.email()), result);
+    }
+    addTrigrams(QString::fromLatin1(key.primaryFingerprint()), result);
+    addTrigrams(QString::fromUtf8(key.issuerName()), result);
+    addTrigrams(Formatting::summaryLine(key), result);
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+bool KeySearchIndex::Matches::isRestrictive() const
+{
+    return !m_slots.empty();
+}
+
+bool KeySearchIndex::Matches::mayMatch(const Key &key) const
+{
+    if (m_slots.empty()) {
+        return true;
+    }
+    const auto it = m_index->m_slotsByKey.find(key.impl());
+    if (it == m_index->m_slotsByKey.end() || it->second >= m_slots.size()) {
+        return true;
+    }
+    return m_slots[it->second];
+}
+
+// static
+KeySearchIndex &KeySearchIndex::instance()
+{
+    static KeySearchIndex index;
+    return index;
+}
+
+KeySearchIndex::KeySearchIndex()
+    : m_cache(KeyCache::instance()),
+      m_pendingKeyChanges(),
+      m_checkForVanishedKeys(false),
+      m_updateScheduled(false),
+      m_keysToIndex(),
+      m_numKeysToIndexDone(0),
+      m_keys(),
+      m_numRemovedKeys(0),
+      m_slotsByFingerprint(),
+      m_slotsByKey(),
+      m_postings(),
+      m_generation(0)
+{
+    const KeyCache *const cache = m_cache.get();
+    QObject::connect(cache, &KeyCache::added, cache, [this](const Key &key) {
+        queueKeyChange(key, true);
+    });
+    QObject::connect(cache, &KeyCache::aboutToRemove, cache, [this](const Key &key) {
+        queueKeyChange(key, false);
+    });
+    // a reload replaces the cache without reporting the keys that are gone
+    QObject::connect(cache, &KeyCache::keysMayHaveChanged, cache, [this]() {
+        m_checkForVanishedKeys = true;
+        scheduleUpdate();
+    });
+    // keys() would wait for the cache to be loaded; once it is, the cache
+    // reports keysMayHaveChanged()
+    if (cache->initialized()) {
+        rebuild(cache->keys());
+    }
+}
+
+void KeySearchIndex::queueKeyChange(const Key &key, bool added)
+{
+    const char *const fpr = key.primaryFingerprint();
+    if (!fpr) {
+        return;
+    }
+    m_pendingKeyChanges[fpr] = {key, added};
+}
+
+quint64 KeySearchIndex::generation()
+{
+    applyKeyChanges();
+    return m_generation;
+}
+
+bool KeySearchIndex::isBuilding() const
+{
+    return m_numKeysToIndexDone < m_keysToIndex.size();
+}
+
+void KeySearchIndex::scheduleUpdate()
+{
+    if (m_updateScheduled) {
+        return;
+    }
+    m_updateScheduled = true;
+    QTimer::singleShot(0, m_cache.get(), [this]() {
+        m_updateScheduled = false;
+        if (isBuilding()) {
+            indexSomeKeys();
+        } else {
+            applyKeyChanges();
+        }
+    });
+}
+
+void KeySearchIndex::indexSomeKeys()
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (isBuilding() && !timer.hasExpired(MAX_INDEXING_TIME)) {
+        insert(m_keysToIndex[m_numKeysToIndexDone++]);
+    }
+    if (isBuilding()) {
+        scheduleUpdate();
+        return;
+    }
+    std::vector<Key>().swap(m_keysToIndex);
+    m_numKeysToIndexDone = 0;
+    ++m_generation;
+    // the changes of the cache since the build started
+    applyKeyChanges();
+}
+
+void KeySearchIndex::applyKeyChanges()
+{
+    // the changes are applied after the keys they may refer to are indexed
+    if (isBuilding() || (m_pendingKeyChanges.empty() && !m_checkForVanishedKeys)) {
+        return;
+    }
+    const bool changed = !m_pendingKeyChanges.empty();
+    for (const auto &change : m_pendingKeyChanges) {
+        if (change.second.added) {
+            insert(change.second.key);
+        } else {
+            remove(change.first);
+        }
+    }
+    m_pendingKeyChanges.clear();
+
+    if (m_checkForVanishedKeys) {
+        m_checkForVanishedKeys = false;
+        const std::vector<Key> keys = KeyCache::instance()->keys();
+        if (keys.size() != m_keys.size() - m_numRemovedKeys) {
+            rebuild(keys);
+            return;
+        }
+    }
+    if (m_numRemovedKeys > MAX_REMOVED_KEYS && m_numRemovedKeys > m_keys.size() / 2) {
+        std::vector<Key> keys;
+        keys.reserve(m_keys.size() - m_numRemovedKeys);
+        std::copy_if(m_keys.begin(), m_keys.end(), std::back_inserter(keys), [](const Key &key) {
+            return !key.isNull();
+        });
+        rebuild(keys);
+        return;
+    }
+    if (changed) {
+        ++m_generation;
+    }
+}
+
+void KeySearchIndex::insert(const Key &key)
+{
+    const char *const fpr = key.primaryFingerprint();
+    if (!fpr) {
+        return;
+    }
+    remove(fpr);
+
+    const auto slot = quint32(m_keys.size());
+    m_keys.push_back(key);
+    m_slotsByFingerprint[fpr] = slot;
+    m_slotsByKey[key.impl()] = slot;
+    // slots only grow, so the postings stay sorted
+    for (const quint64 t : trigramsOf(key)) {
+        m_postings[t].push_back(slot);
+    }
+}
+
+void KeySearchIndex::remove(const std::string &fingerprint)
+{
+    const auto it = m_slotsByFingerprint.find(fingerprint);
+    if (it == m_slotsByFingerprint.end()) {
+        return;
+    }
+    // the postings still name the slot; search() skips removed keys
+    Key &key = m_keys[it->second];
+    m_slotsByKey.erase(key.impl());
+    key = Key();
+    ++m_numRemovedKeys;
+    m_slotsByFingerprint.erase(it);
+}
+
+void KeySearchIndex::rebuild(const std::vector<Key> &keys)
+{
+    m_keys.clear();
+    m_numRemovedKeys = 0;
+    m_slotsByFingerprint.clear();
+    m_slotsByKey.clear();
+    m_postings.clear();
+    m_keys.reserve(keys.size());
+    // the keys are indexed bit by bit from the event loop, so that
+    // building the index for a large keyring doesn't block the GUI
+    m_keysToIndex = keys;
+    m_numKeysToIndexDone = 0;
+    ++m_generation;
+    if (isBuilding()) {
+        scheduleUpdate();
+    }
+}
+
+std::vector<quint32> KeySearchIndex::keysContaining(const QString &word) const
+{
+    std::vector<quint64> trigrams;
+    addTrigrams(word, trigrams);
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+    std::vector<const std::vector<quint32> *> postings;
+    postings.reserve(trigrams.size());
+    for (const quint64 t : trigrams) {
+        const auto it = m_postings.find(t);
+        if (it == m_postings.end()) {
+            return {};
+        }
+        postings.push_back(&it->second);
+    }
+    // start with the rarest trigram to keep the intermediate results small
+    std::sort(postings.begin(), postings.end(), [](const std::vector<quint32> *lhs, const std::vector<quint32> *rhs) {
+        return lhs->size() < rhs->size();
+    });
+
+    std::vector<quint32> result;
+    std::copy_if(postings.front()->begin(), postings.front()->end(), std::back_inserter(result), [this](quint32 slot) {
+        return !m_keys[slot].isNull();
+    });
+    std::vector<quint32> intersection;
+    for (auto it = postings.begin() + 1; it != postings.end() && !result.empty(); ++it) {
+        intersection.clear();
+        std::set_intersection(result.begin(), result.end(), (*it)->begin(), (*it)->end(), std::back_inserter(intersection));
+        result.swap(intersection);
+    }
+    return result;
+}
+
+KeySearchIndex::Matches KeySearchIndex::search(const QString &text)
+{
+    applyKeyChanges();
+
+    Matches matches;
+    matches.m_index = this;
+    if (isBuilding()) {
+        return matches;
+    }
+
+    static const QRegularExpression whitespace(QStringLiteral("\\s+"));
+    bool restrictive = false;
+    std::vector<quint32> result;
+    const QStringList words = text.split(whitespace, Qt::SkipEmptyParts);
+    for (const QString &word : words) {
+        if (word.size() < 3) {
+            continue;
+        }
+        const std::vector<quint32> keys = keysContaining(word);
+        if (!restrictive) {
+            result = keys;
+            restrictive = true;
+        } else {
+            std::vector<quint32> intersection;
+            std::set_intersection(result.begin(), result.end(), keys.begin(), keys.end(), std::back_inserter(intersection));
+            result.swap(intersection);
+        }
+    }
+    if (!restrictive) {
+        return matches;
+    }
+
+    // key IDs and fingerprints may also be written with spaces or "0x"
+    static const QRegularExpression hexId(QStringLiteral("^\\s*(?:0[xX])?[0-9a-fA-F\\s]+$"));
+    if (hexId.match(text).hasMatch()) {
+        QString hex = text;
+        hex.remove(whitespace);
+        if (hex.startsWith(QLatin1String("0x"), Qt::CaseInsensitive)) {
+            hex.remove(0, 2);
+        }
+        if (hex.size() < 3) {
+            return matches;
+        }
+        const std::vector<quint32> keys = keysContaining(hex);
+        std::vector<quint32> united;
+        std::set_union(result.begin(), result.end(), keys.begin(), keys.end(), std::back_inserter(united));
+        result.swap(united);
+    }
+
+    // one more slot, so that a search without results is still restrictive
+    matches.m_slots.assign(m_keys.size() + 1, false);
+    for (const quint32 slot : result) {
+        matches.m_slots[slot] = true;
+    }
+    return matches;
+}
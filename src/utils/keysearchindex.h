@@ -0,0 +1,122 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/keysearchindex.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QString>
+
+#include <gpgme++/key.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Kleo
+{
+
+class KeyCache;
+
+/**
+ * A trigram index over the text of the keys in the KeyCache, i.e. over
+ * the user IDs, fingerprints, issuers and summary lines of the keys.
+ *
+ * The key list filters match the filter text as a substring, so they
+ * have to look at every key. The index tells them beforehand which keys
+ * cannot contain the text at all. It is shared by all views and follows
+ * the changes of the KeyCache incrementally.
+ *
+ * The index is built in small steps from the event loop, after the
+ * KeyCache has been loaded. Until it is complete, searches don't rule
+ * out any key.
+ *
+ * Must only be used in the GUI thread.
+ */
+class KeySearchIndex
+{
+public:
+    /**
+     * The keys that may contain a searched text. Only valid as long as
+     * the generation() of the index doesn't change.
+     */
+    class Matches
+    {
+    public:
+        /** Returns false if the search doesn't rule out any key. */
+        bool isRestrictive() const;
+        /**
+         * Returns whether \a key may contain the searched text. Keys the
+         * index doesn't know, e.g. keys that are not in the KeyCache or
+         * other versions of the keys in the KeyCache, may always match.
+         */
+        bool mayMatch(const GpgME::Key &key) const;
+
+    private:
+        friend class KeySearchIndex;
+        const KeySearchIndex *m_index = nullptr;
+        // by slot of the key in the index; empty if not restrictive
+        std::vector<bool> m_slots;
+    };
+
+    static KeySearchIndex &instance();
+
+    /** Changes whenever the indexed keys change. */
+    quint64 generation();
+
+    /** Returns true while the index is being built. */
+    bool isBuilding() const;
+
+    /**
+     * Returns the keys that contain all words of \a text, ignoring case.
+     * Words shorter than three characters don't rule out any key.
+     */
+    Matches search(const QString &text);
+
+private:
+    KeySearchIndex();
+
+    void queueKeyChange(const GpgME::Key &key, bool added);
+    void scheduleUpdate();
+    void indexSomeKeys();
+    void applyKeyChanges();
+    void insert(const GpgME::Key &key);
+    void remove(const std::string &fingerprint);
+    void rebuild(const std::vector<GpgME::Key> &keys);
+    std::vector<quint32> keysContaining(const QString &word) const;
+
+private:
+    const std::shared_ptr<const KeyCache> m_cache;
+
+    struct KeyChange {
+        GpgME::Key key;
+        bool added;
+    };
+    // the latest change per fingerprint, applied before the next use
+    std::map<std::string, KeyChange> m_pendingKeyChanges;
+    bool m_checkForVanishedKeys;
+    bool m_updateScheduled;
+
+    // the keys of a build in progress, and how many of them are indexed
+    std::vector<GpgME::Key> m_keysToIndex;
+    size_t m_numKeysToIndexDone;
+
+    // the indexed keys by slot; null for removed keys
+    std::vector<GpgME::Key> m_keys;
+    size_t m_numRemovedKeys;
+    std::unordered_map<std::string, quint32> m_slotsByFingerprint;
+    // identifies the very versions of the keys that were indexed
+    std::unordered_map<const void *, quint32> m_slotsByKey;
+    // the slots of the keys containing a trigram, in ascending order
+    std::unordered_map<quint64, std::vector<quint32>> m_postings;
+    quint64 m_generation;
+};
+
+}
+
@@ -34,6 +34,7 @@ public:
     bool m_ioLoggingEnabled;
     QString m_outputDirectory;
     FILE *m_logFile;
+    std::unique_ptr<AsyncLog> m_assuanLog;
 };
 
 Log::Private::~Private()
@@ -121,6 +122,15 @@ void Log::setOutputDirectory(const QString &path)
     const QString lfn = path + QLatin1String("/kleo-log");
     d->m_logFile = fopen(QDir::toNativeSeparators(lfn).toLocal8Bit().constData(), "a");
     Q_ASSERT(d->m_logFile);
+    d->m_assuanLog.reset(new AsyncLog(path + QLatin1String("/kleo-assuan-log")));
+}
+
+std::shared_ptr<AsyncLog::Channel> Log::createAssuanLogChannel(const QByteArray &name) const
+{
+    if (!d->m_assuanLog) {
+        return {};
+    }
+    return d->m_assuanLog->createChannel(name);
 }
 
 std::shared_ptr<QIODevice> Log::createIOLogger(const std::shared_ptr<QIODevice> &io, const QString &prefix, OpenMode mode) const
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <utils/asynclog.h>
 #include <utils/pimpl_ptr.h>
 
 #include  <memory>
@@ -48,6 +49,13 @@ public:
 
     FILE *logFile() const;
 
+    /**
+     * Returns a new channel of the log of the Assuan traffic of the UI
+     * server, or nullptr if logging is disabled. Unlike logFile(), the
+     * channels can be written to without blocking on the other writers.
+     */
+    std::shared_ptr<AsyncLog::Channel> createAssuanLogChannel(const QByteArray &name) const;
+
 private:
     Log();
 
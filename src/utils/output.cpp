@@ -16,6 +16,7 @@
 #include "kdpipeiodevice.h"
 #include "log.h"
 #include "cached.h"
+#include "path-helper.h"
 
 #include <Libkleo/KleoException>
 
@@ -39,7 +40,13 @@
 # include <windows.h>
 #endif
 
+#ifdef Q_OS_LINUX
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
 #include <cerrno>
+#include <cstring>
 
 using namespace Kleo;
 using namespace Kleo::_detail;
@@ -119,6 +126,79 @@ private:
     QString m_oldFileName;
 };
 
+#ifdef Q_OS_LINUX
+// A file without a name, created with O_TMPFILE in the directory of the
+// output file. It is given its name with linkat() when the output is
+// finalized, so that nothing is left behind if the output is canceled or
+// Kleopatra crashes. close() keeps the descriptor open for that.
+class AnonymousTemporaryFile : public QFile
+{
+public:
+    static std::shared_ptr<AnonymousTemporaryFile> create(const QString &fileName)
+    {
+        // linkat() needs /proc to give the file a name without special privileges
+        if (::access("/proc/self/fd", X_OK) != 0) {
+            return std::shared_ptr<AnonymousTemporaryFile>();
+        }
+        const QByteArray dir = QFile::encodeName(QFileInfo(fileName).absolutePath());
+        const int fd = ::open(dir.constData(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            // e.g. not supported by the file system
+            qCDebug(KLEOPATRA_LOG) << "O_TMPFILE failed for" << fileName << ":" << strerror(errno);
+            return std::shared_ptr<AnonymousTemporaryFile>();
+        }
+        std::shared_ptr<AnonymousTemporaryFile> file(new AnonymousTemporaryFile(fd));
+        if (!file->open(fd, QIODevice::WriteOnly, QFileDevice::DontCloseHandle)) {
+            return std::shared_ptr<AnonymousTemporaryFile>();
+        }
+        return file;
+    }
+
+    ~AnonymousTemporaryFile() override
+    {
+        QFile::close();
+        ::close(m_fd);
+    }
+
+    int descriptor() const
+    {
+        return m_fd;
+    }
+
+    // gives the file the name fileName; fails with EEXIST if fileName exists
+    bool link(const QString &fileName) const
+    {
+        const QByteArray path = "/proc/self/fd/" + QByteArray::number(m_fd);
+        return ::linkat(AT_FDCWD, path.constData(), AT_FDCWD, QFile::encodeName(fileName).constData(), AT_SYMLINK_FOLLOW) == 0;
+    }
+
+private:
+    explicit AnonymousTemporaryFile(int fd) : QFile(), m_fd(fd) {}
+
+private:
+    const int m_fd;
+};
+
+// reserves size bytes for the file without changing its size, so that
+// large outputs are not fragmented by growing them write by write
+static qint64 preallocate(int fd, qint64 size)
+{
+    if (fd < 0 || size <= 0 || ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+        return 0;
+    }
+    return size;
+}
+
+// releases the space reserved by preallocate() beyond the end of the file
+static void release_preallocation(int fd, qint64 preallocated)
+{
+    const off_t size = ::lseek(fd, 0, SEEK_END);
+    if (size >= 0 && preallocated > size) {
+        ::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, size, preallocated - size);
+    }
+}
+#endif // Q_OS_LINUX
+
 template <typename T_IODevice>
 struct inhibit_close : T_IODevice {
     explicit inhibit_close() : T_IODevice() {}
@@ -367,7 +447,7 @@ private:
 class FileOutput : public OutputImplBase
 {
 public:
-    explicit FileOutput(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy);
+    explicit FileOutput(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy, qint64 sizeHint);
     ~FileOutput() override
     {
         qCDebug(KLEOPATRA_LOG) << this;
@@ -379,6 +459,11 @@ public:
     }
     std::shared_ptr<QIODevice> ioDevice() const override
     {
+#ifdef Q_OS_LINUX
+        if (m_anonFile) {
+            return m_anonFile;
+        }
+#endif
         return m_tmpFile;
     }
     void doFinalize() override;
@@ -397,10 +482,17 @@ public:
 
 private:
     bool obtainOverwritePermission();
+#ifdef Q_OS_LINUX
+    void finalizeAnonymousFile();
+#endif
 
 private:
     const QString m_fileName;
     std::shared_ptr< TemporaryFile > m_tmpFile;
+#ifdef Q_OS_LINUX
+    std::shared_ptr<AnonymousTemporaryFile> m_anonFile;
+    qint64 m_preallocated = 0;
+#endif
     const std::shared_ptr<OverwritePolicy> m_policy;
     std::weak_ptr<OutputInput> m_attachedInput;
 };
@@ -496,29 +588,42 @@ PipeOutput::PipeOutput(assuan_fd_t fd)
                              assuanFD2int(fd)));
 }
 
-std::shared_ptr<Output> Output::createFromFile(const QString &fileName, bool forceOverwrite)
+std::shared_ptr<Output> Output::createFromFile(const QString &fileName, bool forceOverwrite, qint64 sizeHint)
 {
-    return createFromFile(fileName, std::shared_ptr<OverwritePolicy>(new OverwritePolicy(nullptr, forceOverwrite ? OverwritePolicy::Allow : OverwritePolicy::Deny)));
+    return createFromFile(fileName, std::shared_ptr<OverwritePolicy>(new OverwritePolicy(nullptr, forceOverwrite ? OverwritePolicy::Allow : OverwritePolicy::Deny)), sizeHint);
 
 }
-std::shared_ptr<Output> Output::createFromFile(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy)
+std::shared_ptr<Output> Output::createFromFile(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy, qint64 sizeHint)
 {
-    std::shared_ptr<FileOutput> fo(new FileOutput(fileName, policy));
+    std::shared_ptr<FileOutput> fo(new FileOutput(fileName, policy, sizeHint));
     qCDebug(KLEOPATRA_LOG) << fo.get();
     return fo;
 }
 
-FileOutput::FileOutput(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy)
+FileOutput::FileOutput(const QString &fileName, const std::shared_ptr<OverwritePolicy> &policy, qint64 sizeHint)
     : OutputImplBase(),
       m_fileName(fileName),
-      m_tmpFile(new TemporaryFile(fileName)),
+      m_tmpFile(),
       m_policy(policy)
 {
     Q_ASSERT(m_policy);
+#ifdef Q_OS_LINUX
+    m_anonFile = AnonymousTemporaryFile::create(fileName);
+    if (m_anonFile) {
+        m_preallocated = preallocate(m_anonFile->descriptor(), sizeHint);
+        return;
+    }
+#else
+    Q_UNUSED(sizeHint)
+#endif
+    m_tmpFile.reset(new TemporaryFile(fileName));
     errno = 0;
     if (!m_tmpFile->openNonInheritable())
         throw Exception(errno ? gpg_error_from_errno(errno) : gpg_error(GPG_ERR_EIO),
                         i18n("Could not create temporary file for output \"%1\"", fileName));
+#ifdef Q_OS_LINUX
+    m_preallocated = preallocate(m_tmpFile->handle(), sizeHint);
+#endif
 }
 
 bool FileOutput::obtainOverwritePermission()
@@ -538,10 +643,69 @@ bool FileOutput::obtainOverwritePermission()
     return sel == KMessageBox::Yes || sel == KMessageBox::No;
 }
 
+#ifdef Q_OS_LINUX
+void FileOutput::finalizeAnonymousFile()
+{
+    kleo_assert(m_anonFile);
+
+    if (m_anonFile->isOpen()) {
+        m_anonFile->close(); // flushes, but keeps the descriptor
+    }
+    release_preallocation(m_anonFile->descriptor(), m_preallocated);
+
+    qCDebug(KLEOPATRA_LOG) << this << "linking anonymous file to" << m_fileName;
+
+    if (!m_anonFile->link(m_fileName)) {
+        if (errno != EEXIST)
+            throw Exception(gpg_error_from_errno(errno),
+                            i18n("Could not create output file \"%1\"", m_fileName));
+
+        if (!obtainOverwritePermission())
+            throw Exception(gpg_error(GPG_ERR_CANCELED),
+                            i18n("Overwriting declined"));
+
+        qCDebug(KLEOPATRA_LOG) << this << "going to overwrite" << m_fileName;
+
+        // link to a unique name next to the output file, then replace
+        // the output file atomically
+        QString tmpFileName;
+        for (int i = 0; ; ++i) {
+            tmpFileName = QStringLiteral("%1.%2~").arg(m_fileName).arg(::getpid() + i);
+            if (m_anonFile->link(tmpFileName)) {
+                break;
+            }
+            if (errno != EEXIST || i >= 100)
+                throw Exception(gpg_error_from_errno(errno),
+                                i18n("Could not create temporary file for output \"%1\"", m_fileName));
+        }
+        if (!renameReplacing(tmpFileName, m_fileName)) {
+            const int err = errno;
+            QFile::remove(tmpFileName);
+            throw Exception(gpg_error_from_errno(err),
+                            i18n(R"(Could not rename file "%1" to "%2")",
+                                 tmpFileName, m_fileName));
+        }
+    }
+    qCDebug(KLEOPATRA_LOG) << this << "succeeded";
+
+    m_anonFile.reset();
+    if (!m_attachedInput.expired()) {
+        m_attachedInput.lock()->outputFinalized();
+    }
+}
+#endif // Q_OS_LINUX
+
 void FileOutput::doFinalize()
 {
     qCDebug(KLEOPATRA_LOG) << this;
 
+#ifdef Q_OS_LINUX
+    if (m_anonFile) {
+        finalizeAnonymousFile();
+        return;
+    }
+#endif
+
     struct Remover {
         QString file;
         ~Remover()
@@ -554,6 +718,11 @@ void FileOutput::doFinalize()
 
     kleo_assert(m_tmpFile);
 
+#ifdef Q_OS_LINUX
+    if (m_tmpFile->isOpen() && m_tmpFile->flush()) {
+        release_preallocation(m_tmpFile->handle(), m_preallocated);
+    }
+#endif
     if (m_tmpFile->isOpen()) {
         m_tmpFile->close();
     }
@@ -601,15 +770,10 @@ void FileOutput::doFinalize()
         throw Exception(gpg_error(GPG_ERR_CANCELED),
                         i18n("Overwriting declined"));
 
-    qCDebug(KLEOPATRA_LOG) << this << "going to overwrite" << m_fileName;
+    qCDebug(KLEOPATRA_LOG) << this << "going to overwrite" << m_fileName << "with" << tmpFileName;
 
-    if (!QFile::remove(m_fileName))
-        throw Exception(errno ? gpg_error_from_errno(errno) : gpg_error(GPG_ERR_EIO),
-                        i18n("Could not remove file \"%1\" for overwriting.", m_fileName));
-
-    qCDebug(KLEOPATRA_LOG) << this << "succeeded, renaming " << tmpFileName << "->" << m_fileName;
-
-    if (QFile::rename(tmpFileName, m_fileName)) {
+    // replace the existing file atomically instead of removing it first
+    if (renameReplacing(tmpFileName, m_fileName)) {
         qCDebug(KLEOPATRA_LOG) << this << "succeeded";
 
         if (!m_attachedInput.expired()) {
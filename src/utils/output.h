@@ -63,8 +63,14 @@ public:
     /** Whether or not the output failed. */
     virtual bool failed() const { return false; }
 
-    static std::shared_ptr<Output> createFromFile(const QString &fileName, const std::shared_ptr<OverwritePolicy> &);
-    static std::shared_ptr<Output> createFromFile(const QString &fileName, bool forceOverwrite);
+    /**
+     * Creates an output writing to @p fileName. The data is written to a
+     * temporary file which replaces @p fileName when the output is finalized.
+     * If @p sizeHint is positive, this much space is reserved for the file
+     * up front (where supported), which avoids fragmenting large outputs.
+     */
+    static std::shared_ptr<Output> createFromFile(const QString &fileName, const std::shared_ptr<OverwritePolicy> &, qint64 sizeHint = -1);
+    static std::shared_ptr<Output> createFromFile(const QString &fileName, bool forceOverwrite, qint64 sizeHint = -1);
     static std::shared_ptr<Output> createFromPipeDevice(assuan_fd_t fd, const QString &label);
     static std::shared_ptr<Output> createFromProcessStdIn(const QString &command);
     static std::shared_ptr<Output> createFromProcessStdIn(const QString &command, const QStringList &args);
@@ -25,6 +25,12 @@
 
 #include <algorithm>
 
+#ifdef Q_OS_WIN
+# include <windows.h>
+#else
+# include <cstdio>
+#endif
+
 using namespace Kleo;
 
 static QString commonPrefix(const QString &s1, const QString &s2)
@@ -148,3 +154,14 @@ bool Kleo::moveDir(const QString &src, const QString &dest)
 
     return true;
 }
+
+bool Kleo::renameReplacing(const QString &src, const QString &dest)
+{
+#ifdef Q_OS_WIN
+    return MoveFileExW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(src).utf16()),
+                       reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(dest).utf16()),
+                       MOVEFILE_REPLACE_EXISTING);
+#else
+    return std::rename(QFile::encodeName(src).constData(), QFile::encodeName(dest).constData()) == 0;
+#endif
+}
@@ -23,5 +23,10 @@ QStringList makeRelativeTo(const QString &dir, const QStringList &files);
 void recursivelyRemovePath(const QString &path);
 bool recursivelyCopy(const QString &src, const QString &dest);
 bool moveDir(const QString &src, const QString &dest);
+/**
+ * Renames the file @p src to @p dest, atomically replacing @p dest if it
+ * exists. Unlike QFile::rename(), this never falls back to copying.
+ */
+bool renameReplacing(const QString &src, const QString &dest);
 }
 
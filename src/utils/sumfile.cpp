@@ -0,0 +1,113 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/sumfile.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "sumfile.h"
+
+#include "kleopatra_debug.h"
+
+#include <QFile>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace Kleo;
+
+static bool is_hex(char ch)
+{
+    return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+static QByteArray decode(const char *begin, const char *end)
+{
+    QByteArray decoded;
+    decoded.reserve(end - begin);
+    for (const char *it = begin; it != end; ++it)
+        if (*it == '\\' && it + 1 != end) {
+            switch (*++it) {
+            case '\\': decoded += '\\'; break;
+            case 'n':  decoded += '\n'; break;
+            default:
+                qCDebug(KLEOPATRA_LOG) << "invalid escape sequence" << '\\' << *it << "(interpreted as '" << *it << "')";
+                decoded += *it;
+                break;
+            }
+        } else if (*it != '\\') {
+            decoded += *it;
+        }
+    return decoded;
+}
+
+// parses one line (without the line terminator); returns false if it doesn't match
+// (\\?)([a-f0-9A-F]+) ([ *])([^\n]+)
+static bool parse_line(const char *begin, const char *end, SumFileEntry &entry)
+{
+    const bool escaped = begin != end && *begin == '\\';
+    const char *const hexBegin = escaped ? begin + 1 : begin;
+    const char *it = std::find_if_not(hexBegin, end, is_hex);
+    if (it == hexBegin || end - it < 3 || *it != ' ' || (it[1] != ' ' && it[1] != '*')) {
+        return false;
+    }
+    entry.checksum = QByteArray(hexBegin, it - hexBegin);
+    entry.binary = it[1] == '*';
+    const char *const nameBegin = it + 2;
+    entry.name = escaped ? QFile::decodeName(decode(nameBegin, end))
+                 : QFile::decodeName(QByteArray::fromRawData(nameBegin, end - nameBegin));
+    return true;
+}
+
+std::vector<SumFileEntry> Kleo::parseSumFile(const char *data, size_t size)
+{
+    std::vector<SumFileEntry> entries;
+    if (!data || !size) {
+        return entries;
+    }
+    const char *const end = data + size;
+    entries.reserve(std::count(data, end, '\n') + 1);
+
+    SumFileEntry entry;
+    for (const char *line = data; line < end;) {
+        // memchr is vectorized by all relevant C libraries
+        const char *eol = static_cast<const char *>(std::memchr(line, '\n', end - line));
+        if (!eol) {
+            eol = end;
+        }
+        const char *lineEnd = eol;
+        if (lineEnd != line && lineEnd[-1] == '\r') {
+            --lineEnd;
+        }
+        if (parse_line(line, lineEnd, entry)) {
+            entries.push_back(std::move(entry));
+            entry = SumFileEntry();
+        }
+        line = eol + 1;
+    }
+    return entries;
+}
+
+std::vector<SumFileEntry> Kleo::parseSumFile(const QString &fileName)
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return std::vector<SumFileEntry>();
+    }
+    const qint64 size = f.size();
+    if (size <= 0) {
+        return std::vector<SumFileEntry>();
+    }
+    if (uchar *const data = f.map(0, size)) {
+        const std::vector<SumFileEntry> entries = parseSumFile(reinterpret_cast<const char *>(data), size);
+        f.unmap(data);
+        return entries;
+    }
+    // not mappable (e.g. on some network file systems)
+    const QByteArray contents = f.readAll();
+    return parseSumFile(contents.constData(), contents.size());
+}
@@ -0,0 +1,44 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/sumfile.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+#include <vector>
+
+namespace Kleo
+{
+
+struct SumFileEntry {
+    QString name;
+    QByteArray checksum;
+    bool binary;
+};
+
+/**
+ * Parses a checksum file in the format written by the coreutils
+ * programs (md5sum, sha256sum, ...), i.e. lines of the form
+ *
+ *   [\]<hex checksum> <space or '*'><file name>
+ *
+ * Lines not matching this format are skipped. The file is memory-mapped
+ * if possible, so that large checksum files are not copied around.
+ */
+std::vector<SumFileEntry> parseSumFile(const QString &fileName);
+
+/**
+ * \overload
+ * Parses the checksum file contents in \a data.
+ */
+std::vector<SumFileEntry> parseSumFile(const char *data, size_t size);
+
+}
+
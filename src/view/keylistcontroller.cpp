@@ -60,8 +60,15 @@
 #include <QPointer>
 #include <QItemSelectionModel>
 #include <QAction>
+#include <QCoreApplication>
+#include <QThreadPool>
+#include <QTimer>
 
 #include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
 
 using namespace Kleo;
 using namespace Kleo::Commands;
@@ -133,9 +140,13 @@ public:
 
 private:
     int toolTipOptions() const;
+    void queueKeyChange(const Key &key, bool added);
+    void applyKeyChanges();
 
 private:
-    static Command::Restrictions calculateRestrictionsMask(const QItemSelectionModel *sm);
+    static std::vector<Key> selectedKeys(const QItemSelectionModel *sm);
+    static Command::Restrictions cardRestrictions();
+    void setActionsEnabled(Command::Restrictions restrictionsMask) const;
 
 private:
     struct action_item {
@@ -150,6 +161,16 @@ private:
     QPointer<TabWidget> tabWidget;
     QPointer<QAbstractItemView> currentView;
     QPointer<AbstractKeyListModel> flatModel, hierarchicalModel;
+
+    struct KeyChange {
+        Key key;
+        bool added;
+    };
+    // the latest change per fingerprint, see queueKeyChange()
+    std::map<std::string, KeyChange> pendingKeyChanges;
+    QTimer keyChangesTimer;
+    // counts the calls of enableDisableActions(); shared with its workers
+    std::shared_ptr<std::atomic<quint64>> restrictionsGeneration;
 };
 
 KeyListController::Private::Private(KeyListController *qq)
@@ -160,8 +181,17 @@ KeyListController::Private::Private(KeyListController *qq)
       parentWidget(),
       tabWidget(),
       flatModel(),
-      hierarchicalModel()
+      hierarchicalModel(),
+      pendingKeyChanges(),
+      keyChangesTimer(),
+      restrictionsGeneration(std::make_shared<std::atomic<quint64>>(0))
 {
+    keyChangesTimer.setSingleShot(true);
+    keyChangesTimer.setInterval(0);
+    QObject::connect(&keyChangesTimer, &QTimer::timeout, q, [this]() {
+        applyKeyChanges();
+    });
+
     connect(KeyCache::mutableInstance().get(), SIGNAL(added(GpgME::Key)),
             q, SLOT(slotAddKey(GpgME::Key)));
     connect(KeyCache::mutableInstance().get(), SIGNAL(aboutToRemove(GpgME::Key)),
@@ -180,23 +210,50 @@ KeyListController::~KeyListController() {}
 
 void KeyListController::Private::slotAddKey(const Key &key)
 {
-    // ### make model act on keycache directly...
-    if (flatModel) {
-        flatModel->addKey(key);
+    queueKeyChange(key, true);
+}
+
+void KeyListController::Private::slotAboutToRemoveKey(const Key &key)
+{
+    queueKeyChange(key, false);
+}
+
+// The KeyCache reports changes one key at a time, e.g. thousands of them
+// during an import. The changes are collected until control returns to
+// the event loop and are then applied to the models in one go.
+void KeyListController::Private::queueKeyChange(const Key &key, bool added)
+{
+    const char *const fpr = key.primaryFingerprint();
+    if (!fpr) {
+        return;
     }
-    if (hierarchicalModel) {
-        hierarchicalModel->addKey(key);
+    // only the latest change counts: the models replace keys they already have
+    pendingKeyChanges[fpr] = {key, added};
+    if (!keyChangesTimer.isActive()) {
+        keyChangesTimer.start();
     }
 }
 
-void KeyListController::Private::slotAboutToRemoveKey(const Key &key)
+void KeyListController::Private::applyKeyChanges()
 {
-    // ### make model act on keycache directly...
-    if (flatModel) {
-        flatModel->removeKey(key);
+    std::vector<Key> added, removed;
+    for (const auto &change : pendingKeyChanges) {
+        (change.second.added ? added : removed).push_back(change.second.key);
     }
-    if (hierarchicalModel) {
-        hierarchicalModel->removeKey(key);
+    pendingKeyChanges.clear();
+
+    // ### make model act on keycache directly...
+    for (AbstractKeyListModel *const model : {flatModel.data(), hierarchicalModel.data()}) {
+        if (!model) {
+            continue;
+        }
+        // AbstractKeyListModel has no bulk removal
+        for (const Key &key : removed) {
+            model->removeKey(key);
+        }
+        if (!added.empty()) {
+            model->addKeys(added);
+        }
     }
 }
 
@@ -662,90 +719,161 @@ void KeyListController::Private::slotCommandFinished()
     }
 }
 
-void KeyListController::enableDisableActions(const QItemSelectionModel *sm) const
+namespace
 {
-    const Command::Restrictions restrictionsMask = d->calculateRestrictionsMask(sm);
-    for (const Private::action_item &ai : std::as_const(d->actions))
-        if (ai.action) {
-            ai.action->setEnabled(ai.restrictions == (ai.restrictions & restrictionsMask));
-        }
-}
+// Selections larger than this are analyzed in a worker thread, so that
+// selecting all of a large key list doesn't block the GUI.
+static const size_t MAX_KEYS_ANALYZED_SYNCHRONOUSLY = 1000;
+// how many keys the worker analyzes between checks for a newer selection
+static const size_t KEYS_PER_CHUNK = 1000;
 
-static bool all_secret_are_not_owner_trust_ultimate(const std::vector<Key> &keys)
+// What the restrictions mask needs to know about the selected keys,
+// gathered in a single pass. Only reads the keys, so that it can be
+// used in any thread.
+class SelectionSummary
 {
-    for (const Key &key : keys)
-        if (key.hasSecret() && key.ownerTrust() == Key::Ultimate) {
-            return false;
+public:
+    void add(const Key &key)
+    {
+        ++numKeys;
+        if (key.hasSecret()) {
+            ++numSecret;
+            if (key.ownerTrust() == Key::Ultimate) {
+                anySecretWithUltimateOwnerTrust = true;
+            }
         }
-    return true;
-}
-
-Command::Restrictions find_root_restrictions(const std::vector<Key> &keys)
-{
-    bool trusted = false, untrusted = false;
-    for (const Key &key : keys)
-        if (key.isRoot())
+        if (key.protocol() == OpenPGP) {
+            ++numOpenPGP;
+        } else if (key.protocol() == CMS) {
+            ++numCMS;
+        }
+        if (key.isRoot()) {
             if (key.userID(0).validity() == UserID::Ultimate) {
-                trusted = true;
+                ++numTrustedRoots;
             } else {
-                untrusted = true;
+                ++numUntrustedRoots;
             }
-        else {
-            return Command::NoRestriction;
         }
-    if (trusted)
-        if (untrusted) {
+    }
+
+    Command::Restrictions restrictions() const
+    {
+        if (!numKeys) {
             return Command::NoRestriction;
-        } else {
-            return Command::MustBeTrustedRoot;
         }
-    else if (untrusted) {
-        return Command::MustBeUntrustedRoot;
-    } else {
-        return Command::NoRestriction;
+
+        Command::Restrictions result = Command::NeedSelection;
+
+        if (numKeys == 1) {
+            result |= Command::OnlyOneKey;
+        }
+
+        if (numSecret == numKeys) {
+            result |= Command::NeedSecretKey;
+        } else if (!numSecret) {
+            result |= Command::MustNotBeSecretKey;
+        }
+
+        if (numOpenPGP == numKeys) {
+            result |= Command::MustBeOpenPGP;
+        } else if (numCMS == numKeys) {
+            result |= Command::MustBeCMS;
+        }
+
+        if (!anySecretWithUltimateOwnerTrust) {
+            result |= Command::MayOnlyBeSecretKeyIfOwnerTrustIsNotYetUltimate;
+        }
+
+        // only if all keys are roots, and either all or none of them are trusted
+        if (numTrustedRoots == numKeys) {
+            result |= Command::MustBeTrustedRoot;
+        } else if (numUntrustedRoots == numKeys) {
+            result |= Command::MustBeUntrustedRoot;
+        }
+
+        return result;
     }
+
+private:
+    size_t numKeys = 0;
+    size_t numSecret = 0;
+    size_t numOpenPGP = 0;
+    size_t numCMS = 0;
+    size_t numTrustedRoots = 0;
+    size_t numUntrustedRoots = 0;
+    bool anySecretWithUltimateOwnerTrust = false;
+};
 }
 
-Command::Restrictions KeyListController::Private::calculateRestrictionsMask(const QItemSelectionModel *sm)
+void KeyListController::enableDisableActions(const QItemSelectionModel *sm) const
 {
-    if (!sm) {
-        return Command::NoRestriction;
-    }
-
-    const KeyListModelInterface *const m = dynamic_cast<const KeyListModelInterface *>(sm->model());
-    if (!m) {
-        return Command::NoRestriction;
-    }
+    // supersedes the analysis of a previous selection that may still be running
+    const quint64 generation = ++*d->restrictionsGeneration;
 
-    const std::vector<Key> keys = m->keys(sm->selectedRows());
+    const std::vector<Key> keys = Private::selectedKeys(sm);
     if (keys.empty()) {
-        return Command::NoRestriction;
+        d->setActionsEnabled(Command::NoRestriction);
+        return;
+    }
+    if (keys.size() <= MAX_KEYS_ANALYZED_SYNCHRONOUSLY) {
+        SelectionSummary summary;
+        for (const Key &key : keys) {
+            summary.add(key);
+        }
+        d->setActionsEnabled(summary.restrictions() | Private::cardRestrictions());
+        return;
     }
 
-    Command::Restrictions result = Command::NeedSelection;
+    // Until the analysis is done, only the actions that work with any
+    // selection of more than one key are enabled.
+    d->setActionsEnabled(Command::NeedSelection | Private::cardRestrictions());
 
-    if (keys.size() == 1) {
-        result |= Command::OnlyOneKey;
-    }
+    const std::shared_ptr<std::atomic<quint64>> currentGeneration = d->restrictionsGeneration;
+    const QPointer<const KeyListController> guard(this);
+    QThreadPool::globalInstance()->start([keys, generation, currentGeneration, guard]() {
+        SelectionSummary summary;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (i % KEYS_PER_CHUNK == 0 && *currentGeneration != generation) {
+                return;
+            }
+            summary.add(keys[i]);
+        }
+        const Command::Restrictions restrictions = summary.restrictions();
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [restrictions, generation, currentGeneration, guard]() {
+            if (!guard || *currentGeneration != generation) {
+                return;
+            }
+            // the card status may have changed in the meantime
+            guard->d->setActionsEnabled(restrictions | Private::cardRestrictions());
+        }, Qt::QueuedConnection);
+    });
+}
 
-    if (std::all_of(keys.cbegin(), keys.cend(), std::mem_fn(&Key::hasSecret))) {
-        result |= Command::NeedSecretKey;
-    } else if (!std::any_of(keys.cbegin(), keys.cend(), std::mem_fn(&Key::hasSecret))) {
-        result |= Command::MustNotBeSecretKey;
-    }
+void KeyListController::Private::setActionsEnabled(Command::Restrictions restrictionsMask) const
+{
+    for (const action_item &ai : actions)
+        if (ai.action) {
+            ai.action->setEnabled(ai.restrictions == (ai.restrictions & restrictionsMask));
+        }
+}
 
-    if (std::all_of(keys.cbegin(), keys.cend(), [](const Key &key) { return key.protocol() == OpenPGP; })) {
-        result |= Command::MustBeOpenPGP;
-    } else if (std::all_of(keys.cbegin(), keys.cend(), [](const Key &key) { return key.protocol() == CMS; })) {
-        result |= Command::MustBeCMS;
+std::vector<Key> KeyListController::Private::selectedKeys(const QItemSelectionModel *sm)
+{
+    if (!sm) {
+        return {};
     }
 
-    if (all_secret_are_not_owner_trust_ultimate(keys)) {
-        result |= Command::MayOnlyBeSecretKeyIfOwnerTrustIsNotYetUltimate;
+    const KeyListModelInterface *const m = dynamic_cast<const KeyListModelInterface *>(sm->model());
+    if (!m) {
+        return {};
     }
 
-    result |= find_root_restrictions(keys);
+    return m->keys(sm->selectedRows());
+}
 
+Command::Restrictions KeyListController::Private::cardRestrictions()
+{
+    Command::Restrictions result = Command::NoRestriction;
     if (const ReaderStatus *rs = ReaderStatus::instance()) {
         if (!rs->firstCardWithNullPin().empty()) {
             result |= Command::AnyCardHasNullPin;
@@ -754,7 +882,6 @@ Command::Restrictions KeyListController::Private::calculateRestrictionsMask(cons
             result |= Command::AnyCardCanLearnKeys;
         }
     }
-
     return result;
 }
 
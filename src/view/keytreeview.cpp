@@ -18,6 +18,7 @@
 #include <Libkleo/Predicates>
 
 #include "utils/headerview.h"
+#include "utils/indexedkeylistsortfilterproxymodel.h"
 #include "utils/tags.h"
 
 #include <Libkleo/Stl_Util>
@@ -136,13 +137,14 @@ const KeyListModelInterface * keyListModel(const QTreeView &view)
 
 KeyTreeView::KeyTreeView(QWidget *parent)
     : QWidget(parent),
-      m_proxy(new KeyListSortFilterProxyModel(this)),
+      m_proxy(new IndexedKeyListSortFilterProxyModel(this)),
       m_additionalProxy(nullptr),
       m_view(new TreeView(this)),
       m_flatModel(nullptr),
       m_hierarchicalModel(nullptr),
       m_stringFilter(),
       m_keyFilter(),
+      m_saveExpandStateTimer(nullptr),
       m_isHierarchical(true)
 {
     init();
@@ -150,13 +152,16 @@ KeyTreeView::KeyTreeView(QWidget *parent)
 
 KeyTreeView::KeyTreeView(const KeyTreeView &other)
     : QWidget(nullptr),
-      m_proxy(new KeyListSortFilterProxyModel(this)),
+      m_proxy(new IndexedKeyListSortFilterProxyModel(this)),
       m_additionalProxy(other.m_additionalProxy ? other.m_additionalProxy->clone() : nullptr),
       m_view(new TreeView(this)),
       m_flatModel(other.m_flatModel),
       m_hierarchicalModel(other.m_hierarchicalModel),
       m_stringFilter(other.m_stringFilter),
       m_keyFilter(other.m_keyFilter),
+      // the config may not be up to date yet, see saveExpandState()
+      m_expandedKeys(other.m_expandedKeys),
+      m_saveExpandStateTimer(nullptr),
       m_group(other.m_group),
       m_isHierarchical(other.m_isHierarchical)
 {
@@ -169,13 +174,14 @@ KeyTreeView::KeyTreeView(const QString &text, const std::shared_ptr<KeyFilter> &
                          AbstractKeyListSortFilterProxyModel *proxy, QWidget *parent,
                          const KConfigGroup &group)
     : QWidget(parent),
-      m_proxy(new KeyListSortFilterProxyModel(this)),
+      m_proxy(new IndexedKeyListSortFilterProxyModel(this)),
       m_additionalProxy(proxy),
       m_view(new TreeView(this)),
       m_flatModel(nullptr),
       m_hierarchicalModel(nullptr),
       m_stringFilter(text),
       m_keyFilter(kf),
+      m_saveExpandStateTimer(nullptr),
       m_group(group),
       m_isHierarchical(true),
       m_onceResized(false)
@@ -273,7 +279,7 @@ void KeyTreeView::init()
         }
     }
 
-    m_proxy->setFilterFixedString(m_stringFilter);
+    m_proxy->setStringFilter(m_stringFilter);
     m_proxy->setKeyFilter(m_keyFilter);
     m_proxy->setSortCaseSensitivity(Qt::CaseInsensitive);
 
@@ -300,10 +306,18 @@ void KeyTreeView::init()
     m_view->setModel(rearangingModel);
 
     /* Handle expansion state */
-    if (m_group.isValid()) {
-        m_expandedKeys = m_group.readEntry("Expanded", QStringList());
+    if (m_group.isValid() && m_expandedKeys.isEmpty()) {
+        const QStringList expandedKeys = m_group.readEntry("Expanded", QStringList());
+        m_expandedKeys = QSet<QString>(expandedKeys.begin(), expandedKeys.end());
     }
 
+    /* Expanding or collapsing many items, e.g. with "*" on a large tree,
+     * must not rewrite the config for every single item. */
+    m_saveExpandStateTimer = new QTimer(this);
+    m_saveExpandStateTimer->setSingleShot(true);
+    m_saveExpandStateTimer->setInterval(1000);
+    connect(m_saveExpandStateTimer, &QTimer::timeout, this, &KeyTreeView::saveExpandState);
+
     connect(m_view, &QTreeView::expanded, this, [this] (const QModelIndex &index) {
         if (!index.isValid()) {
             return;
@@ -317,10 +331,8 @@ void KeyTreeView::init()
         if (m_expandedKeys.contains(fpr)) {
             return;
         }
-        m_expandedKeys << fpr;
-        if (m_group.isValid()) {
-            m_group.writeEntry("Expanded", m_expandedKeys);
-        }
+        m_expandedKeys.insert(fpr);
+        m_saveExpandStateTimer->start();
     });
 
     connect(m_view, &QTreeView::collapsed, this, [this] (const QModelIndex &index) {
@@ -331,9 +343,8 @@ void KeyTreeView::init()
         if (key.isNull()) {
             return;
         }
-        m_expandedKeys.removeAll(QString::fromLatin1(key.primaryFingerprint()));
-        if (m_group.isValid()) {
-            m_group.writeEntry("Expanded", m_expandedKeys);
+        if (m_expandedKeys.remove(QString::fromLatin1(key.primaryFingerprint()))) {
+            m_saveExpandStateTimer->start();
         }
     });
 
@@ -362,26 +373,63 @@ void KeyTreeView::restoreExpandState()
         qCWarning(KLEOPATRA_LOG) << "Restore expand state before keycache available. Aborting.";
         return;
     }
-    for (const auto &fpr: std::as_const(m_expandedKeys)) {
-        const KeyListModelInterface *const km = keyListModel(*m_view);
-        if (!km) {
-            qCWarning(KLEOPATRA_LOG) << "invalid model";
-            return;
-        }
-        const auto key = KeyCache::instance()->findByFingerprint(fpr.toLatin1().constData());
+    const KeyListModelInterface *const km = keyListModel(*m_view);
+    if (!km) {
+        qCWarning(KLEOPATRA_LOG) << "invalid model";
+        return;
+    }
+    const auto cache = KeyCache::instance();
+
+    // collect everything first, so that the view is laid out only once
+    QModelIndexList toExpand;
+    toExpand.reserve(m_expandedKeys.size());
+    bool staleKeysRemoved = false;
+    for (auto it = m_expandedKeys.begin(); it != m_expandedKeys.end();) {
+        const QString &fpr = *it;
+        const auto key = cache->findByFingerprint(fpr.toLatin1().constData());
         if (key.isNull()) {
             qCDebug(KLEOPATRA_LOG) << "Cannot find:" << fpr << "anymore in cache";
-            m_expandedKeys.removeAll(fpr);
-            return;
+            it = m_expandedKeys.erase(it);
+            staleKeysRemoved = true;
+            continue;
         }
         const auto idx = km->index(key);
         if (!idx.isValid()) {
             qCDebug(KLEOPATRA_LOG) << "Cannot find:" << fpr << "anymore in model";
-            m_expandedKeys.removeAll(fpr);
-            return;
+            it = m_expandedKeys.erase(it);
+            staleKeysRemoved = true;
+            continue;
+        }
+        if (!m_view->isExpanded(idx)) {
+            toExpand.push_back(idx);
         }
+        ++it;
+    }
+    if (staleKeysRemoved) {
+        m_saveExpandStateTimer->start();
+    }
+    if (toExpand.empty()) {
+        return;
+    }
+
+    const bool updatesEnabled = m_view->updatesEnabled();
+    m_view->setUpdatesEnabled(false);
+    for (const QModelIndex &idx : std::as_const(toExpand)) {
         m_view->expand(idx);
     }
+    m_view->setUpdatesEnabled(updatesEnabled);
+}
+
+void KeyTreeView::saveExpandState()
+{
+    m_saveExpandStateTimer->stop();
+    if (!m_group.isValid()) {
+        return;
+    }
+    QStringList expandedKeys(m_expandedKeys.begin(), m_expandedKeys.end());
+    // keep the config stable
+    expandedKeys.sort();
+    m_group.writeEntry("Expanded", expandedKeys);
 }
 
 void KeyTreeView::setUpTagKeys()
@@ -479,6 +527,9 @@ void KeyTreeView::restoreLayout(const KConfigGroup &group)
 
 KeyTreeView::~KeyTreeView()
 {
+    if (m_saveExpandStateTimer->isActive()) {
+        saveExpandState();
+    }
     if (m_group.isValid()) {
         saveLayout(m_group);
     }
@@ -527,7 +578,7 @@ void KeyTreeView::setStringFilter(const QString &filter)
         return;
     }
     m_stringFilter = filter;
-    m_proxy->setFilterFixedString(filter);
+    m_proxy->setStringFilter(filter);
     Q_EMIT stringFilterChanged(filter);
 }
 
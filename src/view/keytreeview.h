@@ -11,6 +11,7 @@
 
 #include <QWidget>
 
+#include <QSet>
 #include <QString>
 #include <QStringList>
 
@@ -21,6 +22,7 @@
 
 #include <KConfigGroup>
 
+class QTimer;
 class QTreeView;
 
 namespace Kleo
@@ -29,7 +31,7 @@ namespace Kleo
 class KeyFilter;
 class AbstractKeyListModel;
 class AbstractKeyListSortFilterProxyModel;
-class KeyListSortFilterProxyModel;
+class IndexedKeyListSortFilterProxyModel;
 
 class KeyTreeView : public QWidget
 {
@@ -130,12 +132,13 @@ private:
     void init();
     void addKeysImpl(const std::vector<GpgME::Key> &, bool);
     void restoreExpandState();
+    void saveExpandState();
     void setUpTagKeys();
 
 private:
     std::vector<GpgME::Key> m_keys;
 
-    KeyListSortFilterProxyModel *m_proxy;
+    IndexedKeyListSortFilterProxyModel *m_proxy;
     AbstractKeyListSortFilterProxyModel *m_additionalProxy;
 
     QTreeView *m_view;
@@ -146,7 +149,10 @@ private:
     QString m_stringFilter;
     std::shared_ptr<KeyFilter> m_keyFilter;
 
-    QStringList m_expandedKeys;
+    // the fingerprints of the expanded keys
+    QSet<QString> m_expandedKeys;
+    // delays writing m_expandedKeys to the config
+    QTimer *m_saveExpandStateTimer;
 
     KConfigGroup m_group;
 
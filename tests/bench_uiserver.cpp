@@ -0,0 +1,570 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    tests/bench_uiserver.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+//
+// Usage: bench_uiserver [--clients <n>] [--iterations <n>] [--commands <list>]
+//                       [--kleopatra <path>] [--timeout <ms>]
+//                       [--command-timeout <ms>]
+//
+// Starts Kleopatra's UI server against a temporary GNUPGHOME containing the
+// test keys, runs <n> concurrent clients issuing the given commands (out of
+// echo, sign, encrypt and decrypt-verify-files) and reports the throughput
+// and the latency of the commands.
+//
+// decrypt-verify-files is not run by default: it always shows a dialog and
+// only finishes after somebody closes it.
+//
+
+#include <config-kleopatra.h>
+
+#include <kleo-assuan.h>
+#include <gpg-error.h>
+
+#include <Libkleo/KleoException>
+
+#include "utils/wsastarter.h"
+#include "utils/hex.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QThread>
+
+#ifndef Q_OS_WIN32
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace Kleo;
+
+#ifdef Q_OS_WIN32
+static const bool HAVE_FD_PASSING = false;
+#else
+static const bool HAVE_FD_PASSING = true;
+#endif
+
+static const unsigned int ASSUAN_CONNECT_FLAGS = HAVE_FD_PASSING ? 1 : 0;
+
+static const char TEST_KEY_EMAIL[] = "foo@bar.com";
+static const char TEST_KEY_PASSPHRASE[] = "kdetest";
+
+namespace
+{
+
+struct Setup {
+    QString homeDir;
+    QString socketName;
+    QString plainFile;     // input for SIGN and ENCRYPT
+    QString encryptedFile; // input for DECRYPT_VERIFY_FILES, copied per client
+};
+
+struct Sample {
+    QString command;
+    qint64 nsecs;
+    bool failed;
+};
+
+bool runProcess(const QString &program, const QStringList &arguments, QByteArray *output = nullptr, const QByteArray &input = QByteArray())
+{
+    QProcess process;
+    process.setProcessChannelMode(output ? QProcess::SeparateChannels : QProcess::ForwardedErrorChannel);
+    process.start(program, arguments);
+    if (!process.waitForStarted()) {
+        qWarning("Could not start %s: %s", qPrintable(program), qPrintable(process.errorString()));
+        return false;
+    }
+    process.write(input);
+    process.closeWriteChannel();
+    if (!process.waitForFinished(60000) || process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
+        qWarning("%s %s failed", qPrintable(program), qPrintable(arguments.join(QLatin1Char(' '))));
+        return false;
+    }
+    if (output) {
+        *output = process.readAllStandardOutput();
+    }
+    return true;
+}
+
+QString findExecutable(const QString &name)
+{
+    const QString path = QStandardPaths::findExecutable(name);
+    return path.isEmpty() ? name : path;
+}
+
+// makes SIGN and ENCRYPT finish without anybody at the screen, as long as
+// the signer and the recipients can be resolved unambiguously
+bool writeKleopatraConfig(const QString &configDir)
+{
+    if (!QDir().mkpath(configDir)) {
+        qWarning("Could not create %s", qPrintable(configDir));
+        return false;
+    }
+    QFile conf(QDir(configDir).filePath(QStringLiteral("kleopatrarc")));
+    if (!conf.open(QIODevice::WriteOnly)
+        || conf.write("[EMailOperations]\n"
+                      "quick-sign-email=true\n"
+                      "quick-encrypt-email=true\n") < 0) {
+        qWarning("Could not write %s", qPrintable(conf.fileName()));
+        return false;
+    }
+    return true;
+}
+
+// imports the test keys into a new GNUPGHOME and makes signing possible
+// without a pinentry
+bool setUpGnuPGHome(Setup &setup)
+{
+    const QDir home(setup.homeDir);
+    {
+        QFile conf(home.filePath(QStringLiteral("gpg-agent.conf")));
+        if (!conf.open(QIODevice::WriteOnly) || conf.write("allow-preset-passphrase\nallow-loopback-pinentry\n") < 0) {
+            qWarning("Could not write %s", qPrintable(conf.fileName()));
+            return false;
+        }
+    }
+
+    const QString gpg = findExecutable(QStringLiteral("gpg"));
+    if (!runProcess(gpg, {QStringLiteral("--batch"), QStringLiteral("--import"),
+                          QStringLiteral(KLEO_TEST_DATADIR "/kleo-gpg_test_keys.asc")})) {
+        return false;
+    }
+
+    QByteArray listing;
+    if (!runProcess(gpg, {QStringLiteral("--batch"), QStringLiteral("--with-colons"), QStringLiteral("--with-keygrip"),
+                          QStringLiteral("--list-secret-keys")}, &listing)) {
+        return false;
+    }
+    QByteArray ownerTrust;
+    QStringList presetCommands;
+    const QByteArray hexPassphrase = QByteArray(TEST_KEY_PASSPHRASE).toHex().toUpper();
+    bool primary = false;
+    for (const QByteArray &line : listing.split('\n')) {
+        const QList<QByteArray> fields = line.split(':');
+        if (fields.size() < 10) {
+            continue;
+        }
+        if (fields[0] == "sec") {
+            primary = true;
+        } else if (fields[0] == "ssb") {
+            primary = false;
+        } else if (fields[0] == "fpr" && primary) {
+            ownerTrust += fields[9] + ":6:\n";
+        } else if (fields[0] == "grp") {
+            presetCommands.push_back(QStringLiteral("PRESET_PASSPHRASE %1 -1 %2")
+                                     .arg(QString::fromLatin1(fields[9]), QString::fromLatin1(hexPassphrase)));
+        }
+    }
+    if (ownerTrust.isEmpty() || presetCommands.empty()) {
+        qWarning("No secret test keys found after import");
+        return false;
+    }
+    if (!runProcess(gpg, {QStringLiteral("--batch"), QStringLiteral("--import-ownertrust")}, nullptr, ownerTrust)) {
+        return false;
+    }
+    presetCommands.push_back(QStringLiteral("/bye"));
+    if (!runProcess(findExecutable(QStringLiteral("gpg-connect-agent")), presetCommands)) {
+        return false;
+    }
+
+    setup.plainFile = QStringLiteral(KLEO_TEST_DATADIR "/test.data");
+    setup.encryptedFile = home.filePath(QStringLiteral("test.data.gpg"));
+    return runProcess(gpg, {QStringLiteral("--batch"), QStringLiteral("--pinentry-mode"), QStringLiteral("loopback"),
+                            QStringLiteral("--passphrase"), QLatin1String(TEST_KEY_PASSPHRASE),
+                            QStringLiteral("--recipient"), QLatin1String(TEST_KEY_EMAIL),
+                            QStringLiteral("--sign"), QStringLiteral("--encrypt"),
+                            QStringLiteral("--output"), setup.encryptedFile, setup.plainFile});
+}
+
+#ifndef HAVE_ASSUAN2
+assuan_error_t ignore_data(void *, const void *, size_t)
+#else
+gpg_error_t ignore_data(void *, const void *, size_t)
+#endif
+{
+    return 0;
+}
+
+#ifndef HAVE_ASSUAN2
+assuan_error_t ignore_status(void *, const char *)
+#else
+gpg_error_t ignore_status(void *, const char *)
+#endif
+{
+    return 0;
+}
+
+class Client
+{
+public:
+    Client(const Setup &setup, int id)
+        : m_setup(setup),
+          m_dir(QDir(setup.homeDir).filePath(QStringLiteral("client-%1").arg(id))),
+          m_ctx(nullptr)
+    {
+        QDir().mkpath(m_dir);
+    }
+
+    ~Client()
+    {
+        if (m_ctx) {
+#ifndef HAVE_ASSUAN2
+            assuan_disconnect(m_ctx);
+#else
+            assuan_release(m_ctx);
+#endif
+        }
+    }
+
+    bool connect()
+    {
+#ifndef HAVE_ASSUAN2
+        if (const gpg_error_t err = assuan_socket_connect_ext(&m_ctx, QFile::encodeName(m_setup.socketName).constData(), -1, ASSUAN_CONNECT_FLAGS)) {
+            m_ctx = nullptr;
+#else
+        if (!m_ctx) {
+            if (const gpg_error_t err = assuan_new(&m_ctx)) {
+                m_error = QString::fromLocal8Bit(Exception(err, "assuan_new").what());
+                return false;
+            }
+        }
+        if (const gpg_error_t err = assuan_socket_connect(m_ctx, QFile::encodeName(m_setup.socketName).constData(), -1, ASSUAN_CONNECT_FLAGS)) {
+#endif
+            m_error = QString::fromLocal8Bit(Exception(err, "assuan_socket_connect").what());
+            return false;
+        }
+        return true;
+    }
+
+    QString errorString() const
+    {
+        return m_error;
+    }
+
+    // runs one command with all of its setup, returns false on errors
+    bool run(const QString &command)
+    {
+        if (!transact("RESET")) {
+            return false;
+        }
+        if (command == QLatin1String("echo")) {
+            return transact("ECHO load test");
+        }
+        if (command == QLatin1String("sign")) {
+            return transact(std::string("SENDER --protocol=OpenPGP ") + TEST_KEY_EMAIL)
+                   && input(m_setup.plainFile)
+                   && output(QDir(m_dir).filePath(QStringLiteral("test.data.sig")))
+                   && transact("SIGN --protocol=OpenPGP --detached");
+        }
+        if (command == QLatin1String("encrypt")) {
+            return transact(std::string("RECIPIENT ") + TEST_KEY_EMAIL)
+                   && input(m_setup.plainFile)
+                   && output(QDir(m_dir).filePath(QStringLiteral("test.data.asc")))
+                   && transact("ENCRYPT --protocol=OpenPGP");
+        }
+        if (command == QLatin1String("decrypt-verify-files")) {
+            // the result is written next to the input, make sure the
+            // server doesn't ask whether to overwrite it
+            const QString file = QDir(m_dir).filePath(QStringLiteral("test.data.gpg"));
+            QFile::remove(QDir(m_dir).filePath(QStringLiteral("test.data")));
+            if (!QFile::exists(file) && !QFile::copy(m_setup.encryptedFile, file)) {
+                m_error = QStringLiteral("Could not copy %1").arg(m_setup.encryptedFile);
+                return false;
+            }
+            return transact("FILE " + hexencode(QFile::encodeName(file).toStdString()))
+                   && transact("DECRYPT_VERIFY_FILES");
+        }
+        m_error = QStringLiteral("Unknown command %1").arg(command);
+        return false;
+    }
+
+private:
+    bool transact(const std::string &line)
+    {
+        if (const gpg_error_t err = assuan_transact(m_ctx, line.c_str(), ignore_data, nullptr, nullptr, nullptr, ignore_status, nullptr)) {
+            m_error = QString::fromLocal8Bit(Exception(err, line).what());
+            return false;
+        }
+        return true;
+    }
+
+    bool input(const QString &fileName)
+    {
+#ifndef Q_OS_WIN32
+        const int fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY);
+        if (fd == -1) {
+            m_error = QStringLiteral("Could not open %1").arg(fileName);
+            return false;
+        }
+        const bool ok = sendFd(fd) && transact("INPUT FD");
+        ::close(fd);
+        return ok;
+#else
+        return transact("INPUT FILE=" + hexencode(QFile::encodeName(fileName).toStdString()));
+#endif
+    }
+
+    bool output(const QString &fileName)
+    {
+#ifndef Q_OS_WIN32
+        const int fd = ::open(QFile::encodeName(fileName).constData(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1) {
+            m_error = QStringLiteral("Could not open %1").arg(fileName);
+            return false;
+        }
+        const bool ok = sendFd(fd) && transact("OUTPUT FD");
+        ::close(fd);
+        return ok;
+#else
+        // OUTPUT FILE= only accepts existing files
+        QFile file(fileName);
+        file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        file.close();
+        return transact("OUTPUT FILE=" + hexencode(QFile::encodeName(fileName).toStdString()));
+#endif
+    }
+
+#ifndef Q_OS_WIN32
+    bool sendFd(int fd)
+    {
+        if (const gpg_error_t err = assuan_sendfd(m_ctx, fd)) {
+            m_error = QString::fromLocal8Bit(Exception(err, "assuan_sendfd").what());
+            return false;
+        }
+        return true;
+    }
+#endif
+
+private:
+    const Setup &m_setup;
+    const QString m_dir;
+    assuan_context_t m_ctx;
+    QString m_error;
+};
+
+bool waitForServer(const Setup &setup, QProcess &server, int timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < timeout) {
+        if (server.state() == QProcess::NotRunning) {
+            qWarning("Kleopatra exited prematurely");
+            return false;
+        }
+        Client client(setup, 0);
+        if (client.connect()) {
+            return true;
+        }
+        QThread::msleep(100);
+    }
+    qWarning("Kleopatra didn't start listening on %s", qPrintable(setup.socketName));
+    return false;
+}
+
+qint64 percentile(const std::vector<qint64> &sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const size_t rank = std::max<size_t>(1, size_t(std::ceil(p * sorted.size())));
+    return sorted[std::min(rank, sorted.size()) - 1];
+}
+
+void report(const QStringList &commands, const std::vector<Sample> &samples, qint64 totalNsecs)
+{
+    std::printf("%-22s %8s %8s %10s %10s %10s\n", "command", "count", "errors", "p50 [ms]", "p99 [ms]", "max [ms]");
+    for (const QString &command : commands) {
+        std::vector<qint64> latencies;
+        int errors = 0;
+        for (const Sample &sample : samples) {
+            if (sample.command != command) {
+                continue;
+            }
+            if (sample.failed) {
+                ++errors;
+            } else {
+                latencies.push_back(sample.nsecs);
+            }
+        }
+        std::sort(latencies.begin(), latencies.end());
+        std::printf("%-22s %8d %8d %10.2f %10.2f %10.2f\n", qPrintable(command), int(latencies.size()) + errors, errors,
+                    percentile(latencies, 0.5) / 1e6, percentile(latencies, 0.99) / 1e6,
+                    latencies.empty() ? 0.0 : latencies.back() / 1e6);
+    }
+    const double seconds = totalNsecs / 1e9;
+    std::printf("\n%d commands in %.2f s: %.1f commands/s\n", int(samples.size()), seconds,
+                seconds > 0 ? samples.size() / seconds : 0.0);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    const Kleo::WSAStarter _wsastarter;
+    QCoreApplication app(argc, argv);
+
+#ifndef HAVE_ASSUAN2
+    assuan_set_assuan_err_source(GPG_ERR_SOURCE_DEFAULT);
+#else
+    assuan_set_gpg_err_source(GPG_ERR_SOURCE_DEFAULT);
+#endif
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Load test for Kleopatra's UI server"));
+    parser.addHelpOption();
+    parser.addOptions({
+        {QStringLiteral("clients"), QStringLiteral("Number of concurrent clients."), QStringLiteral("n"), QStringLiteral("4")},
+        {QStringLiteral("iterations"), QStringLiteral("Number of times each client runs the commands."), QStringLiteral("n"), QStringLiteral("20")},
+        {QStringLiteral("commands"), QStringLiteral("Comma-separated list of the commands to run (echo, sign, encrypt, decrypt-verify-files)."),
+         QStringLiteral("list"), QStringLiteral("echo,sign,encrypt")},
+        {QStringLiteral("kleopatra"), QStringLiteral("The Kleopatra executable."), QStringLiteral("path"), QStringLiteral(KLEOPATRA_BINARY)},
+        {QStringLiteral("timeout"), QStringLiteral("Time to wait for the UI server to start, in ms."), QStringLiteral("ms"), QStringLiteral("30000")},
+        {QStringLiteral("command-timeout"), QStringLiteral("Time a single command may take before the run fails, in ms."), QStringLiteral("ms"), QStringLiteral("60000")},
+    });
+    parser.process(app);
+
+    const int numClients = std::max(1, parser.value(QStringLiteral("clients")).toInt());
+    const int numIterations = std::max(1, parser.value(QStringLiteral("iterations")).toInt());
+    const QStringList commands = parser.value(QStringLiteral("commands")).split(QLatin1Char(','), Qt::SkipEmptyParts);
+    const qint64 commandTimeout = std::max(1, parser.value(QStringLiteral("command-timeout")).toInt());
+
+    QTemporaryDir home;
+    if (!home.isValid()) {
+        qWarning("Could not create a temporary GNUPGHOME");
+        return 1;
+    }
+    Setup setup;
+    setup.homeDir = home.path();
+    setup.socketName = QDir(setup.homeDir).filePath(QStringLiteral("S.uiserver"));
+
+    // gpg, gpg-agent and Kleopatra all inherit this
+    qputenv("GNUPGHOME", QFile::encodeName(setup.homeDir));
+    if (!setUpGnuPGHome(setup)) {
+        return 1;
+    }
+
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    if (!env.contains(QStringLiteral("QT_QPA_PLATFORM"))) {
+        env.insert(QStringLiteral("QT_QPA_PLATFORM"), QStringLiteral("offscreen"));
+    }
+    // don't let the benchmark change the configuration of the user
+    const QString configDir = QDir(setup.homeDir).filePath(QStringLiteral("config"));
+    if (!writeKleopatraConfig(configDir)) {
+        return 1;
+    }
+    env.insert(QStringLiteral("XDG_CONFIG_HOME"), configDir);
+
+    QProcess server;
+    server.setProcessEnvironment(env);
+    server.setProcessChannelMode(QProcess::ForwardedChannels);
+    server.start(parser.value(QStringLiteral("kleopatra")),
+                 {QStringLiteral("--daemon"), QStringLiteral("--uiserver-socket"), setup.socketName});
+    if (!waitForServer(setup, server, parser.value(QStringLiteral("timeout")).toInt())) {
+        server.kill();
+        return 1;
+    }
+
+    std::vector<std::vector<Sample>> samples(numClients);
+    std::vector<QString> errors(numClients);
+    // the start of the running command of each client in ms of total, or -1
+    std::unique_ptr<std::atomic<qint64>[]> commandStarts(new std::atomic<qint64>[numClients]);
+    std::unique_ptr<std::atomic<int>[]> runningCommands(new std::atomic<int>[numClients]);
+    for (int i = 0; i < numClients; ++i) {
+        commandStarts[i] = -1;
+        runningCommands[i] = -1;
+    }
+    std::vector<std::unique_ptr<QThread>> threads;
+    QElapsedTimer total;
+    total.start();
+    for (int i = 0; i < numClients; ++i) {
+        threads.emplace_back(QThread::create([&setup, &commands, numIterations, i, &samples, &errors, &total, &commandStarts, &runningCommands]() {
+            Client client(setup, i + 1);
+            if (!client.connect()) {
+                errors[i] = client.errorString();
+                return;
+            }
+            QElapsedTimer timer;
+            for (int iteration = 0; iteration < numIterations; ++iteration) {
+                for (int c = 0; c < commands.size(); ++c) {
+                    const QString &command = commands[c];
+                    runningCommands[i] = c;
+                    commandStarts[i] = total.elapsed();
+                    timer.start();
+                    const bool ok = client.run(command);
+                    commandStarts[i] = -1;
+                    samples[i].push_back({command, timer.nsecsElapsed(), !ok});
+                    if (!ok && errors[i].isEmpty()) {
+                        errors[i] = client.errorString();
+                    }
+                }
+            }
+        }));
+        threads.back()->start();
+    }
+    // assuan_transact() doesn't time out, so a command waiting for input
+    // from the user would hang the run forever
+    bool timedOut = false;
+    for (const std::unique_ptr<QThread> &thread : threads) {
+        while (!thread->wait(100)) {
+            if (timedOut) {
+                continue;
+            }
+            const qint64 now = total.elapsed();
+            for (int i = 0; i < numClients; ++i) {
+                const qint64 start = commandStarts[i];
+                if (start >= 0 && now - start > commandTimeout) {
+                    std::fprintf(stderr, "client %d: %s did not finish within %lld ms\n", i + 1,
+                                 qPrintable(commands.value(runningCommands[i])), commandTimeout);
+                    timedOut = true;
+                }
+            }
+            if (timedOut) {
+                // makes the pending assuan_transact() calls fail
+                server.kill();
+            }
+        }
+    }
+    const qint64 totalNsecs = total.nsecsElapsed();
+
+    server.terminate();
+    if (!server.waitForFinished(5000)) {
+        server.kill();
+        server.waitForFinished();
+    }
+    runProcess(findExecutable(QStringLiteral("gpgconf")), {QStringLiteral("--kill"), QStringLiteral("all")});
+
+    std::vector<Sample> allSamples;
+    for (const std::vector<Sample> &clientSamples : samples) {
+        allSamples.insert(allSamples.end(), clientSamples.begin(), clientSamples.end());
+    }
+    report(commands, allSamples, totalNsecs);
+
+    bool failed = timedOut;
+    for (int i = 0; i < numClients; ++i) {
+        if (!errors[i].isEmpty()) {
+            std::fprintf(stderr, "client %d: first error: %s\n", i + 1, qPrintable(errors[i]));
+            failed = true;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    tests/test_keysearchindex.cpp
+
+    This file is part of Kleopatra's test suite.
+    SPDX-FileCopyrightText: 2021 g10 Code GmbH
+
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include <config-kleopatra.h>
+
+#include "kleo_test.h"
+
+#include <utils/indexedkeylistsortfilterproxymodel.h>
+#include <utils/keysearchindex.h>
+
+#include <Libkleo/KeyCache>
+#include <Libkleo/KeyListModel>
+#include <Libkleo/KeyListSortFilterProxyModel>
+
+#include <gpgme++/key.h>
+
+#include <QApplication>
+
+#include <algorithm>
+#include <memory>
+
+using namespace Kleo;
+
+// Checks that filtering with the index gives the same results as
+// filtering without it
+class KeySearchIndexTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    std::shared_ptr<KeyCache> mCache;
+    std::unique_ptr<AbstractKeyListModel> mModel;
+    std::unique_ptr<KeyListSortFilterProxyModel> mPlainProxy;
+    std::unique_ptr<IndexedKeyListSortFilterProxyModel> mIndexedProxy;
+
+    QStringList acceptedKeys(const QSortFilterProxyModel &proxy) const
+    {
+        QStringList result;
+        for (int row = 0, end = proxy.rowCount(); row != end; ++row) {
+            const GpgME::Key key = mModel->key(proxy.mapToSource(proxy.index(row, 0)));
+            result.push_back(QString::fromLatin1(key.primaryFingerprint()));
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    void compareWithPlainFilter(const QString &text)
+    {
+        mPlainProxy->setFilterFixedString(text);
+        mIndexedProxy->setStringFilter(text);
+        QCOMPARE(acceptedKeys(*mIndexedProxy), acceptedKeys(*mPlainProxy));
+    }
+
+    void addFilterTexts()
+    {
+        QTest::addColumn<QString>("text");
+
+        QTest::newRow("empty") << QString();
+        QTest::newRow("one character") << QStringLiteral("K");
+        QTest::newRow("two characters") << QStringLiteral("kl");
+        QTest::newRow("short words") << QStringLiteral("no se");
+        QTest::newRow("name") << QStringLiteral("Kleo Tester");
+        QTest::newRow("lower case name") << QStringLiteral("kleo tester");
+        QTest::newRow("upper case name") << QStringLiteral("KLEOPATRA EXPIRED");
+        QTest::newRow("mixed case email") << QStringLiteral("Bar@FOO.com");
+        QTest::newRow("words in any order") << QStringLiteral("key test");
+        QTest::newRow("words of different user IDs") << QStringLiteral("tester foo@bar.com");
+        QTest::newRow("long key ID") << QStringLiteral("F42057BBBB5298E0");
+        QTest::newRow("lower case key ID") << QStringLiteral("f42057bbbb5298e0");
+        QTest::newRow("key ID with 0x") << QStringLiteral("0xF42057BBBB5298E0");
+        QTest::newRow("short key ID with 0x") << QStringLiteral("0xbb5298e0");
+        QTest::newRow("key ID with spaces") << QStringLiteral("F420 57BB BB52 98E0");
+        QTest::newRow("fingerprint with spaces") << QStringLiteral("F9D7 E0C1 766D A749 CBD9  67E2 F420 57BB BB52 98E0");
+        QTest::newRow("partial fingerprint") << QStringLiteral("cbd967e2");
+        QTest::newRow("no match") << QStringLiteral("xyzzy");
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        mCache = KeyCache::mutableInstance();
+        // waits for the cache to be loaded
+        QVERIFY(!mCache->keys().empty());
+
+        mModel.reset(AbstractKeyListModel::createFlatKeyListModel());
+        mModel->setKeys(mCache->keys());
+        mPlainProxy.reset(new KeyListSortFilterProxyModel);
+        mPlainProxy->setSourceModel(mModel.get());
+        mIndexedProxy.reset(new IndexedKeyListSortFilterProxyModel);
+        mIndexedProxy->setSourceModel(mModel.get());
+
+        QTRY_VERIFY(!KeySearchIndex::instance().isBuilding());
+    }
+
+    void testIndexIsUsed()
+    {
+        QVERIFY(KeySearchIndex::instance().search(QStringLiteral("kleo tester")).isRestrictive());
+        QVERIFY(!KeySearchIndex::instance().search(QStringLiteral("kl")).isRestrictive());
+    }
+
+    void testFilter_data()
+    {
+        addFilterTexts();
+    }
+
+    void testFilter()
+    {
+        QFETCH(QString, text);
+        mPlainProxy->setFilterCaseSensitivity(Qt::CaseSensitive);
+        mIndexedProxy->setFilterCaseSensitivity(Qt::CaseSensitive);
+        compareWithPlainFilter(text);
+    }
+
+    void testCaseInsensitiveFilter_data()
+    {
+        addFilterTexts();
+    }
+
+    void testCaseInsensitiveFilter()
+    {
+        QFETCH(QString, text);
+        mPlainProxy->setFilterCaseSensitivity(Qt::CaseInsensitive);
+        mIndexedProxy->setFilterCaseSensitivity(Qt::CaseInsensitive);
+        compareWithPlainFilter(text);
+    }
+
+    void testRemovedAndAddedKey()
+    {
+        const GpgME::Key key = mCache->findByFingerprint("F9D7E0C1766DA749CBD967E2F42057BBBB5298E0");
+        QVERIFY(!key.isNull());
+        const QString fingerprint = QString::fromLatin1(key.primaryFingerprint());
+        const QString text = QStringLiteral("kleo tester");
+        mPlainProxy->setFilterCaseSensitivity(Qt::CaseInsensitive);
+        mIndexedProxy->setFilterCaseSensitivity(Qt::CaseInsensitive);
+
+        mCache->remove(key);
+        mModel->removeKey(key);
+        compareWithPlainFilter(text);
+        QVERIFY(!acceptedKeys(*mIndexedProxy).contains(fingerprint));
+
+        mCache->insert(key);
+        mModel->addKey(key);
+        compareWithPlainFilter(text);
+        QVERIFY(acceptedKeys(*mIndexedProxy).contains(fingerprint));
+    }
+};
+
+QTEST_KLEOMAIN(KeySearchIndexTest)
+
+#include "test_keysearchindex.moc"